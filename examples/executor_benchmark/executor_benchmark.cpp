@@ -0,0 +1,95 @@
+/// \file
+/// \brief Benchmark for task dispatch through the arpc executors.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "arpc/executor.h"
+#include "arpc/flag.h"
+#include "arpc/thread.h"
+
+struct result {
+  double tasks_per_second;
+  double p99_latency_us;
+};
+
+/// Run `num_tasks` empty tasks on a pool, submitted concurrently from
+/// `num_producers` threads, returning the throughput and the 99th percentile
+/// of the time between a task being submitted and starting to run.
+template <typename Pool>
+result run(unsigned int num_workers, int num_producers, int num_tasks) {
+  Pool pool(num_workers);
+  std::atomic<int> remaining = num_tasks;
+  std::vector<double> latencies_us(num_tasks);
+  arpc::flag done;
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<arpc::thread> producers;
+  for (int i = 0; i < num_producers; i++) {
+    producers.emplace_back([&, i]() {
+      for (int j = i; j < num_tasks; j += num_producers) {
+        pool.run([&remaining, &done, &latency_us(latencies_us[j]),
+                  submitted(std::chrono::steady_clock::now())]() {
+          latency_us = std::chrono::duration<double, std::micro>(
+                           std::chrono::steady_clock::now() - submitted)
+                           .count();
+          if (--remaining == 0) done.set();
+        });
+      }
+    });
+  }
+  for (auto& th : producers) th.join();
+  done.wait();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::sort(latencies_us.begin(), latencies_us.end());
+  return {num_tasks / std::chrono::duration<double>(elapsed).count(),
+          latencies_us[latencies_us.size() * 99 / 100]};
+}
+
+template <typename Pool>
+void report(const char* name, unsigned int num_workers, int num_producers,
+            int num_tasks) {
+  auto r = run<Pool>(num_workers, num_producers, num_tasks);
+  std::cout << name << ", " << num_producers << " producers, " << num_workers
+            << " workers: " << r.tasks_per_second << " tasks/s, p99 latency "
+            << r.p99_latency_us << " us" << std::endl;
+}
+
+// Usage: executor_benchmark [num_tasks] [num_workers] [max_producers]
+int main(int argc, char* argv[]) {
+  const int num_tasks = argc > 1 ? std::atoi(argv[1]) : 100000;
+  const unsigned int num_workers = argc > 2 ? std::atoi(argv[2]) : 4;
+  const int max_producers = argc > 3 ? std::atoi(argv[3]) : 8;
+
+  for (int num_producers = 1; num_producers <= max_producers;
+       num_producers *= 2) {
+    report<arpc::thread_pool>("thread_pool", num_workers, num_producers,
+                              num_tasks);
+    report<arpc::work_stealing_pool>("work_stealing_pool", num_workers,
+                                     num_producers, num_tasks);
+  }
+
+  return 0;
+}
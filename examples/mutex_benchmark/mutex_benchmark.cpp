@@ -0,0 +1,63 @@
+/// \file
+/// \brief Benchmark for arpc::mutex under varying contention.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "arpc/mutex.h"
+#include "arpc/thread.h"
+
+/// Time `num_iterations` lock/unlock pairs on each of `num_threads` threads
+/// sharing one mutex, returning the average time per pair in nanoseconds.
+double run(int num_threads, int num_iterations) {
+  arpc::mutex mu;
+  long counter = 0;  // NOLINT(runtime/int)
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<arpc::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&mu, &counter, num_iterations]() {
+      for (int j = 0; j < num_iterations; j++) {
+        std::scoped_lock lock(mu);
+        counter++;
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  return std::chrono::duration<double, std::nano>(elapsed).count() / counter;
+}
+
+// Usage: mutex_benchmark [num_iterations] [max_threads]
+int main(int argc, char* argv[]) {
+  const int num_iterations = argc > 1 ? std::atoi(argv[1]) : 100000;
+  const int max_threads = argc > 2 ? std::atoi(argv[2]) : 8;
+
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    std::cout << num_threads << " threads: " << run(num_threads, num_iterations)
+              << " ns per lock/unlock" << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,134 @@
+/// \file
+/// \brief Server goodput and latency under overload, with and without request
+/// scheduling.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "arpc/client.h"
+#include "arpc/context.h"
+#include "arpc/flag.h"
+#include "arpc/future.h"
+#include "arpc/interface.h"
+#include "arpc/result_holder.h"
+#include "arpc/server.h"
+
+/// A method taking a fixed time, so that the server's capacity is known.
+ARPC_INTERFACE(Work, (/* doesn't extend other interfaces */),
+               (  // Work for a millisecond and return the argument.
+                   ((int), work, (((int), value)))));
+
+struct WorkImpl : Work {
+  int work(int value) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return value;
+  }
+};
+
+// Usage: overload_benchmark [num_calls] [load_factor] [schedule]
+//
+// Sends `num_calls` requests at `load_factor` (default 2) times what the
+// server can handle. Half of them have a tight deadline and half a loose one.
+// With `schedule`, the server runs them in order of deadline and rejects those
+// that expired while queued, so more of them succeed and the tail latency of
+// those that do is lower than when they're run in arrival order.
+int main(int argc, char* argv[]) {
+  const int num_calls = argc > 1 ? std::atoi(argv[1]) : 4000;
+  const double load_factor = argc > 2 ? std::atof(argv[2]) : 2.0;
+  constexpr unsigned int num_workers = 2;
+  const auto tight_timeout = std::chrono::milliseconds(20);
+  const auto loose_timeout = std::chrono::milliseconds(200);
+
+  arpc::server_options options;
+  options.num_worker_threads = num_workers;
+  options.schedule_requests = argc > 3 && !std::strcmp(argv[3], "schedule");
+  arpc::server_object<WorkImpl> work;
+  arpc::server server(options, arpc::endpoint().port(9996));
+  server.register_object("work", work);
+  server.start();
+
+  arpc::client_connection client(arpc::endpoint().name("localhost").port(9996));
+  auto work_proxy = client.get_proxy<Work::async>("work");
+
+  // Warm up the connection and the worker threads.
+  work_proxy.work(0).first.get();
+
+  // Send the calls at a steady rate, and record when each one completes.
+  const auto interval =
+      std::chrono::duration<double>(1e-3 / num_workers / load_factor);
+  std::vector<double> latencies_ms(num_calls, -1);
+  std::atomic<int> remaining = num_calls;
+  arpc::flag done;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_calls; i++) {
+    std::this_thread::sleep_until(
+        start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    interval * i));
+    auto sent = std::chrono::steady_clock::now();
+
+    arpc::context ctx;
+    ctx.set_timeout(i % 2 ? loose_timeout : tight_timeout);
+    auto record = [&latencies_ms, &remaining, &done, i,
+                   sent](arpc::result_holder<int> result) {
+      try {
+        *result;
+        latencies_ms[i] = std::chrono::duration<double, std::milli>(
+                              std::chrono::steady_clock::now() - sent)
+                              .count();
+      } catch (...) {
+        // Timed out or rejected.
+      }
+      if (--remaining == 0) done.set();
+    };
+    work_proxy.work(i).first.on_complete(record);
+  }
+  done.wait();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  std::vector<double> ok_latencies_ms;
+  for (auto latency : latencies_ms) {
+    if (latency >= 0) ok_latencies_ms.push_back(latency);
+  }
+  std::sort(ok_latencies_ms.begin(), ok_latencies_ms.end());
+
+  std::cout << "scheduling: " << (options.schedule_requests ? "on" : "off")
+            << std::endl
+            << "calls: " << num_calls << std::endl
+            << "succeeded: " << ok_latencies_ms.size() << std::endl
+            << "goodput (calls/s): "
+            << ok_latencies_ms.size() /
+                   std::chrono::duration<double>(elapsed).count()
+            << std::endl;
+  if (!ok_latencies_ms.empty()) {
+    std::cout << "p50 latency (ms): "
+              << ok_latencies_ms[ok_latencies_ms.size() / 2] << std::endl
+              << "p99 latency (ms): "
+              << ok_latencies_ms[ok_latencies_ms.size() * 99 / 100]
+              << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,113 @@
+/// \file
+/// \brief Server methods returning futures, as in a proxy for another server.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "arpc/client.h"
+#include "arpc/future.h"
+#include "arpc/interface.h"
+#include "arpc/server.h"
+
+/// The interface of the backend, which takes a while to answer.
+ARPC_INTERFACE(Greeter, (/* doesn't extend other interfaces */),
+               (  // Return a salutation.
+                   ((std::string), say_hello_to,
+                    (((const std::string&), name)))));
+
+/// The interface of the frontend. Its method returns a future, so the server
+/// sends the response when the future completes rather than when the method
+/// returns. To clients it's the same as returning a `std::string`.
+ARPC_INTERFACE(AsyncGreeter, (/* doesn't extend other interfaces */),
+               (  // Return a salutation from the backend.
+                   ((arpc::future<std::string>), say_hello_to,
+                    (((const std::string&), name)))));
+
+using BackendProxy = decltype(std::declval<arpc::client_connection<>&>()
+                                  .get_proxy<Greeter::async>("greeter"));
+
+struct GreeterImpl : Greeter {
+  std::string say_hello_to(const std::string& name) override {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return "Hello " + name + "!";
+  }
+};
+
+/// Forwards each call to the backend without waiting for its response, so a
+/// single worker thread can have many calls in flight.
+struct AsyncGreeterImpl : AsyncGreeter {
+  explicit AsyncGreeterImpl(arpc::client_connection<>& backend)
+      : backend_(backend.get_proxy<Greeter::async>("greeter")) {}
+
+  arpc::future<std::string> say_hello_to(const std::string& name) override {
+    return backend_.say_hello_to(name).first;
+  }
+
+  BackendProxy backend_;
+};
+
+int main(int argc, char* argv[]) {
+  constexpr int num_calls = 10;
+
+  // The backend has enough workers to take all the calls at once.
+  arpc::server_options backend_options;
+  backend_options.num_worker_threads = num_calls;
+  arpc::server_object<GreeterImpl> greeter;
+  arpc::server backend(backend_options, arpc::endpoint().port(9998));
+  backend.register_object("greeter", greeter);
+  backend.start();
+
+  // The frontend has a single worker.
+  arpc::server_options frontend_options;
+  frontend_options.num_worker_threads = 1;
+  arpc::client_connection backend_client(
+      arpc::endpoint().name("localhost").port(9998));
+  arpc::server_object<AsyncGreeterImpl> async_greeter(backend_client);
+  arpc::server frontend(frontend_options, arpc::endpoint().port(9999));
+  frontend.register_object("greeter", async_greeter);
+  frontend.start();
+
+  // Make all the calls at once through the frontend.
+  arpc::client_connection client(arpc::endpoint().name("localhost").port(9999));
+  auto greeter_proxy = client.get_proxy<AsyncGreeter::async>("greeter");
+
+  auto start = std::chrono::steady_clock::now();
+  std::vector<arpc::future<std::string>> results;
+  for (int i = 0; i < num_calls; i++) {
+    results.push_back(
+        greeter_proxy.say_hello_to("caller " + std::to_string(i)).first);
+  }
+  for (auto& result : results) {
+    std::cout << result.get() << std::endl;
+  }
+
+  // The calls overlap in the backend even though the frontend has one worker.
+  std::cout << num_calls << " calls took "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - start)
+                   .count()
+            << " ms" << std::endl;
+
+  return 0;
+}
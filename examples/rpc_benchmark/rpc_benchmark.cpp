@@ -0,0 +1,126 @@
+/// \file
+/// \brief Loopback RPC benchmark reporting latency and per-call resources.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+#include "arpc/client.h"
+#include "arpc/future.h"
+#include "arpc/interface.h"
+#include "arpc/server.h"
+#include "arpc/uring.h"
+
+/// A minimal interface so that the measurements are dominated by the RPC
+/// machinery and not by the method itself.
+ARPC_INTERFACE(Bench, (/* doesn't extend other interfaces */),
+               (  // Return the argument.
+                   ((int), echo, (((int), value)))));
+
+struct BenchImpl : Bench {
+  int echo(int value) override { return value; }
+};
+
+/// Count the file descriptors currently open by the process.
+std::size_t count_fds() {
+  std::size_t count = 0;
+  if (DIR* dir = opendir("/proc/self/fd")) {
+    while (readdir(dir)) count++;
+    closedir(dir);
+  }
+  // Don't count ".", ".." and the descriptor of the directory itself.
+  return count > 3 ? count - 3 : 0;
+}
+
+// Usage: rpc_benchmark [num_calls] [num_in_flight] [uring] [inline]
+//
+// With `inline`, `echo` runs on the thread receiving the request.
+//
+// Run it under `strace -f -c` to also get the system call count per RPC.
+int main(int argc, char* argv[]) {
+  const int num_calls = argc > 1 ? std::atoi(argv[1]) : 10000;
+  const int num_in_flight = argc > 2 ? std::atoi(argv[2]) : 64;
+  arpc::object_options bench_options;
+  for (int i = 3; i < argc; i++) {
+    if (!std::strcmp(argv[i], "uring")) {
+      std::cout << "io_uring: "
+                << (arpc::uring::enable() ? "on" : "unavailable") << std::endl;
+    } else if (!std::strcmp(argv[i], "inline")) {
+      bench_options.run_inline = true;
+    }
+  }
+
+  arpc::server_object<BenchImpl> bench;
+  arpc::server server({/* default options */}, arpc::endpoint().port(9998));
+  server.register_object("bench", bench, bench_options);
+  server.start();
+
+  arpc::client_connection client(arpc::endpoint().name("localhost").port(9998));
+  auto bench_proxy = client.get_proxy<Bench>("bench");
+  auto async_bench_proxy = client.get_proxy<Bench::async>("bench");
+
+  // Warm up the connection and the worker threads.
+  bench_proxy.echo(0);
+
+  // Sequential round trips.
+  std::vector<double> latencies_us;
+  latencies_us.reserve(num_calls);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_calls; i++) {
+    auto call_start = std::chrono::steady_clock::now();
+    bench_proxy.echo(i);
+    latencies_us.push_back(std::chrono::duration<double, std::micro>(
+                               std::chrono::steady_clock::now() - call_start)
+                               .count());
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  std::sort(latencies_us.begin(), latencies_us.end());
+
+  std::cout << "calls: " << num_calls << std::endl
+            << "qps: "
+            << num_calls / std::chrono::duration<double>(elapsed).count()
+            << std::endl
+            << "p50 latency (us): " << latencies_us[latencies_us.size() / 2]
+            << std::endl
+            << "p99 latency (us): "
+            << latencies_us[latencies_us.size() * 99 / 100] << std::endl;
+
+  // Descriptors held while calls are in flight.
+  auto idle_fds = count_fds();
+  std::vector<arpc::future<int>> pending;
+  pending.reserve(num_in_flight);
+  for (int i = 0; i < num_in_flight; i++) {
+    pending.push_back(async_bench_proxy.echo(i).first);
+  }
+  auto busy_fds = count_fds();
+  for (auto& f : pending) f.get();
+
+  std::cout << "fds per in-flight call: "
+            << static_cast<double>(busy_fds - idle_fds) / num_in_flight
+            << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,111 @@
+/// \file
+/// \brief Server latency as the number of idle connections grows.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include <sys/resource.h>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+#include "arpc/address_resolver.h"
+#include "arpc/client.h"
+#include "arpc/interface.h"
+#include "arpc/server.h"
+#include "arpc/socket.h"
+#include "arpc/wait.h"
+
+/// A minimal interface so that the measurements are dominated by the server
+/// machinery and not by the method itself.
+ARPC_INTERFACE(Bench, (/* doesn't extend other interfaces */),
+               (  // Return the argument.
+                   ((int), echo, (((int), value)))));
+
+struct BenchImpl : Bench {
+  int echo(int value) override { return value; }
+};
+
+/// Raise the descriptor limit as far as allowed, and return it.
+std::size_t raise_fd_limit() {
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit)) return 1024;
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  getrlimit(RLIMIT_NOFILE, &limit);
+  return limit.rlim_cur;
+}
+
+// Usage: server_benchmark [max_idle_connections] [num_calls]
+//
+// Each idle connection costs two descriptors (both ends live in this process).
+// With the reactor dispatching events incrementally, the time per call should
+// stay flat as the number of idle connections grows.
+int main(int argc, char* argv[]) {
+  const std::size_t max_fds = raise_fd_limit();
+  std::size_t max_idle = argc > 1 ? std::atol(argv[1]) : 10000;
+  const int num_calls = argc > 2 ? std::atoi(argv[2]) : 5000;
+  // Keep some descriptors for the server, the client and the thread pool.
+  max_idle = std::min(max_idle, max_fds > 512 ? (max_fds - 512) / 2 : 0);
+
+  arpc::server_object<BenchImpl> bench;
+  // A deep backlog so that opening the idle connections doesn't overflow it.
+  arpc::server server({/* default options */}, arpc::endpoint().port(9997),
+                      /* reuse_addr */ true, /* non_blocking */ true,
+                      /* backlog */ 1024);
+  server.register_object("bench", bench);
+  server.start();
+
+  arpc::client_connection client(arpc::endpoint().name("localhost").port(9997));
+  auto bench_proxy = client.get_proxy<Bench>("bench");
+
+  auto addr_list = arpc::address_resolver::get().resolve(
+      arpc::endpoint().name("localhost").port(9997));
+  const auto& server_addr = *addr_list.begin();
+
+  std::cout << "idle connections, us per call" << std::endl;
+  std::vector<arpc::channel> idle;
+  idle.reserve(max_idle);
+  for (std::size_t target = 1;; target = std::min(target * 10, max_idle)) {
+    while (idle.size() < target) {
+      auto s = arpc::socket(server_addr);
+      s.connect(server_addr);
+      idle.push_back(std::move(s));
+    }
+    // Let the server accept the new connections before measuring.
+    bench_proxy.echo(0);
+    arpc::wait(arpc::timeout(std::chrono::milliseconds(100)));
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < num_calls; i++) {
+      bench_proxy.echo(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << idle.size() << ", "
+              << std::chrono::duration<double, std::micro>(elapsed).count() /
+                     num_calls
+              << std::endl;
+
+    if (target >= max_idle) break;
+  }
+
+  return 0;
+}
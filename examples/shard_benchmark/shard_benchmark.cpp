@@ -0,0 +1,111 @@
+/// \file
+/// \brief Server throughput as the number of shards grows.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "arpc/client.h"
+#include "arpc/interface.h"
+#include "arpc/server.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+
+/// A minimal interface so that the measurements are dominated by the server
+/// machinery and not by the method itself.
+ARPC_INTERFACE(Bench, (/* doesn't extend other interfaces */),
+               (  // Return the argument.
+                   ((int), echo, (((int), value)))));
+
+struct BenchImpl : Bench {
+  int echo(int value) override { return value; }
+};
+
+/// Run `num_clients` connections doing back-to-back calls for `duration`
+/// against a server with `num_shards` shards, returning the calls per second.
+double run(unsigned int num_shards, int num_clients,
+           std::chrono::milliseconds duration) {
+  const int port = 9900 + num_shards;
+
+  arpc::server_options options;
+  options.num_shards = num_shards;
+  arpc::server_object<BenchImpl> bench;
+  arpc::server server(options, arpc::endpoint().port(port),
+                      /* reuse_addr */ true, /* non_blocking */ true,
+                      /* backlog */ arpc::channel::default_backlog,
+                      /* reuse_port */ true);
+  server.register_object("bench", bench);
+  server.start();
+
+  std::vector<std::unique_ptr<arpc::client_connection<>>> clients;
+  for (int i = 0; i < num_clients; i++) {
+    clients.push_back(std::make_unique<arpc::client_connection<>>(
+        arpc::endpoint().name("localhost").port(port)));
+    // Warm up the connection.
+    clients.back()->get_proxy<Bench>("bench").echo(0);
+  }
+
+  std::atomic<bool> done = false;
+  std::atomic<long> calls = 0;  // NOLINT(runtime/int)
+  auto start = std::chrono::steady_clock::now();
+  std::vector<arpc::thread> threads;
+  for (auto& client : clients) {
+    threads.emplace_back([&done, &calls, &client]() {
+      auto proxy = client->get_proxy<Bench>("bench");
+      for (int i = 0; !done; i++) {
+        proxy.echo(i);
+        calls++;
+      }
+    });
+  }
+  arpc::wait(arpc::timeout(duration));
+  done = true;
+  for (auto& th : threads) th.join();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+
+  return calls / std::chrono::duration<double>(elapsed).count();
+}
+
+// Usage: shard_benchmark [max_shards] [num_clients] [duration_ms]
+//
+// Shards are tried in powers of two. Each one runs its own reactor and its
+// share of the worker threads, so the numbers only scale with enough cores
+// for the clients too.
+int main(int argc, char* argv[]) {
+  const unsigned int max_shards =
+      argc > 1 ? std::atoi(argv[1])
+               : std::max(arpc::thread::hardware_concurrency() / 2, 1U);
+  const int num_clients = argc > 2 ? std::atoi(argv[2]) : 32;
+  const std::chrono::milliseconds duration(argc > 3 ? std::atoi(argv[3])
+                                                    : 2000);
+
+  for (unsigned int num_shards = 1; num_shards <= max_shards;
+       num_shards *= 2) {
+    std::cout << num_shards << " shards, " << num_clients
+              << " clients: " << run(num_shards, num_clients, duration)
+              << " calls/s" << std::endl;
+  }
+
+  return 0;
+}
@@ -29,7 +29,7 @@
 #include <utility>
 #include "arpc/address.h"
 #include "arpc/future.h"
-#include "arpc/queue.h"
+#include "arpc/mpmc_queue.h"
 #include "arpc/singleton.h"
 #include "arpc/thread.h"
 
@@ -44,7 +44,7 @@ class address_resolver : public singleton<address_resolver> {
 
  private:
   friend class singleton<address_resolver>;
-  using queue_type = queue<std::pair<endpoint, promise<address_list>>>;
+  using queue_type = mpmc_queue<std::pair<endpoint, promise<address_list>>>;
 
   static constexpr queue_type::size_type queue_size = 16;
 
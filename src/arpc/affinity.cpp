@@ -0,0 +1,98 @@
+/// \file
+/// \brief Placement of threads on CPUs.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/affinity.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif  // __linux__
+
+#include "arpc/errors.h"
+
+namespace arpc {
+
+namespace {
+#ifdef __linux__
+void set_native_affinity(pthread_t handle, const cpu_set& cpus) {
+  if (cpus.empty()) return;
+
+  cpu_set_t native;
+  CPU_ZERO(&native);
+  for (auto cpu : cpus) {
+    if (cpu >= CPU_SETSIZE) throw errors::invalid_argument("CPU out of range");
+    CPU_SET(cpu, &native);
+  }
+  if (int err = pthread_setaffinity_np(handle, sizeof(native), &native)) {
+    // Usually EINVAL, for sets with no CPUs the thread is allowed to use.
+    throw_with_code<errors::invalid_argument>("Error setting thread affinity",
+                                              err);
+  }
+}
+
+cpu_set get_native_affinity(pthread_t handle) {
+  cpu_set_t native;
+  if (int err = pthread_getaffinity_np(handle, sizeof(native), &native)) {
+    throw_with_code<errors::io_error>("Error getting thread affinity", err);
+  }
+
+  cpu_set cpus;
+  for (unsigned int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (CPU_ISSET(cpu, &native)) cpus.insert(cpu);
+  }
+  return cpus;
+}
+#else   // __linux__
+void check_no_affinity(const cpu_set& cpus) {
+  if (!cpus.empty()) {
+    throw errors::not_implemented("Thread affinity is not supported");
+  }
+}
+#endif  // __linux__
+}  // namespace
+
+#ifdef __linux__
+void set_affinity(std::thread& t, const cpu_set& cpus) {
+  set_native_affinity(t.native_handle(), cpus);
+}
+
+void set_affinity(const cpu_set& cpus) {
+  set_native_affinity(pthread_self(), cpus);
+}
+
+cpu_set get_affinity(std::thread& t) {
+  return get_native_affinity(t.native_handle());
+}
+
+cpu_set get_affinity() { return get_native_affinity(pthread_self()); }
+#else   // __linux__
+void set_affinity(std::thread& t, const cpu_set& cpus) {
+  check_no_affinity(cpus);
+}
+
+void set_affinity(const cpu_set& cpus) { check_no_affinity(cpus); }
+
+cpu_set get_affinity(std::thread& t) { return {}; }
+
+cpu_set get_affinity() { return {}; }
+#endif  // __linux__
+
+}  // namespace arpc
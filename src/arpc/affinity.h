@@ -0,0 +1,52 @@
+/// \file
+/// \brief Placement of threads on CPUs.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_AFFINITY_H_
+#define ARPC_AFFINITY_H_
+
+#include <set>
+#include <thread>
+
+namespace arpc {
+
+/// Set of CPUs, by index.
+using cpu_set = std::set<unsigned int>;
+
+/// Restrict `t` to run on the CPUs in `cpus`. Does nothing if `cpus` is empty.
+///
+/// Only supported on Linux; elsewhere it throws `errors::not_implemented`
+/// unless `cpus` is empty.
+void set_affinity(std::thread& t, const cpu_set& cpus);
+
+/// Restrict the current thread to run on the CPUs in `cpus`. Does nothing if
+/// `cpus` is empty.
+void set_affinity(const cpu_set& cpus);
+
+/// \return The CPUs `t` may run on, or an empty set if it isn't known.
+cpu_set get_affinity(std::thread& t);
+
+/// \return The CPUs the current thread may run on, or an empty set if it
+///   isn't known.
+cpu_set get_affinity();
+
+}  // namespace arpc
+
+#endif  // ARPC_AFFINITY_H_
@@ -24,6 +24,10 @@
 namespace arpc {
 
 awaitable<void> never() { return awaitable<void>(-1); }
-awaitable<void> always() { return timeout(std::chrono::milliseconds::zero()); }
+awaitable<void> always() {
+  return timeout(std::chrono::milliseconds::zero()).ready_when([]() {
+    return true;
+  });
+}
 
 }  // namespace arpc
@@ -37,12 +37,21 @@ class awaitable {
 
  private:
   using react_fn_type = fu2::unique_function<return_type()>;
+  using ready_fn_type = fu2::unique_function<bool()>;
+  using fd_fn_type = fu2::unique_function<int()>;
 
  public:
   explicit awaitable(int fd, bool for_write = false)
       : fd_(fd), for_write_(for_write) {}
 
-  explicit awaitable(std::chrono::milliseconds timeout,
+  /// Awaitable on a descriptor returned by `fd_fn`, which is only called when
+  /// the descriptor is needed for polling, so that it can be created lazily.
+  template <typename FF,
+            typename = std::enable_if_t<std::is_invocable_r_v<int, FF>>>
+  explicit awaitable(FF&& fd_fn, bool for_write = false)
+      : fd_fn_(std::forward<FF>(fd_fn)), for_write_(for_write) {}
+
+  explicit awaitable(std::chrono::nanoseconds timeout,
                      bool for_polling = false)
       : timeout_(timeout), for_polling_(for_polling) {}
 
@@ -76,10 +85,28 @@ class awaitable {
                                       std::move(new_react_fn));
   }
 
+  /// Attach a function telling whether the awaited condition holds.
+  ///
+  /// `select()` checks it before calling the react function, so that
+  /// spurious wake-ups are discarded without having to throw
+  /// `errors::try_again` from the react function.
+  template <typename RF>
+  awaitable<return_type> ready_when(RF&& ready_fn) {
+    ready_fn_ = std::forward<RF>(ready_fn);
+    return std::move(*this);
+  }
+
   react_fn_type& get_react_fn() { return react_fn_; }
-  int get_fd() const { return fd_; }
+  ready_fn_type& get_ready_fn() { return ready_fn_; }
+  int get_fd() const {
+    if (fd_fn_) {
+      fd_ = fd_fn_();
+      fd_fn_ = fd_fn_type();
+    }
+    return fd_;
+  }
   bool for_write() const { return for_write_; }
-  std::chrono::milliseconds timeout() const { return timeout_; }
+  std::chrono::nanoseconds timeout() const { return timeout_; }
   bool for_polling() const { return for_polling_; }
 
  private:
@@ -89,15 +116,19 @@ class awaitable {
   template <typename OR>
   awaitable(awaitable<OR>&& old, react_fn_type&& react_fn)
       : react_fn_(std::move(react_fn)),
+        ready_fn_(std::move(old.ready_fn_)),
+        fd_fn_(std::move(old.fd_fn_)),
         fd_(old.fd_),
         for_write_(old.for_write_),
         timeout_(std::move(old.timeout_)),
         for_polling_(old.for_polling_) {}
 
   react_fn_type react_fn_ = []() { return; };
-  const int fd_ = -1;
+  ready_fn_type ready_fn_;
+  mutable fd_fn_type fd_fn_;
+  mutable int fd_ = -1;
   const bool for_write_ = false;
-  const std::chrono::milliseconds timeout_ = std::chrono::milliseconds(-1);
+  const std::chrono::nanoseconds timeout_ = std::chrono::nanoseconds(-1);
   const bool for_polling_ = false;
 };
 
@@ -107,21 +138,20 @@ awaitable<void> always();
 template <typename Rep, typename Period>
 awaitable<void> timeout(const std::chrono::duration<Rep, Period>& duration) {
   return awaitable<void>(
-      std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration));
 }
 
 template <typename Rep, typename Period>
 awaitable<void> polling(const std::chrono::duration<Rep, Period>& duration) {
   return awaitable<void>(
-      std::chrono::duration_cast<std::chrono::milliseconds>(duration), true);
+      std::chrono::duration_cast<std::chrono::nanoseconds>(duration), true);
 }
 
 template <typename Clock, typename Duration>
 awaitable<void> deadline(const std::chrono::time_point<Clock, Duration>& when) {
-  std::chrono::milliseconds delta =
-      std::chrono::duration_cast<std::chrono::milliseconds>(
-          when - std::chrono::system_clock::now());
-  return awaitable<void>(std::max(std::chrono::milliseconds::zero(), delta));
+  std::chrono::nanoseconds delta =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(when - Clock::now());
+  return awaitable<void>(std::max(std::chrono::nanoseconds::zero(), delta));
 }
 
 }  // namespace arpc
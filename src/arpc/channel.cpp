@@ -20,9 +20,12 @@
 ///   under the License.
 
 #include "arpc/channel.h"
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
+#include <exception>
+#include <memory>
 #include <utility>
 #ifndef ESP_PLATFORM
 #include <netinet/in.h>
@@ -31,7 +34,10 @@
 #include <sys/socket.h>
 #endif  // ESP_PLATFORM
 #include "arpc/errors.h"
+#include "arpc/poller.h"
+#include "arpc/result_holder.h"
 #include "arpc/select.h"
+#include "arpc/uring.h"
 
 namespace arpc {
 
@@ -51,6 +57,8 @@ channel::channel(channel&& fd) noexcept : fd_(-1) { swap(fd); }
 
 channel::~channel() noexcept {
   if (fd_ >= 0) {
+    poller::forget(fd_);
+    uring::forget(fd_);
     ::close(fd_);  // Ignore close-time errors to prevent exceptions.
   }
 }
@@ -88,13 +96,28 @@ std::size_t channel::read(void* buf, std::size_t len) {
 }
 
 std::size_t channel::maybe_read(void* buf, std::size_t len) {
+  auto num = try_read(buf, len);
+  if (!num) throw errors::try_again("Channel not ready for reading");
+  return *num;
+}
+
+std::optional<std::size_t> channel::try_read(void* buf, std::size_t len) {
+  if (auto num = uring::take_read(fd_, buf, len)) return num;
   auto num = ::read(fd_, buf, len);
+  if (num < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return std::nullopt;
   if (num < 0) throw_io_error("Error reading");
   if (num == 0) throw errors::eof("End of channel");
   return static_cast<std::size_t>(num);
 }
 
 awaitable<std::size_t> channel::async_read(void* buf, std::size_t len) {
+  if (auto* ring = uring::current()) {
+    return ring->read(fd_, buf, len).then([](int num) {
+      if (num < 0) throw_io_error("Error reading", -num);
+      if (num == 0) throw errors::eof("End of channel");
+      return static_cast<std::size_t>(num);
+    });
+  }
   return can_read().then([this, buf, len]() { return maybe_read(buf, len); });
 }
 
@@ -104,12 +127,39 @@ std::size_t channel::write(const void* buf, std::size_t len) {
 }
 
 std::size_t channel::maybe_write(const void* buf, std::size_t len) {
+  auto num = try_write(buf, len);
+  if (!num) throw errors::try_again("Channel not ready for writing");
+  return *num;
+}
+
+std::optional<std::size_t> channel::try_write(const void* buf,
+                                              std::size_t len) {
   auto num = ::write(fd_, buf, len);
+  if (num < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return std::nullopt;
   if (num < 0) throw_io_error("Error writing");
   return static_cast<std::size_t>(num);
 }
 
 awaitable<std::size_t> channel::async_write(const void* buf, std::size_t len) {
+  if (uring::current()) {
+    // With io_uring, waiting for writability goes through epoll and costs an
+    // extra system call. There's usually room to write, so try right away.
+    auto written = std::make_shared<result_holder<std::size_t>>();
+    return can_write()
+        .ready_when([this, buf, len, written]() {
+          if (!*written) {
+            try {
+              if (auto num = try_write(buf, len)) written->set_value(*num);
+            } catch (...) {
+              written->set_exception(std::current_exception());
+            }
+          }
+          return written->has_value();
+        })
+        .then([written]() {
+          return *std::exchange(*written, result_holder<std::size_t>());
+        });
+  }
   return can_write().then([this, buf, len]() { return maybe_write(buf, len); });
 }
 
@@ -182,6 +232,12 @@ channel& channel::listen(int backlog) {
 }
 
 awaitable<channel> channel::async_accept() {
+  if (auto* ring = uring::current()) {
+    return ring->accept(fd_, nullptr, nullptr).then([](int fd) {
+      if (fd < 0) throw_io_error("Accept error", -fd);
+      return channel(fd);
+    });
+  }
   return can_read().then(std::move([this]() { return maybe_accept(); }));
 }
 
@@ -191,12 +247,20 @@ channel channel::accept() {
 }
 
 channel channel::maybe_accept() {
+  if (int fd = uring::take_accept(fd_); fd >= 0) return channel(fd);
   channel c(::accept(fd_, nullptr, nullptr));
   if (!c) throw_io_error("Accept error");
   return c;
 }
 
 awaitable<channel> channel::async_accept(address& addr) {
+  if (auto* ring = uring::current()) {
+    return ring->accept(fd_, addr.address_data(), &addr.address_size())
+        .then([](int fd) {
+          if (fd < 0) throw_io_error("Accept error", -fd);
+          return channel(fd);
+        });
+  }
   return can_read().then(
       std::move([this, &addr]() { return maybe_accept(addr); }));
 }
@@ -207,6 +271,10 @@ channel channel::accept(address& addr) {
 }
 
 channel channel::maybe_accept(address& addr) {
+  if (int fd = uring::take_accept(fd_); fd >= 0) {
+    ::getpeername(fd, addr.address_data(), &addr.address_size());
+    return channel(fd);
+  }
   channel c(::accept(fd_, addr.address_data(), &addr.address_size()));
   if (!c) throw_io_error("Accept error");
   return c;
@@ -26,6 +26,7 @@
 #include <sys/types.h>
 #include <chrono>
 #include <cstddef>
+#include <optional>
 #include "arpc/address.h"
 #include "arpc/awaitable.h"
 
@@ -57,6 +58,8 @@ class channel {
   awaitable<void> can_write();
   std::size_t maybe_read(void* buf, std::size_t len);
   std::size_t maybe_write(const void* buf, std::size_t len);
+  std::optional<std::size_t> try_read(void* buf, std::size_t len);
+  std::optional<std::size_t> try_write(const void* buf, std::size_t len);
   awaitable<std::size_t> async_read(void* buf, std::size_t len);
   awaitable<std::size_t> async_write(const void* buf, std::size_t len);
 
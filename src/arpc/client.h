@@ -42,14 +42,16 @@
 #include "arpc/future.h"
 #include "arpc/interface.h"
 #include "arpc/message_defs.h"
+#include "arpc/mpmc_queue.h"
 #include "arpc/mutex.h"
 #include "arpc/object_name.h"
 #include "arpc/packet_protocols.h"
-#include "arpc/queue.h"
 #include "arpc/result_holder.h"
 #include "arpc/select.h"
+#include "arpc/semaphore.h"
 #include "arpc/string_adapters.h"
 #include "arpc/thread.h"
+#include "arpc/timer_wheel.h"
 #include "arpc/traits/type_traits.h"
 #include "arpc/type_hash.h"
 
@@ -76,8 +78,9 @@ class client_connection {
         : connection_(connection), name_(name), options_(options) {}
 
     template <auto mptr, typename... A>
-    std::pair<future<typename traits::member_function_pointer_traits<
-                  mptr>::return_type>,
+    std::pair<future<future_value_t<typename traits::
+                                        member_function_pointer_traits<
+                                            mptr>::return_type>>,
               rpc_defs::request_id_type>
     async_call(A&&... args) {
       // Propagate any timeout in client_options.
@@ -86,8 +89,10 @@ class client_connection {
         ctx.set_timeout(*options_.request_timeout);
       }
 
-      using return_type =
-          typename traits::member_function_pointer_traits<mptr>::return_type;
+      // Methods returning a future are called like any other, and their
+      // result arrives as that of the future.
+      using return_type = future_value_t<
+          typename traits::member_function_pointer_traits<mptr>::return_type>;
 
       // Get a serializable tuple with the args.
       using args_ref_tuple_type =
@@ -156,12 +161,20 @@ class client_connection {
     template <auto mptr, typename... A>
     typename traits::member_function_pointer_traits<mptr>::return_type call(
         A&&... args) {
+      using return_type =
+          typename traits::member_function_pointer_traits<mptr>::return_type;
+
       auto [result, req_id] = async_call<mptr>(std::forward<A>(args)...);
-      try {
-        return result.get();
-      } catch (const errors::cancelled&) {
-        connection_.cancel_request(req_id);
-        throw;
+      if constexpr (is_future_v<return_type>) {
+        // The caller waits on the future, if at all.
+        return std::move(result);
+      } else {
+        try {
+          return result.get();
+        } catch (const errors::cancelled&) {
+          connection_.cancel_request(req_id);
+          throw;
+        }
       }
     }
 
@@ -218,17 +231,24 @@ class client_connection {
 
   void gc() {
     std::scoped_lock lock(pending_mu_);
-    auto now = std::chrono::system_clock::now();
-    auto it = pending_.begin();
-    while (it != pending_.end()) {
-      if (it->second.deadline && *(it->second.deadline) < now) {
-        it->second.result.set_exception(std::make_exception_ptr(
-            errors::deadline_exceeded("Request timed out")));
-        it = pending_.erase(it);
-      } else {
-        ++it;
-      }
+    deadlines_.expire(deadline_clock::now(),
+                      [this](rpc_defs::request_id_type req_id) {
+                        auto it = pending_.find(req_id);
+                        if (it != pending_.end()) {
+                          it->second.result.set_exception(
+                              std::make_exception_ptr(errors::deadline_exceeded(
+                                  "Request timed out")));
+                          pending_.erase(it);
+                        }
+                      });
+  }
+
+  // Must be called with pending_mu_ held.
+  void erase_pending(typename pending_map_type::iterator it) {
+    if (it->second.deadline) {
+      deadlines_.remove(*it->second.deadline, it->first);
     }
+    pending_.erase(it);
   }
 
   rpc_defs::request_id_type new_request_id() {
@@ -242,7 +262,7 @@ class client_connection {
     if (it != pending_.end()) {
       it->second.result.set_exception(
           std::make_exception_ptr(errors::cancelled("Request cancelled")));
-      pending_.erase(it);
+      erase_pending(it);
     }
   }
 
@@ -251,7 +271,7 @@ class client_connection {
     auto it = pending_.find(req_id);
     if (it != pending_.end()) {
       it->second.result.set_value(std::move(response));
-      pending_.erase(it);
+      erase_pending(it);
     }
   }
 
@@ -262,6 +282,7 @@ class client_connection {
       p.second.result.set_exception(exc);
     }
     pending_.clear();
+    deadlines_.clear();
   }
 
   void send(std::string data) {
@@ -289,6 +310,7 @@ class client_connection {
       result = pending.result.get_future();
 
       if (pending.deadline) {
+        deadlines_.add(*pending.deadline, req_id);
         try {
           new_deadline_.maybe_put();
         } catch (const errors::try_again&) {
@@ -354,19 +376,9 @@ class client_connection {
     }
   }
 
-  std::optional<context::time_point> get_earliest_deadline() {
+  std::optional<deadline_clock::time_point> get_earliest_deadline() {
     std::scoped_lock lock(pending_mu_);
-    std::optional<context::time_point> earliest_deadline;
-    for (const auto& p : pending_) {
-      if (p.second.deadline) {
-        if (earliest_deadline) {
-          earliest_deadline = std::min(*earliest_deadline, *p.second.deadline);
-        } else {
-          earliest_deadline = *p.second.deadline;
-        }
-      }
-    }
-    return earliest_deadline;
+    return deadlines_.next_expiry();
   }
 
   void handle_timeouts_and_cancellations() {
@@ -409,9 +421,10 @@ class client_connection {
   flag ready_;
   connection_type connection_;
   pending_map_type pending_;
+  timer_wheel<rpc_defs::request_id_type, deadline_clock> deadlines_;
   daemon_thread receiver_;
-  queue<void> new_deadline_;
-  queue<rpc_defs::request_id_type> cancelled_requests_;
+  semaphore new_deadline_;
+  mpmc_queue<rpc_defs::request_id_type> cancelled_requests_;
   daemon_thread timeout_and_cancellation_handler_;
 };
 
@@ -0,0 +1,56 @@
+/// \file
+/// \brief Monotonic clock for deadlines, with an optional cached time source.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/clock.h"
+
+namespace arpc {
+
+namespace {
+struct coarse_state {
+  bool enabled = false;
+  deadline_clock::time_point cached;
+};
+
+thread_local coarse_state coarse;
+
+deadline_clock::time_point read_clock() noexcept {
+  return deadline_clock::time_point(
+      std::chrono::steady_clock::now().time_since_epoch());
+}
+}  // namespace
+
+deadline_clock::time_point deadline_clock::now() noexcept {
+  if (coarse.enabled) return coarse.cached;
+  return read_clock();
+}
+
+void deadline_clock::refresh() noexcept {
+  if (coarse.enabled) coarse.cached = read_clock();
+}
+
+deadline_clock::coarse_scope::coarse_scope() : was_coarse_(coarse.enabled) {
+  coarse.enabled = true;
+  coarse.cached = read_clock();
+}
+
+deadline_clock::coarse_scope::~coarse_scope() { coarse.enabled = was_coarse_; }
+
+}  // namespace arpc
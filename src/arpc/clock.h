@@ -0,0 +1,71 @@
+/// \file
+/// \brief Monotonic clock for deadlines, with an optional cached time source.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_CLOCK_H_
+#define ARPC_CLOCK_H_
+
+#include <chrono>
+
+namespace arpc {
+
+/// Clock for deadlines and timeouts.
+///
+/// It ticks with `std::chrono::steady_clock`, so deadlines don't fire early or
+/// stall when the wall clock is stepped. Wall-clock time never gets involved:
+/// deadlines only leave the process as the time left until them.
+///
+/// A thread can opt into a coarse mode with a `coarse_scope`, in which
+/// `now()` returns a cached time instead of reading the clock. The cache is
+/// updated by `refresh()`, which reactors call on every dispatch and fiber
+/// loops on every round, so threads running an event loop read the clock once
+/// per loop iteration instead of once per deadline computed. In exchange, time
+/// stands still for code that doesn't go back to its loop. Servers run their
+/// reactor and fiber threads in coarse mode with
+/// `server_options::coarse_clock`.
+class deadline_clock {
+ public:
+  using duration = std::chrono::steady_clock::duration;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<deadline_clock>;
+  static constexpr bool is_steady = true;
+
+  static time_point now() noexcept;
+
+  /// Update the cached time, if this thread is in coarse mode.
+  static void refresh() noexcept;
+
+  /// Put this thread in coarse mode while the scope is alive.
+  class coarse_scope {
+   public:
+    coarse_scope();
+    ~coarse_scope();
+    coarse_scope(const coarse_scope&) = delete;
+    coarse_scope& operator=(const coarse_scope&) = delete;
+
+   private:
+    bool was_coarse_;
+  };
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_CLOCK_H_
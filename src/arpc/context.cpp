@@ -38,13 +38,15 @@ context& context::top() {
 }
 
 context::context(context& parent, bool set_current, bool shield)
-    : set_current_(set_current), parent_(&parent), deadline_(std::nullopt) {
-  if (parent_) {
-    if (!shield) {
-      parent_->add_child(this);
-    }
-    deadline_ = parent_->deadline_;
-    data_ = parent_->data_;
+    : set_current_(set_current),
+      propagate_(!shield),
+      parent_(&parent),
+      deadline_(parent.deadline_.load(std::memory_order_acquire)),
+      data_(std::atomic_load(&parent.data_)) {
+  // The root context lives forever, so its children aren't counted, which
+  // also keeps all threads from contending on its counter.
+  if (parent_->parent_) {
+    parent_->num_children_.fetch_add(1, std::memory_order_relaxed);
   }
 
   if (set_current_) {
@@ -55,21 +57,43 @@ context::context(context& parent, bool set_current, bool shield)
 
 context::context(root)
     : set_current_(false),
+      propagate_(false),
       parent_(nullptr),
       previous_(nullptr),
-      deadline_(std::nullopt) {}
+      deadline_(no_deadline) {}
 
 context::~context() {
   cancel();
 
-  if (parent_) parent_->remove_child(this);
+  if (parent_) {
+    if (registered_) parent_->remove_child(this);
+    if (parent_->parent_) parent_->release_child();
+  }
   if (set_current_) current_ = previous_;
 
-  std::unique_lock lock(children_mu_);
-  child_detached_.wait(lock, [this]() { return children_.empty(); });
+  // With no children left none of them will touch this context again, and
+  // otherwise the last one to go says so under the lock.
+  if (num_children_.fetch_or(destroying, std::memory_order_acq_rel) != 0) {
+    std::unique_lock lock(children_mu_);
+    child_detached_.wait(lock, [this]() { return children_released_; });
+  }
+}
+
+void context::subscribe() {
+  std::call_once(subscribed_, [this]() {
+    if (propagate_ && parent_) {
+      parent_->subscribe();
+      parent_->add_child(this);
+      registered_ = true;
+    }
+  });
 }
 
 void context::add_child(context* child) {
+  // Pairs with the fence in cancel(): either it sees this, or this sees the
+  // context cancelled.
+  has_subscribers_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
   std::scoped_lock lock(children_mu_);
   children_.insert(child);
   if (cancelled_) {
@@ -78,47 +102,63 @@ void context::add_child(context* child) {
 }
 
 void context::remove_child(context* child) {
-  {
+  std::scoped_lock lock(children_mu_);
+  children_.erase(child);
+}
+
+void context::release_child() {
+  // Only the last child going while the destructor waits needs to wake it up,
+  // under the lock so that the destructor can't return before it's done.
+  if (num_children_.fetch_sub(1, std::memory_order_acq_rel) ==
+      (destroying | 1)) {
     std::scoped_lock lock(children_mu_);
-    children_.erase(child);
+    children_released_ = true;
+    child_detached_.notify_all();
   }
-  child_detached_.notify_one();
 }
 
 std::optional<context::time_point> context::deadline() const {
-  std::scoped_lock lock(data_mu_);
-  return deadline_;
+  auto when = deadline_.load(std::memory_order_acquire);
+  if (when == no_deadline) return std::nullopt;
+  return time_point(duration(when));
 }
 
 std::optional<context::duration> context::deadline_left() const {
-  std::scoped_lock lock(data_mu_);
-  if (deadline_) {
-    return std::chrono::duration_cast<duration>(
-        *deadline_ - std::chrono::system_clock::now());
+  if (auto when = deadline()) {
+    return std::chrono::duration_cast<duration>(*when - deadline_clock::now());
   } else {
     return std::nullopt;
   }
 }
 
 void context::cancel() {
+  // Set before looking at the children, so that add_child() either sees it
+  // or adds a child we'll cancel.
+  cancelled_.set();
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!has_subscribers_.load(std::memory_order_relaxed)) return;
   std::scoped_lock lock(children_mu_);
   for (auto* child : children_) {
     child->cancel();
   }
-  cancelled_.set();
 }
 
-bool context::is_cancelled() const { return cancelled_.is_set(); }
+bool context::is_cancelled() const {
+  for (auto* c = this; c; c = c->propagate_ ? c->parent_ : nullptr) {
+    if (c->cancelled_.is_set()) return true;
+  }
+  return false;
+}
 
 awaitable<void> context::wait_cancelled() {
+  subscribe();
   return cancelled_.async_wait().then(
       []() { throw errors::cancelled("Context is cancelled"); });
 }
 
 awaitable<void> context::wait_deadline() {
-  std::scoped_lock lock(data_mu_);
-  if (deadline_) {
-    return arpc::deadline(*deadline_).then([]() {
+  if (auto when = deadline()) {
+    return arpc::deadline(*when).then([]() {
       throw errors::deadline_exceeded("Deadline exceeded");
     });
   } else {
@@ -127,28 +167,44 @@ awaitable<void> context::wait_deadline() {
 }
 
 void context::set_deadline(time_point when) {
-  std::scoped_lock lock(data_mu_);
-  if (!deadline_ || *deadline_ > when) {
-    deadline_ = when;
+  // Only ever moves earlier.
+  auto ticks = when.time_since_epoch().count();
+  auto current = deadline_.load(std::memory_order_relaxed);
+  while (ticks < current &&
+         !deadline_.compare_exchange_weak(current, ticks,
+                                          std::memory_order_acq_rel)) {
   }
 }
 
 void context::set_timeout(duration timeout) {
   set_deadline(std::chrono::time_point_cast<context::duration>(
-      std::chrono::system_clock::now() + timeout));
+      deadline_clock::now() + timeout));
 }
 
 void context::reset_all() {
   std::scoped_lock lock(data_mu_);
-  data_.clear();
+  store_data(nullptr);
+}
+
+void context::store_data(std::shared_ptr<const data_map> data) {
+  std::atomic_store(&data_, std::move(data));
+}
+
+std::shared_ptr<context::data_map> context::copy_data() const {
+  return data_ ? std::make_shared<data_map>(*data_)
+               : std::make_shared<data_map>();
 }
 
 std::vector<std::shared_ptr<const dynamic_base_class>> context::data() const {
-  std::vector<std::shared_ptr<const dynamic_base_class>> res;
-  res.reserve(data_.size());
+  std::shared_ptr<const data_map> data;
   {
     std::scoped_lock lock(data_mu_);
-    for (auto it : data_) {
+    data = data_;
+  }
+  std::vector<std::shared_ptr<const dynamic_base_class>> res;
+  if (data) {
+    res.reserve(data->size());
+    for (auto it : *data) {
       res.push_back(it.second);
     }
   }
@@ -157,11 +213,16 @@ std::vector<std::shared_ptr<const dynamic_base_class>> context::data() const {
 
 void context::set_data(
     std::vector<std::shared_ptr<dynamic_base_class>>&& new_data) {
-  data_.clear();
-  for (auto it : new_data) {
-    data_[it->portable_class_name()] =
-        std::static_pointer_cast<const dynamic_base_class>(std::move(it));
+  std::shared_ptr<data_map> data;
+  if (!new_data.empty()) {
+    data = std::make_shared<data_map>();
+    for (auto it : new_data) {
+      (*data)[it->portable_class_name()] =
+          std::static_pointer_cast<const dynamic_base_class>(std::move(it));
+    }
   }
+  std::scoped_lock lock(data_mu_);
+  store_data(std::move(data));
 }
 
 shield::shield() : context(current(), true, true) {}
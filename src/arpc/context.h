@@ -23,9 +23,11 @@
 #define ARPC_CONTEXT_H_
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <cstdint>
+#include <limits>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -34,6 +36,7 @@
 #include <utility>
 #include <vector>
 #include "arpc/awaitable.h"
+#include "arpc/clock.h"
 #include "arpc/container/flat_map.h"
 #include "arpc/container/flat_set.h"
 #include "arpc/dynamic_base_class.h"
@@ -42,9 +45,16 @@
 
 namespace arpc {
 
+/// Cancellation and deadline scope, carrying arbitrary data along.
+///
+/// Contexts are cheap to create. Data is shared with the parent until either
+/// of them changes it, as an immutable map replaced on every change. A context
+/// checks whether it's cancelled by looking at its ancestors, and only
+/// registers with its parent to be notified of cancellations once someone
+/// waits on `wait_cancelled()`.
 class context : public serializable<context> {
  public:
-  ARPC_CUSTOM_SERIALIZATION_VERSION(1);
+  ARPC_CUSTOM_SERIALIZATION_VERSION(2);
 
   template <typename E>
   void save(E& e) const {
@@ -55,8 +65,7 @@ class context : public serializable<context> {
 
   template <typename D>
   void load(D& d) {
-    std::optional<duration> deadline_remaining;
-    d(deadline_remaining);
+    auto deadline_remaining = load_deadline_left(d);
 
     std::vector<std::shared_ptr<dynamic_base_class>> new_data;
     d(new_data);
@@ -71,9 +80,19 @@ class context : public serializable<context> {
     if (cancelled) cancel();
   }
 
-  using duration = std::chrono::milliseconds;
-  using time_point =
-      std::chrono::time_point<std::chrono::system_clock, duration>;
+  // Deadlines are kept on the monotonic deadline_clock, and only sent over
+  // the wire as the time left until them.
+  using duration = std::chrono::microseconds;
+  using time_point = std::chrono::time_point<deadline_clock, duration>;
+
+  /// Read just the time left until the deadline from a saved context, to
+  /// know it without loading the whole context.
+  template <typename D>
+  static std::optional<duration> load_deadline_left(D& d) {
+    std::optional<duration> deadline_remaining;
+    d(deadline_remaining);
+    return deadline_remaining;
+  }
 
   context(context&&) = default;
   explicit context(context& parent = current(), bool set_current = true,
@@ -104,13 +123,17 @@ class context : public serializable<context> {
   template <typename... V>
   void set(V&&... v) {
     std::scoped_lock lock(data_mu_);
-    (..., set_one(std::forward<V>(v)));
+    auto new_data = copy_data();
+    (..., set_one(*new_data, std::forward<V>(v)));
+    store_data(std::move(new_data));
   }
 
   template <typename... V>
   void reset() {
     std::scoped_lock lock(data_mu_);
-    (..., reset_one<V>());
+    auto new_data = copy_data();
+    (..., reset_one<V>(*new_data));
+    store_data(std::move(new_data));
   }
 
   void reset_all();
@@ -118,15 +141,19 @@ class context : public serializable<context> {
   template <typename T>
   const T& get() const {
     std::scoped_lock lock(data_mu_);
-    auto it = data_.find(portable_class_name<T>());
-    if (it != data_.end()) {
-      return static_cast<const T&>(*it->second);
-    } else {
-      return default_instance<T>();
+    if (data_) {
+      auto it = data_->find(portable_class_name<T>());
+      if (it != data_->end()) {
+        return static_cast<const T&>(*it->second);
+      }
     }
+    return default_instance<T>();
   }
 
  private:
+  using data_map = arpc::flat_map<std::string_view,
+                                  std::shared_ptr<const dynamic_base_class>>;
+
   struct root {};
   explicit context(root);
 
@@ -139,34 +166,60 @@ class context : public serializable<context> {
     return instance;
   }
 
+  std::shared_ptr<data_map> copy_data() const;
+  // Replace the data, holding `data_mu_`. Children snapshot it without the
+  // lock, so it's only ever stored atomically.
+  void store_data(std::shared_ptr<const data_map> data);
+
   template <typename T>
-  void set_one(T&& t) {
-    data_[t.portable_class_name()] =
+  static void set_one(data_map& data, T&& t) {
+    data[t.portable_class_name()] =
         std::make_shared<const std::decay_t<T>>(std::forward<T>(t));
   }
 
   template <typename T>
-  void reset_one() {
-    data_.erase(portable_class_name<T>());
+  static void reset_one(data_map& data) {
+    data.erase(portable_class_name<T>());
   }
 
+  void subscribe();
   void add_child(context* child);
   void remove_child(context* child);
+  void release_child();
 
   template <bool daemon>
   friend class base_thread;
+  // Switches the current context along with its fibers.
+  friend class fiber_loop;
 
   mutable std::mutex data_mu_;
   mutable std::mutex children_mu_;
   std::condition_variable child_detached_;
   bool set_current_;
+  // Whether the parent's cancellation applies to this context.
+  bool propagate_;
   context* parent_;
   context* previous_;
+  // Live child contexts, which the destructor waits for, plus `destroying`
+  // once it does.
+  static constexpr std::size_t destroying = ~(~std::size_t(0) >> 1);
+  std::atomic<std::size_t> num_children_ = 0;
+  // Set, under `children_mu_`, by the last child going while the destructor
+  // waits.
+  bool children_released_ = false;
+  // Whether `children_` ever had anyone, so that cancel() can skip the lock.
+  std::atomic<bool> has_subscribers_ = false;
+  // Children waiting on their cancellation, which need to be told about ours.
   arpc::flat_set<context*> children_;
+  std::once_flag subscribed_;
+  bool registered_ = false;
   flag cancelled_;
-  std::optional<time_point> deadline_;
-  arpc::flat_map<std::string_view, std::shared_ptr<const dynamic_base_class>>
-      data_;
+  // Ticks of the deadline, or `no_deadline`, in an atomic so that it can be
+  // read without locking.
+  static constexpr duration::rep no_deadline =
+      std::numeric_limits<duration::rep>::max();
+  std::atomic<duration::rep> deadline_;
+  std::shared_ptr<const data_map> data_;
   static thread_local context* current_;
 };
 
@@ -0,0 +1,575 @@
+/// \file
+/// \brief C++20 coroutines running on a reactor-backed event loop.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_COROUTINE_H_
+#define ARPC_COROUTINE_H_
+
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "arpc/coroutine.h needs C++20 coroutines (build with cpp_std=c++20)"
+#endif
+
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "arpc/awaitable.h"
+#include "arpc/context.h"
+#include "arpc/errors.h"
+#include "arpc/future.h"
+#include "arpc/reactor.h"
+#include "arpc/result_holder.h"
+#include "arpc/select.h"
+#include "arpc/timer_wheel.h"
+
+namespace arpc {
+
+template <typename T = void>
+class task;
+
+class event_loop;
+
+namespace detail {
+
+struct loop_timer;
+
+/// A coroutine suspended in an event loop until any of the awaitables
+/// registered for it completes.
+struct loop_wait {
+  std::coroutine_handle<> handle;
+  std::exception_ptr error;
+  bool done = false;
+  std::vector<reactor::key> armed;
+  std::vector<std::shared_ptr<loop_timer>> timers;
+};
+
+/// An awaitable with a timeout, kept in the event loop's timer wheel.
+struct loop_timer {
+  std::shared_ptr<loop_wait> wait;
+  std::chrono::steady_clock::time_point when;
+  awaitable<void> a;
+};
+
+inline thread_local event_loop* current_event_loop = nullptr;
+
+}  // namespace detail
+
+/// Single-threaded scheduler for coroutines.
+///
+/// `run()` resumes the coroutines of the loop in the calling thread. When they
+/// `co_await` an `awaitable<T>` (or an `arpc::future<T>`, or `co_select()`
+/// several of them) they are suspended, and the awaitables are armed in the
+/// loop's `reactor` (or kept in its timer wheel if they have a timeout) until
+/// one of them is ready. The thread only blocks when no coroutine can run, in
+/// a single `select()` on the reactor, so any number of coroutines can wait at
+/// the same time. To use more threads, run a loop in each one.
+///
+/// The loop honours the context of the thread running it: when the context is
+/// cancelled or its deadline expires, every waiting coroutine is resumed with
+/// `errors::cancelled` or `errors::deadline_exceeded`, as are any later waits
+/// during the same `run()`.
+///
+/// Awaitables backed by `uring` operations aren't supported.
+class event_loop {
+ public:
+  event_loop() = default;
+
+  ~event_loop() {
+    // Destroying the frames of the spawned tasks drops their waits.
+    auto detached = std::move(detached_);
+    for (auto* address : detached) {
+      std::coroutine_handle<>::from_address(address).destroy();
+    }
+  }
+
+  event_loop(const event_loop&) = delete;
+  event_loop& operator=(const event_loop&) = delete;
+
+  /// The loop running in this thread.
+  ///
+  /// \throw errors::invalid_state if there's none.
+  static event_loop& current() {
+    if (!detail::current_event_loop)
+      throw errors::invalid_state("Not running in an event loop");
+    return *detail::current_event_loop;
+  }
+
+  /// Run `t` (and any spawned tasks meanwhile) until it finishes.
+  ///
+  /// \return The result of `t`, or throw its exception.
+  template <typename T>
+  T run(task<T> t) {
+    scope s(this);
+    auto h = t.handle_;
+    ready_.push_back(h);
+    while (!h.done()) step();
+    return t.take_result();
+  }
+
+  /// Run the spawned tasks until all of them finish.
+  void run() {
+    scope s(this);
+    while (!detached_.empty()) step();
+  }
+
+  /// Start `t` concurrently. It only makes progress while the loop runs, and
+  /// any exception it throws is dropped.
+  void spawn(task<void> t);
+
+  /// Number of coroutines waiting for awaitables.
+  std::size_t size() const { return pending_.size(); }
+
+  /// Start waiting for `a` on behalf of `w`.
+  void add(const std::shared_ptr<detail::loop_wait>& w, awaitable<void> a) {
+    if (a.timeout() < std::chrono::nanoseconds::zero()) {
+      w->armed.push_back(reactor_.arm(std::move(a)));
+      return;
+    }
+
+    int fd = a.get_fd();
+    bool for_write = a.for_write();
+    auto when = std::chrono::steady_clock::now() + a.timeout();
+    auto t = std::make_shared<detail::loop_timer>(
+        detail::loop_timer{w, when, std::move(a)});
+    if (fd >= 0) {
+      // Also react as soon as the descriptor is ready.
+      w->armed.push_back(reactor_.arm(
+          awaitable<void>(fd, for_write)
+              .ready_when([t]() {
+                auto& ready_fn = t->a.get_ready_fn();
+                return !ready_fn || ready_fn();
+              })
+              .then([t]() { t->a.get_react_fn()(); })));
+    }
+    timers_.add(when, t);
+    w->timers.push_back(std::move(t));
+  }
+
+  /// Register a new wait for `handle`.
+  std::shared_ptr<detail::loop_wait> make_wait(std::coroutine_handle<> handle) {
+    auto w = std::make_shared<detail::loop_wait>();
+    w->handle = handle;
+    pending_.insert(w);
+    return w;
+  }
+
+  /// Finish `w`, resuming its coroutine.
+  void complete(const std::shared_ptr<detail::loop_wait>& w) {
+    abandon(w);
+    ready_.push_back(w->handle);
+  }
+
+  /// Finish `w` without resuming its coroutine.
+  void abandon(const std::shared_ptr<detail::loop_wait>& w) {
+    w->done = true;
+    for (const auto& k : w->armed) reactor_.disarm(k);
+    for (const auto& t : w->timers) timers_.remove(t->when, t);
+    w->armed.clear();
+    w->timers.clear();
+    pending_.erase(w);
+  }
+
+  /// Exception with which waits fail right away, if the loop's context was
+  /// cancelled or exceeded its deadline.
+  std::exception_ptr stopped() const {
+    if (!stopped_ && context::current().is_cancelled()) {
+      return std::make_exception_ptr(errors::cancelled("Context is cancelled"));
+    }
+    return stopped_;
+  }
+
+ private:
+  template <typename T>
+  friend class task;
+
+  // Makes a loop the current one for the thread.
+  class scope {
+   public:
+    explicit scope(event_loop* loop) : previous_(detail::current_event_loop) {
+      detail::current_event_loop = loop;
+      loop->stopped_ = nullptr;
+    }
+    ~scope() { detail::current_event_loop = previous_; }
+
+   private:
+    event_loop* previous_;
+  };
+
+  void step() {
+    if (!ready_.empty()) {
+      // Coroutines made ready while these run wait for the next step.
+      auto ready = std::move(ready_);
+      ready_.clear();
+      for (auto h : ready) h.resume();
+      return;
+    }
+
+    if (pending_.empty()) {
+      throw errors::invalid_state("Coroutines are waiting for nothing");
+    }
+
+    try {
+      if (auto next = timers_.next_expiry()) {
+        auto [dispatched, timed_out] =
+            select(reactor_.async_dispatch(), deadline(*next));
+        if (dispatched) *dispatched;
+      } else {
+        auto [dispatched] = select(reactor_.async_dispatch());
+        *dispatched;
+      }
+    } catch (const errors::cancelled&) {
+      fail_all(std::current_exception());
+    } catch (const errors::deadline_exceeded&) {
+      fail_all(std::current_exception());
+    }
+
+    timers_.expire(std::chrono::steady_clock::now(),
+                   [this](std::shared_ptr<detail::loop_timer> t) {
+                     if (t->wait->done) return;
+                     auto& a = t->a;
+                     try {
+                       if (!a.get_ready_fn() || a.get_ready_fn()()) {
+                         a.get_react_fn()();
+                         return;
+                       }
+                     } catch (const errors::try_again&) {
+                     }
+                     // Not ready after all: check again after the same time.
+                     t->when = std::chrono::steady_clock::now() + a.timeout();
+                     timers_.add(t->when, t);
+                   });
+  }
+
+  void fail_all(std::exception_ptr error) {
+    stopped_ = error;
+    auto pending = pending_;
+    for (const auto& w : pending) {
+      w->error = error;
+      complete(w);
+    }
+  }
+
+  reactor reactor_;
+  timer_wheel<std::shared_ptr<detail::loop_timer>> timers_;
+  std::vector<std::coroutine_handle<>> ready_;
+  std::unordered_set<std::shared_ptr<detail::loop_wait>> pending_;
+  std::unordered_set<void*> detached_;
+  std::exception_ptr stopped_;
+};
+
+namespace detail {
+
+template <typename T>
+class task_promise_base {
+ public:
+  template <typename U>
+  void return_value(U&& u) {
+    result_.set_value(std::forward<U>(u));
+  }
+
+ protected:
+  result_holder<T> result_;
+};
+
+template <>
+class task_promise_base<void> {
+ public:
+  void return_void() { result_.set_value(); }
+
+ protected:
+  result_holder<void> result_;
+};
+
+/// Awaiter for `co_select()`: suspends until any of the awaitables is ready,
+/// then returns the result of that one (as `select()` does).
+template <typename... Ts>
+class select_awaiter {
+ public:
+  using result_type = std::tuple<result_holder<Ts>...>;
+
+  explicit select_awaiter(awaitable<Ts>&&... inputs)
+      : inputs_(std::move(inputs)...) {}
+
+  select_awaiter(const select_awaiter&) = delete;
+  select_awaiter& operator=(const select_awaiter&) = delete;
+
+  ~select_awaiter() {
+    // The coroutine was destroyed while suspended.
+    if (wait_ && !wait_->done) loop_->abandon(wait_);
+  }
+
+  bool await_ready() {
+    loop_ = &event_loop::current();
+    if ((error_ = loop_->stopped())) return true;
+
+    // React right away to inputs ready in user space, as select() does.
+    return react_ready(std::index_sequence_for<Ts...>{});
+  }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    wait_ = loop_->make_wait(handle);
+    try {
+      arm(std::index_sequence_for<Ts...>{});
+    } catch (...) {
+      loop_->abandon(wait_);
+      throw;
+    }
+  }
+
+  result_type await_resume() {
+    if (error_) std::rethrow_exception(error_);
+    if (wait_ && wait_->error) std::rethrow_exception(wait_->error);
+    return std::move(results_);
+  }
+
+ private:
+  template <std::size_t i>
+  bool react_one() {
+    auto& a = std::get<i>(inputs_);
+    if (!a.get_ready_fn() || !a.get_ready_fn()()) return false;
+
+    using T = std::tuple_element_t<i, std::tuple<Ts...>>;
+    auto& res = std::get<i>(results_);
+    try {
+      if constexpr (std::is_void_v<T>) {
+        a.get_react_fn()();
+        res.set_value();
+      } else {
+        res.set_value(a.get_react_fn()());
+      }
+    } catch (const errors::try_again&) {
+      return false;
+    } catch (...) {
+      res.set_exception(std::current_exception());
+    }
+    return true;
+  }
+
+  template <std::size_t... ints>
+  bool react_ready(std::index_sequence<ints...>) {
+    return (... || react_one<ints>());
+  }
+
+  template <std::size_t i>
+  void arm_one() {
+    using T = std::tuple_element_t<i, std::tuple<Ts...>>;
+    auto* res = &std::get<i>(results_);
+    auto input = std::move(std::get<i>(inputs_))
+                     .decorate([loop = loop_, w = wait_, res](auto& react) {
+                       // Results are only stored while the awaiter, which
+                       // lives in the coroutine frame, still waits.
+                       if (w->done) return;
+                       try {
+                         if constexpr (std::is_void_v<T>) {
+                           react();
+                           res->set_value();
+                         } else {
+                           res->set_value(react());
+                         }
+                       } catch (const errors::try_again&) {
+                         throw;
+                       } catch (...) {
+                         res->set_exception(std::current_exception());
+                       }
+                       loop->complete(w);
+                     });
+    loop_->add(wait_, std::move(input));
+  }
+
+  template <std::size_t... ints>
+  void arm(std::index_sequence<ints...>) {
+    (..., arm_one<ints>());
+  }
+
+  std::tuple<awaitable<Ts>...> inputs_;
+  result_type results_;
+  event_loop* loop_ = nullptr;
+  std::shared_ptr<loop_wait> wait_;
+  std::exception_ptr error_;
+};
+
+/// Awaiter for a single awaitable, returning its value.
+template <typename T>
+class single_awaiter : public select_awaiter<T> {
+ public:
+  using select_awaiter<T>::select_awaiter;
+
+  T await_resume() {
+    return std::move(std::get<0>(select_awaiter<T>::await_resume())).value();
+  }
+};
+
+}  // namespace detail
+
+/// Lazily started coroutine returning a `T`.
+///
+/// A task starts running when it's `co_await`ed (from another coroutine) or
+/// given to an `event_loop`, and the awaiting coroutine resumes right when the
+/// task finishes. Destroying a task destroys its coroutine, even if suspended.
+template <typename T>
+class [[nodiscard]] task {
+ public:
+  class promise_type : public detail::task_promise_base<T> {
+   public:
+    task get_return_object() {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    auto final_suspend() noexcept {
+      struct final_awaiter {
+        bool await_ready() noexcept { return false; }
+        std::coroutine_handle<> await_suspend(
+            std::coroutine_handle<promise_type> h) noexcept {
+          auto continuation = h.promise().continuation_;
+          return continuation ? continuation : std::noop_coroutine();
+        }
+        void await_resume() noexcept {}
+      };
+      return final_awaiter{};
+    }
+
+    void unhandled_exception() {
+      this->result_.set_exception(std::current_exception());
+    }
+
+   private:
+    friend class task;
+
+    std::coroutine_handle<> continuation_;
+  };
+
+  task(task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (handle_) handle_.destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+
+  ~task() {
+    if (handle_) handle_.destroy();
+  }
+
+  auto operator co_await() && noexcept {
+    struct awaiter {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready() noexcept { return handle.done(); }
+      std::coroutine_handle<> await_suspend(
+          std::coroutine_handle<> continuation) noexcept {
+        handle.promise().continuation_ = continuation;
+        return handle;
+      }
+      T await_resume() {
+        return std::move(handle.promise().result_).value();
+      }
+    };
+    return awaiter{handle_};
+  }
+
+ private:
+  friend class event_loop;
+
+  explicit task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  T take_result() { return std::move(handle_.promise().result_).value(); }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+/// Coroutine counterpart of `select()`: wait until any of the awaitables is
+/// ready without blocking the thread, and return the result of that one.
+///
+/// The awaitables that weren't ready aren't reacted to.
+template <typename... Ts>
+detail::select_awaiter<Ts...> co_select(awaitable<Ts>&&... inputs) {
+  return detail::select_awaiter<Ts...>(std::move(inputs)...);
+}
+
+/// Wait for an awaitable from a coroutine running in an `event_loop`.
+template <typename T>
+detail::single_awaiter<T> operator co_await(awaitable<T>&& a) {
+  return detail::single_awaiter<T>(std::move(a));
+}
+
+/// Wait for a future from a coroutine running in an `event_loop`.
+template <typename T>
+detail::single_awaiter<T> operator co_await(future<T>& f) {
+  return detail::single_awaiter<T>(f.async_get());
+}
+
+template <typename T>
+detail::single_awaiter<T> operator co_await(future<T>&& f) {
+  return detail::single_awaiter<T>(f.async_get());
+}
+
+namespace detail {
+
+/// Coroutine driving a task spawned in an event loop, which destroys itself
+/// when it finishes.
+struct detached_task {
+  struct promise_type {
+    std::unordered_set<void*>* owner = nullptr;
+
+    ~promise_type() {
+      if (owner) {
+        owner->erase(
+            std::coroutine_handle<promise_type>::from_promise(*this).address());
+      }
+    }
+
+    detached_task get_return_object() {
+      return {std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() {}
+  };
+
+  std::coroutine_handle<promise_type> handle;
+};
+
+inline detached_task run_detached(task<void> t) { co_await std::move(t); }
+
+}  // namespace detail
+
+inline void event_loop::spawn(task<void> t) {
+  auto h = detail::run_detached(std::move(t)).handle;
+  h.promise().owner = &detached_;
+  detached_.insert(h.address());
+  ready_.push_back(h);
+}
+
+}  // namespace arpc
+
+#endif  // ARPC_COROUTINE_H_
@@ -20,53 +20,281 @@
 ///   under the License.
 
 #include "arpc/executor.h"
+#include "arpc/wait.h"
 
 namespace arpc {
 
-thread_pool::thread_pool(unsigned int num_worker_threads, int queue_size)
-    : pending_(queue_size == 0 ? num_worker_threads : queue_size),
-      slots_(num_worker_threads) {
-  threads_.reserve(num_worker_threads);
-  for (unsigned int i = 0; i < num_worker_threads; i++) {
-    threads_.emplace_back([this]() {
-      while (true) {
-        promise<fn_type> fn_promise;
-        future<fn_type> fn_future = fn_promise.get_future();
-        request_work(std::move(fn_promise));
-        auto f = fn_future.get();
-        try {
-          f();
-        } catch (...) {
-          // Log the exception?
-        }
-      }
-    });
-  }
-}
-
-void thread_pool::request_work(promise<fn_type> slot) {
+namespace {
+// Pool and worker index of the current thread, if it's a pool worker.
+thread_local const void* current_pool = nullptr;
+thread_local std::size_t current_worker = 0;
+
+// Pin worker `i` to `worker_cpus[i % worker_cpus.size()]`.
+void pin_workers(std::vector<daemon_thread>& threads,
+                 const std::vector<cpu_set>& worker_cpus) {
+  if (worker_cpus.empty()) return;
+  for (std::size_t i = 0; i < threads.size(); i++) {
+    set_affinity(threads[i], worker_cpus[i % worker_cpus.size()]);
+  }
+}
+
+std::vector<cpu_set> get_affinities(std::vector<daemon_thread>& threads) {
+  std::vector<cpu_set> result;
+  result.reserve(threads.size());
+  for (auto& t : threads) result.push_back(get_affinity(t));
+  return result;
+}
+
+// xorshift64, to pick stealing victims.
+std::uint64_t next_random(std::uint64_t& state) {
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+}  // namespace
+
+thread_pool::thread_pool(unsigned int num_worker_threads, int queue_size,
+                         const std::vector<cpu_set>& worker_cpus)
+    : worker_cpus_(worker_cpus), slots_(num_worker_threads) {
+  if (queue_size >= 0) {
+    queue_slots_.emplace(queue_size == 0 ? num_worker_threads : queue_size);
+  }
+  start(num_worker_threads);
+}
+
+thread_pool::thread_pool(const adaptive_options& options, int queue_size,
+                         const std::vector<cpu_set>& worker_cpus)
+    : adaptive_(options),
+      worker_cpus_(worker_cpus),
+      slots_(options.max_threads) {
+  if (options.max_threads == 0 || options.min_threads > options.max_threads) {
+    throw errors::invalid_argument("Invalid thread pool size bounds");
+  }
+  if (queue_size >= 0) {
+    queue_slots_.emplace(queue_size == 0 ? options.max_threads : queue_size);
+  }
+  start(options.min_threads);
+}
+
+thread_pool::~thread_pool() { stop(); }
+
+std::vector<cpu_set> thread_pool::worker_affinity() {
+  std::scoped_lock lock(mu_);
+  std::vector<cpu_set> result;
+  result.reserve(threads_.size());
+  for (auto& [id, t] : threads_) result.push_back(get_affinity(t));
+  return result;
+}
+
+thread_pool::stats thread_pool::get_stats() {
+  std::scoped_lock lock(mu_);
+  stats result = stats_;
+  result.num_threads = threads_.size();
+  result.num_idle = idle_.size();
+  result.queue_size = queued_.size();
+  return result;
+}
+
+void thread_pool::start(unsigned int num_worker_threads) {
+  try {
+    std::scoped_lock lock(mu_);
+    for (unsigned int i = 0; i < num_worker_threads; i++) add_worker();
+  } catch (...) {
+    stop();
+    throw;
+  }
+  if (adaptive_) monitor_ = daemon_thread(&thread_pool::monitor, this);
+}
+
+void thread_pool::submit(fn_type fn) {
+  // As with work_stealing_pool, only functions from outside of the pool count
+  // towards queue_size: workers blocked on a full queue could leave nobody to
+  // drain it.
+  bool counted = current_pool != this && queue_slots_;
+  if (counted) queue_slots_->put();
+
+  // Idle workers park their slots under the lock, so either one is idle now
+  // or it'll find the function in the queue.
+  std::scoped_lock lock(mu_);
+  if (auto slot = slots_.try_get()) {
+    idle_.pop_front();
+    if (counted) queue_slots_->try_get();
+    slot->set_value(std::move(fn));
+    return;
+  }
+  pending_.maybe_put(std::move(fn));
+  queued_.push_back({deadline_clock::now(), counted});
+  if (adaptive_) {
+    work_queued_.set();
+    grow();
+  }
+}
+
+void thread_pool::work(std::size_t id) {
+  current_pool = this;
+  {
+    std::scoped_lock lock(mu_);
+    num_starting_--;
+  }
+  while (true) {
+    promise<fn_type> fn_promise;
+    future<fn_type> fn_future = fn_promise.get_future();
+    request_work(id, std::move(fn_promise));
+    auto f = fn_future.get();
+    // An empty function means the worker was removed by shrink().
+    if (!f) return;
+    try {
+      f();
+    } catch (...) {
+      // Log the exception?
+    }
+  }
+}
+
+void thread_pool::request_work(std::size_t id, promise<fn_type> slot) {
   while (true) {
     auto [have_pending_fn, have_slot_space] =
         select(pending_.can_get(), slots_.can_put());
-    try {
+    // Decide on the current state under the lock rather than on what select()
+    // saw, which submit() may have changed meanwhile.
+    std::scoped_lock lock(mu_);
+    if (auto fn = pending_.try_get()) {
+      auto [since, counted] = queued_.front();
+      queued_.pop_front();
+      if (counted) queue_slots_->try_get();
+      auto wait = deadline_clock::now() - since;
+      stats_.num_queued++;
+      stats_.total_queue_wait += wait;
+      stats_.max_queue_wait = std::max(stats_.max_queue_wait, wait);
+      slot.set_value(std::move(*fn));
+      return;
+    }
+    // try_put() only moves from slot if it succeeds.
+    if (slots_.try_put(std::move(slot))) {
+      idle_.push_back({id, deadline_clock::now()});
+      return;
+    }
+  }
+}
+
+void thread_pool::add_worker() {
+  auto id = next_id_++;
+  auto& t = threads_[id];
+  t = daemon_thread(&thread_pool::work, this, id);
+  num_starting_++;
+  if (!worker_cpus_.empty()) {
+    set_affinity(t, worker_cpus_[id % worker_cpus_.size()]);
+  }
+}
+
+void thread_pool::grow() {
+  // Workers still starting up will take care of as many queued functions.
+  if (queued_.size() <= num_starting_ ||
+      threads_.size() >= adaptive_->max_threads ||
+      deadline_clock::now() - queued_.front().since <
+          adaptive_->max_queue_wait) {
+    return;
+  }
+  add_worker();
+  stats_.num_added++;
+}
+
+void thread_pool::shrink(std::vector<daemon_thread>& removed) {
+  auto now = deadline_clock::now();
+  // The slots are used in FIFO order, so the front one has been idle longest.
+  while (!idle_.empty() && threads_.size() > adaptive_->min_threads &&
+         now - idle_.front().since >= adaptive_->idle_timeout) {
+    auto id = idle_.front().id;
+    idle_.pop_front();
+    slots_.try_get()->set_value(fn_type());
+    auto it = threads_.find(id);
+    removed.push_back(std::move(it->second));
+    threads_.erase(it);
+    stats_.num_removed++;
+  }
+}
+
+void thread_pool::monitor() {
+  while (true) {
+    bool queued;
+    std::vector<daemon_thread> removed;
+    {
       std::scoped_lock lock(mu_);
-      if (have_pending_fn) {
-        *have_pending_fn;
-        slot.set_value(pending_.maybe_get());
-        return;
-      }
-      if (have_slot_space) {
-        *have_slot_space;
-        slots_.maybe_put(std::move(slot));
-        return;
-      }
-    } catch (const errors::try_again&) {
-      // Just try again.
+      grow();
+      shrink(removed);
+      queued = !queued_.empty();
+      if (!queued) work_queued_.reset();
     }
+    // The removed workers exit right away, without taking the lock.
+    for (auto& t : removed) t.join();
+
+    // Only poll for waiting functions while there are any.
+    if (queued) {
+      wait(timeout(adaptive_->max_queue_wait));
+    } else {
+      auto [work_queued, timed_out] =
+          select(work_queued_.async_wait(), timeout(adaptive_->idle_timeout));
+    }
+  }
+}
+
+void thread_pool::stop() {
+  if (monitor_.joinable()) {
+    monitor_.get_context().cancel();
+    monitor_.join();
+  }
+  // Workers may need the lock to notice that they're cancelled, so it can't
+  // be held here. Nothing else changes threads_ once the monitor is gone.
+  for (auto& [id, t] : threads_) {
+    t.get_context().cancel();
+  }
+  for (auto& [id, t] : threads_) {
+    t.join();
   }
 }
 
-thread_pool::~thread_pool() {
+work_stealing_pool::work_stealing_pool(
+    unsigned int num_worker_threads, int queue_size,
+    const std::vector<cpu_set>& worker_cpus) {
+  num_worker_threads = std::max(num_worker_threads, 1U);
+  if (queue_size >= 0) {
+    shared_slots_.emplace(queue_size == 0 ? num_worker_threads : queue_size);
+  }
+  workers_.reserve(num_worker_threads);
+  for (unsigned int i = 0; i < num_worker_threads; i++) {
+    workers_.push_back(
+        std::make_unique<worker>(0x9e3779b97f4a7c15ULL * (i + 1)));
+  }
+  threads_.reserve(num_worker_threads);
+  for (unsigned int i = 0; i < num_worker_threads; i++) {
+    threads_.emplace_back([this, i]() { work(i); });
+  }
+  try {
+    pin_workers(threads_, worker_cpus);
+  } catch (...) {
+    stop();
+    throw;
+  }
+}
+
+work_stealing_pool::~work_stealing_pool() {
+  stop();
+
+  // Drop the functions that didn't get to run.
+  for (auto& w : workers_) {
+    while (auto* fn = w->deque.pop()) delete fn;
+    for (auto& entry : w->inbox) delete entry.first;
+  }
+  for (auto* fn : shared_) delete fn;
+}
+
+std::vector<cpu_set> work_stealing_pool::worker_affinity() {
+  return get_affinities(threads_);
+}
+
+void work_stealing_pool::stop() {
+  stopping_ = true;
   for (auto& t : threads_) {
     t.get_context().cancel();
   }
@@ -75,4 +303,143 @@ thread_pool::~thread_pool() {
   }
 }
 
+void work_stealing_pool::submit(std::unique_ptr<fn_type> fn) {
+  if (current_pool == this) {
+    workers_[current_worker]->deque.push(fn.release());
+  } else {
+    if (shared_slots_) shared_slots_->put();
+    std::scoped_lock lock(shared_mu_);
+    shared_.push_back(fn.release());
+    shared_size_++;
+  }
+  notify();
+}
+
+void work_stealing_pool::submit_to(std::size_t index,
+                                   std::unique_ptr<fn_type> fn) {
+  // As with run(), only functions from outside of the pool count towards
+  // queue_size.
+  bool counted = current_pool != this && shared_slots_;
+  if (counted) shared_slots_->put();
+
+  auto& w = *workers_[index];
+  {
+    std::scoped_lock lock(w.inbox_mu);
+    w.inbox.emplace_back(fn.release(), counted);
+    w.inbox_size++;
+  }
+  notify(w);
+}
+
+void work_stealing_pool::work(std::size_t index) {
+  current_pool = this;
+  current_worker = index;
+  while (!stopping_.load(std::memory_order_relaxed)) {
+    std::unique_ptr<fn_type> fn(find_work(index));
+    if (!fn) {
+      park(index);
+      continue;
+    }
+    try {
+      (*fn)();
+    } catch (...) {
+      // Log the exception?
+    }
+  }
+}
+
+work_stealing_pool::fn_type* work_stealing_pool::find_work(std::size_t index) {
+  auto& self = *workers_[index];
+  // Functions in the inbox can't go anywhere else, so they go first.
+  if (auto* fn = take_inbox(self)) return fn;
+  if (auto* fn = self.deque.pop()) return fn;
+  if (auto* fn = take_shared()) return fn;
+
+  auto n = workers_.size();
+  auto first = next_random(self.rng) % n;
+  for (std::size_t i = 0; i < n; i++) {
+    auto victim = (first + i) % n;
+    if (victim == index) continue;
+    if (auto* fn = workers_[victim]->deque.steal()) return fn;
+  }
+  return nullptr;
+}
+
+work_stealing_pool::fn_type* work_stealing_pool::take_inbox(worker& w) {
+  if (w.inbox_size.load(std::memory_order_relaxed) == 0) return nullptr;
+  std::pair<fn_type*, bool> entry;
+  {
+    std::scoped_lock lock(w.inbox_mu);
+    if (w.inbox.empty()) return nullptr;
+    entry = w.inbox.front();
+    w.inbox.pop_front();
+    w.inbox_size--;
+  }
+  if (entry.second) shared_slots_->try_get();
+  return entry.first;
+}
+
+work_stealing_pool::fn_type* work_stealing_pool::take_shared() {
+  if (shared_size_.load(std::memory_order_relaxed) == 0) return nullptr;
+  fn_type* fn;
+  {
+    std::scoped_lock lock(shared_mu_);
+    if (shared_.empty()) return nullptr;
+    fn = shared_.front();
+    shared_.pop_front();
+    shared_size_--;
+  }
+  if (shared_slots_) shared_slots_->try_get();
+  return fn;
+}
+
+bool work_stealing_pool::has_work(std::size_t index) const {
+  // Other workers' inboxes don't count, since this one can't take from them.
+  if (workers_[index]->inbox_size.load() != 0) return true;
+  if (shared_size_.load() != 0) return true;
+  for (const auto& w : workers_) {
+    if (!w->deque.empty()) return true;
+  }
+  return false;
+}
+
+void work_stealing_pool::park(std::size_t index) {
+  auto& w = *workers_[index];
+  w.sleeping = true;
+  num_sleeping_++;
+  // Pairs with the fences in notify(): either this sees the new work, or
+  // notify() sees this worker sleeping.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (has_work(index) || stopping_) {
+    if (w.sleeping.exchange(false)) num_sleeping_--;
+    return;
+  }
+  w.wake.wait();
+  w.wake.reset();
+}
+
+void work_stealing_pool::notify() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (num_sleeping_.load() == 0) return;
+
+  auto n = workers_.size();
+  auto first = next_wake_++ % n;
+  for (std::size_t i = 0; i < n; i++) {
+    auto& w = *workers_[(first + i) % n];
+    if (w.sleeping.load() && w.sleeping.exchange(false)) {
+      num_sleeping_--;
+      w.wake.set();
+      return;
+    }
+  }
+}
+
+void work_stealing_pool::notify(worker& w) {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (w.sleeping.load() && w.sleeping.exchange(false)) {
+    num_sleeping_--;
+    w.wake.set();
+  }
+}
+
 }  // namespace arpc
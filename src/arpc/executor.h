@@ -23,15 +23,27 @@
 #define ARPC_EXECUTOR_H_
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
 #include <deque>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <utility>
 #include <vector>
 #include "function2/function2.hpp"
+#include "arpc/affinity.h"
+#include "arpc/clock.h"
+#include "arpc/container/flat_map.h"
 #include "arpc/errors.h"
+#include "arpc/flag.h"
 #include "arpc/future.h"
 #include "arpc/queue.h"
+#include "arpc/semaphore.h"
 #include "arpc/thread.h"
+#include "arpc/work_stealing_deque.h"
 
 namespace arpc {
 
@@ -43,44 +55,193 @@ class synchronous_executor {
   }
 };
 
+/// Pool of threads running functions in FIFO order.
+///
+/// The pool can have a fixed number of workers, or adapt it to the load
+/// within some bounds: workers are added while functions wait in the queue for
+/// longer than `adaptive_options::max_queue_wait`, which happens when all of
+/// them are busy (for instance, blocked on calls to other servers), and removed
+/// once they've been idle for `adaptive_options::idle_timeout`.
+///
+/// With a non-negative `queue_size`, running a function from outside of the
+/// pool blocks while that many are waiting in the queue. Functions run from the
+/// pool's own workers never block.
 class thread_pool {
  public:
+  struct adaptive_options {
+    // Bounds for the number of workers. The pool starts with `min_threads`.
+    unsigned int min_threads = 1;
+    unsigned int max_threads = 2 * std::max(thread::hardware_concurrency(), 1U);
+
+    // Add a worker when a function has been waiting in the queue for longer
+    // than this.
+    std::chrono::microseconds max_queue_wait = std::chrono::milliseconds(1);
+
+    // Remove workers idle for longer than this, down to `min_threads`.
+    std::chrono::milliseconds idle_timeout = std::chrono::seconds(10);
+  };
+
+  /// Counters to tune the pool with, as returned by `get_stats()`.
+  struct stats {
+    // Current number of workers, and how many of them are waiting for work.
+    std::size_t num_threads = 0;
+    std::size_t num_idle = 0;
+    // Functions currently waiting in the queue.
+    std::size_t queue_size = 0;
+    // Functions that had to wait in the queue for a worker, and for how long
+    // in total and at most.
+    std::uint64_t num_queued = 0;
+    deadline_clock::duration total_queue_wait{};
+    deadline_clock::duration max_queue_wait{};
+    // Workers added and removed by an adaptive pool.
+    std::uint64_t num_added = 0;
+    std::uint64_t num_removed = 0;
+  };
+
+  /// \param worker_cpus CPUs to pin the workers to: worker `i` runs on
+  ///   `worker_cpus[i % worker_cpus.size()]`. Empty for no pinning.
   explicit thread_pool(unsigned int num_worker_threads =
                            std::max(thread::hardware_concurrency(), 1U),
-                       int queue_size = -1);
+                       int queue_size = -1,
+                       const std::vector<cpu_set>& worker_cpus = {});
+
+  /// Create an adaptive pool. A `queue_size` of 0 means `max_threads`.
+  explicit thread_pool(const adaptive_options& options, int queue_size = -1,
+                       const std::vector<cpu_set>& worker_cpus = {});
   ~thread_pool();
 
   template <typename F>
   void run(F&& f) {
-    while (true) {
-      auto [have_slot, have_pending_space] =
-          select(slots_.can_get(), pending_.can_put());
-      try {
-        std::scoped_lock lock(mu_);
-        if (have_slot) {
-          *have_slot;
-          slots_.maybe_get().set_value(std::move(fn_type(std::forward<F>(f))));
-          return;
-        }
-        if (have_pending_space) {
-          *have_pending_space;
-          pending_.maybe_put(std::move(fn_type(std::forward<F>(f))));
-          return;
-        }
-      } catch (const errors::try_again&) {
-        // Just try again.
-      }
-    }
+    submit(fn_type(std::forward<F>(f)));
   }
 
+  /// \return The CPUs each worker may run on.
+  std::vector<cpu_set> worker_affinity();
+
+  stats get_stats();
+
  private:
   using fn_type = fu2::unique_function<void()>;
 
-  void request_work(promise<fn_type> slot);
+  struct queued_fn {
+    deadline_clock::time_point since;
+    // Whether it holds one of `queue_slots_`.
+    bool counted;
+  };
 
+  struct idle_worker {
+    std::size_t id;
+    deadline_clock::time_point since;
+  };
+
+  void start(unsigned int num_worker_threads);
+  void submit(fn_type fn);
+  void work(std::size_t id);
+  void request_work(std::size_t id, promise<fn_type> slot);
+  void add_worker();
+  void grow();
+  void shrink(std::vector<daemon_thread>& removed);
+  void monitor();
+  void stop();
+
+  const std::optional<adaptive_options> adaptive_;
+  const std::vector<cpu_set> worker_cpus_;
   std::mutex mu_;
   queue<fn_type> pending_;
   queue<promise<fn_type>> slots_;
+  // Bounds the functions from outside of the pool waiting in `pending_`.
+  std::optional<semaphore> queue_slots_;
+  // These follow the contents of `pending_` and `slots_`, which are only
+  // changed while holding `mu_`.
+  std::deque<queued_fn> queued_;
+  std::deque<idle_worker> idle_;
+  flat_map<std::size_t, daemon_thread> threads_;
+  std::size_t next_id_ = 0;
+  std::size_t num_starting_ = 0;
+  stats stats_;
+  flag work_queued_;
+  daemon_thread monitor_;
+};
+
+/// Thread pool where each worker has its own deque of functions.
+///
+/// Functions run from a worker of the pool go to that worker's deque, which
+/// it runs in LIFO order, while functions run from other threads go to a
+/// shared queue. Workers with nothing left to do steal from the deques of
+/// randomly chosen workers, and only park (on a flag) when they find no work
+/// anywhere, so dispatching a function makes no system calls unless a worker
+/// has to be woken up.
+///
+/// It has the same interface as `thread_pool`: with a non-negative
+/// `queue_size` (0 meaning one per worker), running a function from outside
+/// of the pool blocks while that many are waiting in the shared queue.
+///
+/// Functions can also be sent to a specific worker with `run_on()`, to keep
+/// related work on one thread (and, with `worker_cpus`, on one CPU). These go
+/// to the worker's inbox, which other workers never steal from.
+class work_stealing_pool {
+ public:
+  /// \param worker_cpus CPUs to pin the workers to: worker `i` runs on
+  ///   `worker_cpus[i % worker_cpus.size()]`. Empty for no pinning.
+  explicit work_stealing_pool(unsigned int num_worker_threads =
+                                  std::max(thread::hardware_concurrency(), 1U),
+                              int queue_size = -1,
+                              const std::vector<cpu_set>& worker_cpus = {});
+  ~work_stealing_pool();
+
+  template <typename F>
+  void run(F&& f) {
+    submit(std::make_unique<fn_type>(std::forward<F>(f)));
+  }
+
+  /// Run `f` on the worker with index `worker`, modulo the number of workers.
+  template <typename F>
+  void run_on(std::size_t worker, F&& f) {
+    submit_to(worker % workers_.size(),
+              std::make_unique<fn_type>(std::forward<F>(f)));
+  }
+
+  std::size_t num_workers() const { return workers_.size(); }
+
+  /// \return The CPUs each worker may run on.
+  std::vector<cpu_set> worker_affinity();
+
+ private:
+  using fn_type = fu2::unique_function<void()>;
+
+  struct worker {
+    explicit worker(std::uint64_t seed) : rng(seed) {}
+
+    work_stealing_deque<fn_type> deque;
+    // Functions from run_on(), and whether each one took a shared queue slot.
+    std::mutex inbox_mu;
+    std::deque<std::pair<fn_type*, bool>> inbox;
+    std::atomic<std::size_t> inbox_size = 0;
+    std::atomic<bool> sleeping = false;
+    flag wake;
+    std::uint64_t rng;
+  };
+
+  void submit(std::unique_ptr<fn_type> fn);
+  void submit_to(std::size_t index, std::unique_ptr<fn_type> fn);
+  void work(std::size_t index);
+  fn_type* find_work(std::size_t index);
+  fn_type* take_inbox(worker& w);
+  fn_type* take_shared();
+  bool has_work(std::size_t index) const;
+  void park(std::size_t index);
+  void notify();
+  void notify(worker& w);
+  void stop();
+
+  std::vector<std::unique_ptr<worker>> workers_;
+  std::mutex shared_mu_;
+  std::deque<fn_type*> shared_;
+  std::atomic<std::size_t> shared_size_ = 0;
+  std::optional<semaphore> shared_slots_;
+  std::atomic<std::size_t> num_sleeping_ = 0;
+  std::atomic<std::size_t> next_wake_ = 0;
+  std::atomic<bool> stopping_ = false;
   std::vector<daemon_thread> threads_;
 };
 
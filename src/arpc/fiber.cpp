@@ -0,0 +1,322 @@
+/// \file
+/// \brief Stackful fibers, in which blocking calls yield instead.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/fiber.h"
+#ifndef ESP_PLATFORM
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif  // ESP_PLATFORM
+#include <optional>
+#include "arpc/clock.h"
+#include "arpc/errors.h"
+#include "arpc/select.h"
+
+namespace arpc {
+
+#ifndef ESP_PLATFORM
+
+namespace detail {
+
+struct fiber {
+  explicit fiber(std::size_t stack_size) {
+    // The lowest page is left inaccessible, to catch stack overflows.
+    guard_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    mapped_size = stack_size + guard_size;
+    stack = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED) throw_io_error("Error allocating a fiber stack");
+    if (::mprotect(stack, guard_size, PROT_NONE)) {
+      ::munmap(stack, mapped_size);
+      throw_io_error("Error protecting a fiber stack");
+    }
+  }
+  ~fiber() { ::munmap(stack, mapped_size); }
+
+  fiber(const fiber&) = delete;
+  fiber& operator=(const fiber&) = delete;
+
+  ucontext_t ucontext;
+  void* stack;
+  std::size_t guard_size;
+  std::size_t mapped_size;
+  fu2::unique_function<void()> fn;
+  // The thread's current context while the fiber is switched out, and the
+  // fiber's own while it runs.
+  context* current = nullptr;
+  bool scheduled = false;
+  bool finished = true;
+};
+
+}  // namespace detail
+
+namespace {
+// Loop of the fiber running in this thread, if any.
+thread_local fiber_loop* current_loop = nullptr;
+// Where fibers running in this thread switch back to.
+thread_local ucontext_t loop_ucontext;
+}  // namespace
+
+fiber_loop::fiber_loop(std::size_t stack_size) : stack_size_(stack_size) {}
+
+fiber_loop::~fiber_loop() = default;
+
+fiber_loop* fiber_loop::current() { return current_loop; }
+
+void fiber_loop::run() { loop(false); }
+
+void fiber_loop::run_forever() { loop(true); }
+
+void fiber_loop::loop(bool forever) {
+  if (current_loop) {
+    throw errors::invalid_state("Can't run a fiber loop from a fiber");
+  }
+  parent_context_ = &context::current();
+  stopping_ = false;
+
+  try {
+    while (true) {
+      // In coarse mode, fibers see the time as of the start of each round.
+      deadline_clock::refresh();
+      while (auto fn = inbox_.try_get()) start(std::move(*fn));
+
+      // Fibers made ready while these run wait for the next round.
+      for (auto n = ready_.size(); n > 0; n--) {
+        auto* f = ready_.front();
+        ready_.pop_front();
+        resume(*f);
+      }
+      if (!ready_.empty() || !inbox_.empty()) continue;
+      if (!forever && num_fibers_ == 0) return;
+
+      if (auto next = timers_.next_expiry()) {
+        auto [dispatched, spawned, timed_out] = select(
+            reactor_.async_dispatch(), inbox_.can_get(), deadline(*next));
+        if (dispatched) *dispatched;
+      } else {
+        auto [dispatched, spawned] =
+            select(reactor_.async_dispatch(), inbox_.can_get());
+        if (dispatched) *dispatched;
+      }
+      timers_.expire(std::chrono::steady_clock::now(),
+                     [this](detail::fiber* f) { wake(*f); });
+    }
+  } catch (...) {
+    stop();
+    throw;
+  }
+}
+
+void fiber_loop::start(fn_type fn) {
+  detail::fiber* f;
+  if (!idle_.empty()) {
+    f = idle_.back();
+    idle_.pop_back();
+  } else {
+    fibers_.push_back(std::make_unique<detail::fiber>(stack_size_));
+    f = fibers_.back().get();
+  }
+
+  ::getcontext(&f->ucontext);
+  f->ucontext.uc_stack.ss_sp = static_cast<char*>(f->stack) + f->guard_size;
+  f->ucontext.uc_stack.ss_size = stack_size_;
+  f->ucontext.uc_link = nullptr;
+  ::makecontext(&f->ucontext, &fiber_loop::enter, 0);
+  f->fn = std::move(fn);
+  f->current = nullptr;
+  f->finished = false;
+  num_fibers_++;
+  resume(*f);
+}
+
+void fiber_loop::enter() {
+  auto* loop = current_loop;
+  auto& f = *loop->running_;
+  {
+    context ctx(*loop->parent_context_);
+    try {
+      f.fn();
+    } catch (...) {
+      // Log the exception?
+    }
+  }
+  f.fn = nullptr;
+  f.finished = true;
+  ::swapcontext(&f.ucontext, &loop_ucontext);
+}
+
+void fiber_loop::resume(detail::fiber& f) {
+  f.scheduled = false;
+  running_ = &f;
+  current_loop = this;
+  std::swap(context::current_, f.current);
+  ::swapcontext(&loop_ucontext, &f.ucontext);
+  std::swap(context::current_, f.current);
+  current_loop = nullptr;
+  running_ = nullptr;
+
+  if (f.finished) {
+    idle_.push_back(&f);
+    num_fibers_--;
+  }
+}
+
+void fiber_loop::suspend(detail::fiber& f) {
+  ::swapcontext(&f.ucontext, &loop_ucontext);
+}
+
+void fiber_loop::wake(detail::fiber& f) {
+  if (f.scheduled || f.finished) return;
+  f.scheduled = true;
+  ready_.push_back(&f);
+}
+
+int fiber_loop::poll(pollfd* fds, std::size_t nfds,
+                     std::chrono::nanoseconds timeout) {
+  auto& f = *running_;
+  std::optional<std::chrono::steady_clock::time_point> when;
+  if (timeout > std::chrono::nanoseconds::zero()) {
+    when = std::chrono::steady_clock::now() + timeout;
+  }
+
+  std::vector<reactor::key> keys;
+  keys.reserve(nfds);
+  while (true) {
+    if (stopping_) throw errors::cancelled("Fiber loop is stopping");
+    // select() leaves checking the fiber's context to the loop.
+    if (context::current().is_cancelled()) {
+      throw errors::cancelled("Context is cancelled");
+    }
+
+    // The reactor only says which descriptors became ready, so poll(2) tells
+    // what exactly happened, and avoids switching out if it already did.
+    int res = ::poll(fds, nfds, 0);
+    if (res != 0 || timeout == std::chrono::nanoseconds::zero()) return res;
+    if (when && std::chrono::steady_clock::now() >= *when) return 0;
+
+    for (std::size_t i = 0; i < nfds; i++) {
+      if (fds[i].fd < 0) continue;
+      keys.push_back(reactor_.arm(
+          awaitable<void>(fds[i].fd, (fds[i].events & POLLOUT) != 0)
+              .then([this, &f]() { wake(f); })));
+    }
+    if (when) timers_.add(*when, &f);
+
+    suspend(f);
+
+    for (const auto& k : keys) reactor_.disarm(k);
+    keys.clear();
+    if (when) timers_.remove(*when, &f);
+  }
+}
+
+void fiber_loop::stop() {
+  // Waiting fibers throw errors::cancelled once resumed, so that they unwind
+  // their stacks; keep at it until all of them are done.
+  stopping_ = true;
+  while (num_fibers_ > 0) {
+    for (auto& f : fibers_) wake(*f);
+    while (!ready_.empty()) {
+      auto* f = ready_.front();
+      ready_.pop_front();
+      resume(*f);
+    }
+  }
+  while (inbox_.try_get()) {
+  }
+  reactor_.clear();
+  timers_.clear();
+}
+
+#else  // ESP_PLATFORM
+
+namespace detail {
+struct fiber {};
+}  // namespace detail
+
+fiber_loop::fiber_loop(std::size_t stack_size) : stack_size_(stack_size) {}
+
+fiber_loop::~fiber_loop() = default;
+
+fiber_loop* fiber_loop::current() { return nullptr; }
+
+void fiber_loop::run() {
+  throw errors::not_implemented("Fibers are not supported");
+}
+
+void fiber_loop::run_forever() {
+  throw errors::not_implemented("Fibers are not supported");
+}
+
+int fiber_loop::poll(pollfd* fds, std::size_t nfds,
+                     std::chrono::nanoseconds timeout) {
+  throw errors::not_implemented("Fibers are not supported");
+}
+
+#endif  // ESP_PLATFORM
+
+fiber_pool::fiber_pool(unsigned int num_threads, std::size_t stack_size,
+                       const std::vector<cpu_set>& worker_cpus,
+                       bool coarse_clock) {
+#ifdef ESP_PLATFORM
+  throw errors::not_implemented("Fibers are not supported");
+#endif  // ESP_PLATFORM
+  num_threads = std::max(num_threads, 1U);
+  loops_.reserve(num_threads);
+  for (unsigned int i = 0; i < num_threads; i++) {
+    loops_.push_back(std::make_unique<fiber_loop>(stack_size));
+  }
+  threads_.reserve(num_threads);
+  for (unsigned int i = 0; i < num_threads; i++) {
+    threads_.emplace_back([loop = loops_[i].get(), coarse_clock]() {
+      std::optional<deadline_clock::coarse_scope> coarse;
+      if (coarse_clock) coarse.emplace();
+      loop->run_forever();
+    });
+  }
+  try {
+    for (std::size_t i = 0; i < threads_.size() && !worker_cpus.empty(); i++) {
+      set_affinity(threads_[i], worker_cpus[i % worker_cpus.size()]);
+    }
+  } catch (...) {
+    stop();
+    throw;
+  }
+}
+
+fiber_pool::~fiber_pool() { stop(); }
+
+std::size_t fiber_pool::size() const {
+  std::size_t result = 0;
+  for (const auto& loop : loops_) result += loop->size();
+  return result;
+}
+
+void fiber_pool::stop() {
+  for (auto& t : threads_) {
+    t.get_context().cancel();
+  }
+  for (auto& t : threads_) {
+    t.join();
+  }
+}
+
+}  // namespace arpc
@@ -0,0 +1,169 @@
+/// \file
+/// \brief Stackful fibers, in which blocking calls yield instead.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_FIBER_H_
+#define ARPC_FIBER_H_
+
+#ifndef ESP_PLATFORM
+#include <poll.h>
+#else  // ESP_PLATFORM
+#include <sys/poll.h>
+#endif  // ESP_PLATFORM
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "function2/function2.hpp"
+#include "arpc/affinity.h"
+#include "arpc/context.h"
+#include "arpc/queue.h"
+#include "arpc/reactor.h"
+#include "arpc/thread.h"
+#include "arpc/timer_wheel.h"
+
+namespace arpc {
+
+namespace detail {
+struct fiber;
+}  // namespace detail
+
+/// Scheduler for stackful fibers on a single thread.
+///
+/// Each function spawned in the loop runs in a fiber with its own stack. When
+/// it blocks in `select()` (and so in anything built on it, like
+/// `future::get()`, `queue::get()`, `flag::wait()` or reads from channels),
+/// the descriptors it waits for are armed in the loop's `reactor` and the
+/// fiber is switched out, so that the thread can run other fibers meanwhile.
+/// Code written for threads can then keep many more calls waiting at the same
+/// time than there are threads, without changes.
+///
+/// Each fiber runs with a context that's a child of the one current where the
+/// loop runs, so cancelling that one cancels all the fibers. Fibers don't each
+/// wait on their own context's cancellation, which would take a descriptor per
+/// fiber: the loop resumes all of them when its context is cancelled, and a
+/// fiber whose context was cancelled otherwise (say, by an ancestor it got
+/// from elsewhere) throws `errors::cancelled` the next time it's resumed.
+/// Blocking in anything other than `select()`, like a `std::mutex` or a system
+/// call, blocks the whole loop. Awaitables backed by `uring` operations aren't
+/// supported, and neither are fibers on ESP-IDF.
+class fiber_loop {
+ public:
+  static constexpr std::size_t default_stack_size = 256 * 1024;
+
+  explicit fiber_loop(std::size_t stack_size = default_stack_size);
+  ~fiber_loop();
+
+  fiber_loop(const fiber_loop&) = delete;
+  fiber_loop& operator=(const fiber_loop&) = delete;
+
+  /// Run `f` in a new fiber. Can be called from any thread; the fiber starts
+  /// once the loop gets to it.
+  template <typename F>
+  void spawn(F&& f) {
+    inbox_.put(fn_type(std::forward<F>(f)));
+  }
+
+  /// Run fibers in the calling thread until none are left.
+  void run();
+
+  /// Run fibers in the calling thread until its context is cancelled. The
+  /// fibers still waiting then are resumed with `errors::cancelled` before
+  /// returning.
+  void run_forever();
+
+  /// Number of fibers started and not yet finished.
+  std::size_t size() const {
+    return num_fibers_.load(std::memory_order_relaxed);
+  }
+
+  /// \return The loop running the current fiber, or `nullptr` if this isn't
+  ///   running in a fiber.
+  static fiber_loop* current();
+
+  /// Same as `poll(2)` with a nanosecond timeout, but switching out the
+  /// current fiber while it waits. Used by `select()` when running in a fiber.
+  int poll(pollfd* fds, std::size_t nfds, std::chrono::nanoseconds timeout);
+
+ private:
+  using fn_type = fu2::unique_function<void()>;
+
+  static void enter();
+  void loop(bool forever);
+  void start(fn_type fn);
+  void resume(detail::fiber& f);
+  void suspend(detail::fiber& f);
+  void wake(detail::fiber& f);
+  void stop();
+
+  const std::size_t stack_size_;
+  queue<fn_type> inbox_;
+  reactor reactor_;
+  timer_wheel<detail::fiber*> timers_;
+  std::deque<detail::fiber*> ready_;
+  std::vector<detail::fiber*> idle_;
+  std::atomic<std::size_t> num_fibers_ = 0;
+  std::vector<std::unique_ptr<detail::fiber>> fibers_;
+  context* parent_context_ = nullptr;
+  bool stopping_ = false;
+  detail::fiber* running_ = nullptr;
+};
+
+/// Executor running functions in fibers, spread over a few threads each with
+/// its own `fiber_loop`.
+///
+/// It has the same `run()` interface as `thread_pool`, but a function blocked
+/// in `select()` only holds its fiber's stack, not a thread.
+class fiber_pool {
+ public:
+  /// \param worker_cpus CPUs to pin the threads to: thread `i` runs on
+  ///   `worker_cpus[i % worker_cpus.size()]`. Empty for no pinning.
+  /// \param coarse_clock Whether to run the threads with `deadline_clock` in
+  ///   coarse mode, refreshed by their loops on every round.
+  explicit fiber_pool(unsigned int num_threads =
+                          std::max(thread::hardware_concurrency(), 1U),
+                      std::size_t stack_size = fiber_loop::default_stack_size,
+                      const std::vector<cpu_set>& worker_cpus = {},
+                      bool coarse_clock = false);
+  ~fiber_pool();
+
+  template <typename F>
+  void run(F&& f) {
+    loops_[next_loop_++ % loops_.size()]->spawn(std::forward<F>(f));
+  }
+
+  /// Number of fibers started and not yet finished, over all the threads.
+  std::size_t size() const;
+
+ private:
+  void stop();
+
+  std::vector<std::unique_ptr<fiber_loop>> loops_;
+  std::atomic<std::size_t> next_loop_ = 0;
+  std::vector<daemon_thread> threads_;
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_FIBER_H_
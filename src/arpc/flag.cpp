@@ -20,39 +20,31 @@
 ///   under the License.
 
 #include "arpc/flag.h"
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif  // __linux__
+#include <cstdint>
 #include "arpc/errors.h"
 #include "arpc/pipe.h"
 #include "arpc/select.h"
 
 namespace arpc {
 
-flag::flag() {
-  pipe(pipe_);
-  pipe_[0].make_non_blocking();
-  pipe_[1].make_non_blocking();
-}
+flag::flag() {}
 
 void flag::set() {
+  if (set_.load(std::memory_order_acquire)) return;
   std::scoped_lock lock(mu_);
-  if (!set_) {
-    pipe_[1].write("*", 1);
-    set_ = true;
-  }
+  if (!set_.exchange(true, std::memory_order_acq_rel)) signal();
 }
 
 void flag::reset() {
+  if (!set_.load(std::memory_order_acquire)) return;
   std::scoped_lock lock(mu_);
-  if (set_) {
-    char c;
-    pipe_[0].read(&c, 1);
-    set_ = false;
-  }
+  if (set_.exchange(false, std::memory_order_acq_rel)) unsignal();
 }
 
-bool flag::is_set() const {
-  std::scoped_lock lock(mu_);
-  return set_;
-}
+bool flag::is_set() const { return set_.load(std::memory_order_acquire); }
 
 flag::operator bool() const { return is_set(); }
 
@@ -61,12 +53,75 @@ void flag::wait() {
   *res;
 }
 
+channel& flag::wait_channel() {
+  std::scoped_lock lock(mu_);
+  materialize();
+#ifdef __linux__
+  return event_;
+#else   // __linux__
+  return pipe_[0];
+#endif  // __linux__
+}
+
+#ifdef __linux__
+
+void flag::materialize() {
+  if (event_) return;
+  event_.reset(::eventfd(set_ ? 1 : 0, EFD_NONBLOCK | EFD_CLOEXEC));
+  if (!event_) throw_io_error("Error creating eventfd");
+}
+
+void flag::signal() {
+  if (event_) {
+    std::uint64_t one = 1;
+    event_.maybe_write(&one, sizeof(one));
+  }
+}
+
+void flag::unsignal() {
+  if (event_) {
+    std::uint64_t count;
+    event_.maybe_read(&count, sizeof(count));
+  }
+}
+
+#else  // __linux__
+
+void flag::materialize() {
+  if (pipe_[0]) return;
+  pipe(pipe_);
+  pipe_[0].make_non_blocking();
+  pipe_[1].make_non_blocking();
+  if (set_) signal();
+}
+
+void flag::signal() {
+  if (pipe_[1]) pipe_[1].write("*", 1);
+}
+
+void flag::unsignal() {
+  if (pipe_[0]) {
+    char c;
+    pipe_[0].read(&c, 1);
+  }
+}
+
+#endif  // __linux__
+
+void flag::close() {
+  std::scoped_lock lock(mu_);
+  set_.store(false, std::memory_order_release);
+#ifdef __linux__
+  event_.close();
+#else   // __linux__
+  pipe_[0].close();
+  pipe_[1].close();
+#endif  // __linux__
+}
+
 awaitable<void> flag::async_wait() {
-  return pipe_[0].can_read().then([this]() {
-    if (!is_set()) {
-      throw errors::try_again("Flag not yet set");
-    }
-  });
+  return awaitable<void>([this]() { return *wait_channel(); })
+      .ready_when([this]() { return is_set(); });
 }
 
 }  // namespace arpc
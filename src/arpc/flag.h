@@ -22,6 +22,7 @@
 #ifndef ARPC_FLAG_H_
 #define ARPC_FLAG_H_
 
+#include <atomic>
 #include <mutex>
 #include "arpc/awaitable.h"
 #include "arpc/channel.h"
@@ -39,10 +40,27 @@ class flag {
   awaitable<void> async_wait();
   void wait();
 
+  /// Reset the flag and close the descriptors created for `async_wait()`, for
+  /// flags kept around unused. Nobody may be waiting on it.
+  void close();
+
  private:
+  // The descriptors backing async_wait() are only created when it's first
+  // called; until then setting and resetting the flag needs no system calls.
+  channel& wait_channel();
+  void materialize();
+  void signal();
+  void unsignal();
+
   mutable std::mutex mu_;
-  bool set_ = false;
+  std::atomic<bool> set_ = false;
+#ifdef __linux__
+  // A single eventfd: readable while set, written to set it, read to reset it.
+  channel event_;
+#else   // __linux__
+  // A self-pipe pair holding one byte while set.
   channel pipe_[2];
+#endif  // __linux__
 };
 
 }  // namespace arpc
@@ -26,31 +26,61 @@ namespace detail {
 
 future_state_base::~future_state_base() {}
 
-void future_state_base::release_reader() {
-  bool has_writer;
-  {
-    std::scoped_lock lock(mu_);
-    has_reader_ = false;
-    has_writer = has_writer_;
-  }
-  if (!has_writer) {
-    delete this;
+void future_state_base::release_reader() { release(has_reader); }
+
+void future_state_base::release_writer() { release(has_writer); }
+
+void future_state_base::release(unsigned int which) {
+  auto status = status_.fetch_and(~which, std::memory_order_acq_rel) & ~which;
+  if ((status & (has_writer | has_reader)) == 0) {
+    recycle();
   }
 }
 
-void future_state_base::release_writer() {
-  bool has_reader;
-  {
-    std::scoped_lock lock(mu_);
-    has_writer_ = false;
-    has_reader = has_reader_;
-  }
-  if (!has_reader) {
-    delete this;
-  }
+bool future_state_base::is_ready() const {
+  return status_.load(std::memory_order_acquire) & has_result;
+}
+
+awaitable<void> future_state_base::can_get() {
+  return set_.async_wait().ready_when([this]() { return is_ready(); });
+}
+
+void future_state_base::on_set(fu2::unique_function<void()> callback) {
+  callback_ = std::move(callback);
+  // Whichever of on_set() and publish() comes second runs the callback.
+  auto status = status_.fetch_or(has_callback, std::memory_order_acq_rel);
+  if (status & has_result) run_callback();
+}
+
+void future_state_base::publish() {
+  // Raise the flag first, so that consume() always sees it raised and can
+  // lower it again.
+  set_.set();
+  auto status = status_.fetch_or(has_result, std::memory_order_acq_rel);
+  if (status & has_callback) run_callback();
+}
+
+void future_state_base::run_callback() {
+  // The callback might hold the last reference to this state, so it's moved
+  // out before running and nothing is touched after it's destroyed.
+  auto callback = std::move(callback_);
+  status_.fetch_and(~has_callback, std::memory_order_relaxed);
+  callback();
+}
+
+bool future_state_base::consume() {
+  if (!is_ready()) return false;
+  status_.fetch_and(~has_result, std::memory_order_relaxed);
+  set_.reset();
+  return true;
 }
 
-awaitable<void> future_state_base::can_get() { return set_.async_wait(); }
+void future_state_base::reset_status() {
+  status_.store(has_writer | has_reader, std::memory_order_relaxed);
+  // Pooled states would otherwise pin the descriptor of every flag waited on.
+  set_.close();
+  callback_ = nullptr;
+}
 
 }  // namespace detail
 }  // namespace arpc
@@ -22,12 +22,14 @@
 #ifndef ARPC_FUTURE_H_
 #define ARPC_FUTURE_H_
 
+#include <atomic>
+#include <cstddef>
 #include <exception>
 #include <memory>
-#include <mutex>
 #include <optional>
 #include <type_traits>
 #include <utility>
+#include <vector>
 #include "arpc/errors.h"
 #include "arpc/flag.h"
 #include "arpc/function.h"
@@ -38,6 +40,64 @@
 namespace arpc {
 namespace detail {
 
+/// Per-thread free lists of objects, so that short-lived objects of type `T`
+/// can be recycled instead of going through the allocator each time.
+///
+/// Objects go back to the list of the thread releasing them, which needn't be
+/// the one that got them. Each list holds at most `max_free` objects and
+/// deletes any extra ones.
+template <typename T, std::size_t max_free = 64>
+class object_pool {
+ public:
+  static T* get() {
+    auto* list = local();
+    if (!list || list->items.empty()) return new T();
+    auto* t = list->items.back();
+    list->items.pop_back();
+    return t;
+  }
+
+  static void put(T* t) {
+    auto* list = local();
+    if (!list || list->items.size() >= max_free) {
+      delete t;
+      return;
+    }
+    list->items.push_back(t);
+  }
+
+ private:
+  struct free_list {
+    free_list() { items.reserve(max_free); }
+    ~free_list() {
+      exited() = true;
+      for (auto* t : items) delete t;
+    }
+
+    std::vector<T*> items;
+  };
+
+  // Objects released from thread_local destructors run after the list is
+  // gone, so those are just deleted.
+  static bool& exited() {
+    thread_local bool exited = false;
+    return exited;
+  }
+
+  static free_list* local() {
+    if (exited()) return nullptr;
+    thread_local free_list list;
+    return &list;
+  }
+};
+
+/// State shared by a promise and its future.
+///
+/// Which of them are still around, whether the result has been set and
+/// whether a callback is waiting for it are tracked in a single atomic, so
+/// setting and getting the result take no locks. The flag is only there for
+/// `can_get()`, and as it creates its descriptor lazily, it makes no system
+/// calls unless someone waits on it.
 class future_state_base {
  public:
   using releaser = void (*)(future_state_base*);
@@ -48,13 +108,38 @@ class future_state_base {
 
   void release_writer();
 
+  bool is_ready() const;
+
   awaitable<void> can_get();
 
+  /// Call `callback` once the result is set: right away if it already is,
+  /// or otherwise from the thread setting it.
+  void on_set(fu2::unique_function<void()> callback);
+
  protected:
-  std::mutex mu_;
-  bool has_writer_ = true;
-  bool has_reader_ = true;
+  static constexpr unsigned int has_writer = 1;
+  static constexpr unsigned int has_reader = 2;
+  static constexpr unsigned int has_result = 4;
+  static constexpr unsigned int has_callback = 8;
+
+  // Mark the result as set, once it's been written.
+  void publish();
+
+  // Take the result, after checking it's there.
+  bool consume();
+
+  // Make the state ready for a new promise and future, or delete it.
+  virtual void recycle() = 0;
+
+  void reset_status();
+
+ private:
+  void release(unsigned int which);
+  void run_callback();
+
+  std::atomic<unsigned int> status_ = has_writer | has_reader;
   flag set_;
+  fu2::unique_function<void()> callback_;
 };
 
 template <typename T>
@@ -62,31 +147,38 @@ class future_state : public future_state_base {
  public:
   using value_type = T;
 
+  static future_state* make() { return object_pool<future_state>::get(); }
+
   template <typename U>
   void set_value(U&& u) {
-    std::scoped_lock lock(mu_);
     result_.set_value(std::forward<U>(u));
-    set_.set();
+    publish();
   }
 
   void set_exception(std::exception_ptr exception) {
-    std::scoped_lock lock(mu_);
     result_.set_exception(exception);
-    set_.set();
+    publish();
   }
 
-  void set(result_holder<value_type>&& result) { result_ = std::move(result); }
+  void set(result_holder<value_type>&& result) {
+    result_ = std::move(result);
+    publish();
+  }
 
   value_type maybe_get() {
-    std::scoped_lock lock(mu_);
-    if (result_) {
-      set_.reset();
+    if (consume()) {
       return *std::move(result_);
     }
     throw errors::try_again("Future not ready yet");
   }
 
  private:
+  void recycle() override {
+    result_.reset();
+    reset_status();
+    object_pool<future_state>::put(this);
+  }
+
   result_holder<value_type> result_;
 };
 
@@ -95,24 +187,25 @@ class future_state<void> : public future_state_base {
  public:
   using value_type = void;
 
+  static future_state* make() { return object_pool<future_state>::get(); }
+
   void set_value() {
-    std::scoped_lock lock(mu_);
     result_.set_value();
-    set_.set();
+    publish();
   }
 
   void set_exception(std::exception_ptr exception) {
-    std::scoped_lock lock(mu_);
     result_.set_exception(exception);
-    set_.set();
+    publish();
   }
 
-  void set(result_holder<value_type>&& result) { result_ = std::move(result); }
+  void set(result_holder<value_type>&& result) {
+    result_ = std::move(result);
+    publish();
+  }
 
   void maybe_get() {
-    std::scoped_lock lock(mu_);
-    if (result_) {
-      set_.reset();
+    if (consume()) {
       *result_;
       return;
     }
@@ -120,6 +213,12 @@ class future_state<void> : public future_state_base {
   }
 
  private:
+  void recycle() override {
+    result_.reset();
+    reset_status();
+    object_pool<future_state>::put(this);
+  }
+
   result_holder<value_type> result_;
 };
 
@@ -146,12 +245,17 @@ class future {
 
   future()
       : state_(nullptr,
-               [](detail::future_state_base* s) { s->release_reader(); }),
-        get_fn_([this](detail::future_state_base& s) {
-          return static_cast<detail::future_state<value_type>&>(s).maybe_get();
-        }) {}
+               [](detail::future_state_base* s) { s->release_reader(); }) {}
 
-  value_type maybe_get() { return get_fn_(state()); }
+  value_type maybe_get() {
+    if (get_fn_) return get_fn_(state());
+    return get_from_state(state());
+  }
+
+  std::optional<value_type> try_get() {
+    if (!state().is_ready()) return std::nullopt;
+    return maybe_get();
+  }
 
   awaitable<void> can_get() { return state().can_get(); }
 
@@ -160,35 +264,63 @@ class future {
   }
 
   value_type get() {
+    if (state().is_ready()) return maybe_get();
     auto [res] = select(async_get());
     return std::move(*res);
   }
 
+  /// Call `fn` with the result, as a `result_holder<value_type>`, as soon as
+  /// it's set, without anyone having to wait on the future.
+  ///
+  /// `fn` runs in the thread setting the result or, if it's already set, in
+  /// this one. The future is consumed.
+  template <typename F>
+  void on_complete(F&& fn) {
+    auto& s = state();
+    s.on_set([f(std::move(*this)), fn(std::forward<F>(fn))]() mutable {
+      result_holder<value_type> result;
+      try {
+        result.set_value(f.maybe_get());
+      } catch (...) {
+        result.set_exception(std::current_exception());
+      }
+      fn(std::move(result));
+    });
+  }
+
+  /// Like `on_complete(fn)`, but run `fn` through `executor`.
+  template <typename F, typename Executor>
+  void on_complete(F&& fn, Executor& executor) {
+    on_complete([fn(std::forward<F>(fn)), &executor](
+                    result_holder<value_type> result) mutable {
+      executor.run([fn(std::move(fn)), result(std::move(result))]() mutable {
+        fn(std::move(result));
+      });
+    });
+  }
+
   template <typename E, typename CGF>
   auto except(CGF&& handler_fn) {
-    auto new_get_fn =
-        compose_catch<E>(std::move(get_fn_), std::move(handler_fn));
-    using new_value_type =
-        std::invoke_result_t<decltype(new_get_fn), detail::future_state_base&>;
-    return future<new_value_type>(std::move(state_), std::move(new_get_fn));
+    return compose([&handler_fn](auto&& get_fn) {
+      return compose_catch<E, detail::future_state_base&>(
+          std::move(get_fn), std::move(handler_fn));
+    });
   }
 
   template <typename OGF>
   auto then(OGF&& get_fn) {
-    auto new_get_fn = compose_pipe<detail::future_state_base&>(
-        std::move(get_fn_), std::move(get_fn));
-    using new_value_type =
-        std::invoke_result_t<decltype(new_get_fn), detail::future_state_base&>;
-    return future<new_value_type>(std::move(state_), std::move(new_get_fn));
+    return compose([&get_fn](auto&& old_get_fn) {
+      return compose_pipe<detail::future_state_base&>(std::move(old_get_fn),
+                                                      std::move(get_fn));
+    });
   }
 
   template <typename OWF>
   auto decorate(OWF&& get_fn) {
-    auto new_get_fn = compose_wrap<detail::future_state_base&>(
-        std::move(get_fn_), std::move(get_fn));
-    using new_value_type =
-        std::invoke_result_t<decltype(new_get_fn), detail::future_state_base&>;
-    return future<new_value_type>(std::move(state_), std::move(new_get_fn));
+    return compose([&get_fn](auto&& old_get_fn) {
+      return compose_wrap<detail::future_state_base&>(std::move(old_get_fn),
+                                                      std::move(get_fn));
+    });
   }
 
  private:
@@ -203,15 +335,33 @@ class future {
 
   explicit future(detail::future_state<value_type>* new_state)
       : state_(new_state,
-               [](detail::future_state_base* s) { s->release_reader(); }),
-        get_fn_(std::move([this](detail::future_state_base& s) {
-          return static_cast<detail::future_state<value_type>&>(s).maybe_get();
-        })) {}
+               [](detail::future_state_base* s) { s->release_reader(); }) {}
+
+  static value_type get_from_state(detail::future_state_base& s) {
+    return static_cast<detail::future_state<value_type>&>(s).maybe_get();
+  }
+
+  // Build the get function of a derived future by passing `composer` either
+  // the current get function or, if there's none yet, a plain function
+  // pointer, so that small continuations still fit inline in the new one.
+  template <typename C>
+  auto compose(C&& composer) {
+    using new_value_type = std::invoke_result_t<
+        std::invoke_result_t<C, get_fn_type&&>, detail::future_state_base&>;
+    typename future<new_value_type>::get_fn_type new_get_fn;
+    if (get_fn_) {
+      new_get_fn = composer(std::move(get_fn_));
+    } else {
+      new_get_fn = composer(&future::get_from_state);
+    }
+    return future<new_value_type>(std::move(state_), std::move(new_get_fn));
+  }
 
   future(pointer_type new_state, get_fn_type new_get_fn)
       : state_(std::move(new_state)), get_fn_(std::move(new_get_fn)) {}
 
   pointer_type state_;
+  // Empty until a continuation is attached.
   get_fn_type get_fn_;
 };
 
@@ -233,12 +383,21 @@ class future<void> {
 
   future()
       : state_(nullptr,
-               [](detail::future_state_base* s) { s->release_reader(); }),
-        get_fn_([this](detail::future_state_base& s) {
-          static_cast<detail::future_state<value_type>&>(s).maybe_get();
-        }) {}
+               [](detail::future_state_base* s) { s->release_reader(); }) {}
+
+  value_type maybe_get() {
+    if (get_fn_) {
+      get_fn_(state());
+    } else {
+      get_from_state(state());
+    }
+  }
 
-  value_type maybe_get() { get_fn_(state()); }
+  bool try_get() {
+    if (!state().is_ready()) return false;
+    maybe_get();
+    return true;
+  }
 
   awaitable<void> can_get() { return state().can_get(); }
 
@@ -247,35 +406,64 @@ class future<void> {
   }
 
   value_type get() {
+    if (state().is_ready()) return maybe_get();
     auto [res] = select(async_get());
     *res;
   }
 
+  /// Call `fn` with the result, as a `result_holder<value_type>`, as soon as
+  /// it's set, without anyone having to wait on the future.
+  ///
+  /// `fn` runs in the thread setting the result or, if it's already set, in
+  /// this one. The future is consumed.
+  template <typename F>
+  void on_complete(F&& fn) {
+    auto& s = state();
+    s.on_set([f(std::move(*this)), fn(std::forward<F>(fn))]() mutable {
+      result_holder<value_type> result;
+      try {
+        f.maybe_get();
+        result.set_value();
+      } catch (...) {
+        result.set_exception(std::current_exception());
+      }
+      fn(std::move(result));
+    });
+  }
+
+  /// Like `on_complete(fn)`, but run `fn` through `executor`.
+  template <typename F, typename Executor>
+  void on_complete(F&& fn, Executor& executor) {
+    on_complete([fn(std::forward<F>(fn)), &executor](
+                    result_holder<value_type> result) mutable {
+      executor.run([fn(std::move(fn)), result(std::move(result))]() mutable {
+        fn(std::move(result));
+      });
+    });
+  }
+
   template <typename E, typename CGF>
   auto except(CGF&& handler_fn) {
-    auto new_get_fn =
-        compose_catch<E>(std::move(get_fn_), std::move(handler_fn));
-    using new_value_type =
-        std::invoke_result_t<decltype(new_get_fn), detail::future_state_base&>;
-    return future<new_value_type>(std::move(state_), std::move(new_get_fn));
+    return compose([&handler_fn](auto&& get_fn) {
+      return compose_catch<E, detail::future_state_base&>(
+          std::move(get_fn), std::move(handler_fn));
+    });
   }
 
   template <typename OGF>
   auto then(OGF&& get_fn) {
-    auto new_get_fn = compose_pipe<detail::future_state_base&>(
-        std::move(get_fn_), std::move(get_fn));
-    using new_value_type =
-        std::invoke_result_t<decltype(new_get_fn), detail::future_state_base&>;
-    return future<new_value_type>(std::move(state_), std::move(new_get_fn));
+    return compose([&get_fn](auto&& old_get_fn) {
+      return compose_pipe<detail::future_state_base&>(std::move(old_get_fn),
+                                                      std::move(get_fn));
+    });
   }
 
   template <typename OWF>
   auto decorate(OWF&& get_fn) {
-    auto new_get_fn = compose_wrap<detail::future_state_base&>(
-        std::move(get_fn_), std::move(get_fn));
-    using new_value_type =
-        std::invoke_result_t<decltype(new_get_fn), detail::future_state_base&>;
-    return future<new_value_type>(std::move(state_), std::move(new_get_fn));
+    return compose([&get_fn](auto&& old_get_fn) {
+      return compose_wrap<detail::future_state_base&>(std::move(old_get_fn),
+                                                      std::move(get_fn));
+    });
   }
 
  private:
@@ -290,15 +478,33 @@ class future<void> {
 
   explicit future(detail::future_state<value_type>* new_state)
       : state_(new_state,
-               [](detail::future_state_base* s) { s->release_reader(); }),
-        get_fn_([this](detail::future_state_base& s) {
-          static_cast<detail::future_state<value_type>&>(s).maybe_get();
-        }) {}
+               [](detail::future_state_base* s) { s->release_reader(); }) {}
+
+  static value_type get_from_state(detail::future_state_base& s) {
+    static_cast<detail::future_state<value_type>&>(s).maybe_get();
+  }
+
+  // Build the get function of a derived future by passing `composer` either
+  // the current get function or, if there's none yet, a plain function
+  // pointer, so that small continuations still fit inline in the new one.
+  template <typename C>
+  auto compose(C&& composer) {
+    using new_value_type = std::invoke_result_t<
+        std::invoke_result_t<C, get_fn_type&&>, detail::future_state_base&>;
+    typename future<new_value_type>::get_fn_type new_get_fn;
+    if (get_fn_) {
+      new_get_fn = composer(std::move(get_fn_));
+    } else {
+      new_get_fn = composer(&future::get_from_state);
+    }
+    return future<new_value_type>(std::move(state_), std::move(new_get_fn));
+  }
 
   future(pointer_type new_state, get_fn_type new_get_fn)
       : state_(std::move(new_state)), get_fn_(std::move(new_get_fn)) {}
 
   pointer_type state_;
+  // Empty until a continuation is attached.
   get_fn_type get_fn_;
 };
 
@@ -312,7 +518,7 @@ class promise {
 
   promise()
       : state_(
-            new detail::future_state<value_type>(),
+            detail::future_state<value_type>::make(),
             [](detail::future_state_base* state) { state->release_writer(); }),
         future_(state_.get()) {}
 
@@ -360,7 +566,7 @@ class promise<void> {
 
   promise()
       : state_(
-            new detail::future_state<value_type>(),
+            detail::future_state<value_type>::make(),
             [](detail::future_state_base* state) { state->release_writer(); }),
         future_(state_.get()) {}
 
@@ -391,6 +597,27 @@ class promise<void> {
   future<value_type> future_;
 };
 
+/// Whether `T` is a `future`.
+template <typename T>
+struct is_future : std::false_type {};
+template <typename T>
+struct is_future<future<T>> : std::true_type {};
+template <typename T>
+inline constexpr bool is_future_v = is_future<T>::value;
+
+/// The type of the value of a `future<T>`, that is, `T`, or `T` itself if it
+/// isn't a future.
+template <typename T>
+struct future_value {
+  using type = T;
+};
+template <typename T>
+struct future_value<future<T>> {
+  using type = T;
+};
+template <typename T>
+using future_value_t = typename future_value<T>::type;
+
 }  // namespace arpc
 
 #endif  // ARPC_FUTURE_H_
@@ -117,9 +117,10 @@ struct async_interface : virtual Extends::async... {
 #define ARPC_INTERFACE_DECLS(...) \
   ARPC_FOREACH(ARPC_INTERFACE_DECLS_ONE, ARPC_INTERFACE_DECLS_SEP, __VA_ARGS__)
 
-#define ARPC_INTERFACE_ASYNC_DECL(RETURN, METHOD, ARGS)     \
-  virtual ::std::pair<::arpc::future<ARPC_EXPAND_1 RETURN>, \
-                      ::arpc::rpc_defs::request_id_type>    \
+#define ARPC_INTERFACE_ASYNC_DECL(RETURN, METHOD, ARGS)                       \
+  virtual ::std::pair<                                                        \
+      ::arpc::future<::arpc::future_value_t<ARPC_EXPAND_1 RETURN>>,           \
+      ::arpc::rpc_defs::request_id_type>                                      \
   METHOD(ARPC_INTERFACE_DECL_ARGS ARGS) = 0;
 #define ARPC_INTERFACE_ASYNC_DECLS_ONE(...) \
   ARPC_INTERFACE_ASYNC_DECL __VA_ARGS__
@@ -157,12 +158,12 @@ struct async_interface : virtual Extends::async... {
   ARPC_FOREACH(ARPC_INTERFACE_PROXY_IMPLS_ONE, ARPC_INTERFACE_PROXY_IMPLS_SEP, \
                __VA_ARGS__)
 
-#define ARPC_INTERFACE_ASYNC_PROXY_IMPL(RETURN, METHOD, ARGS) \
-  ::std::pair<::arpc::future<ARPC_EXPAND_1 RETURN>,           \
-              ::arpc::rpc_defs::request_id_type>              \
-  METHOD(ARPC_INTERFACE_PROXY_IMPL_ARGS ARGS) override {      \
-    return obj_.template async_call<&own_interface::METHOD>(  \
-        ARPC_INTERFACE_PROXY_FORWARD_ARGS ARGS);              \
+#define ARPC_INTERFACE_ASYNC_PROXY_IMPL(RETURN, METHOD, ARGS)               \
+  ::std::pair<::arpc::future<::arpc::future_value_t<ARPC_EXPAND_1 RETURN>>, \
+              ::arpc::rpc_defs::request_id_type>                            \
+  METHOD(ARPC_INTERFACE_PROXY_IMPL_ARGS ARGS) override {                    \
+    return obj_.template async_call<&own_interface::METHOD>(                \
+        ARPC_INTERFACE_PROXY_FORWARD_ARGS ARGS);                            \
   }
 #define ARPC_INTERFACE_ASYNC_PROXY_IMPLS_ONE(...) \
   ARPC_INTERFACE_ASYNC_PROXY_IMPL __VA_ARGS__
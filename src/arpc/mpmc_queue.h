@@ -0,0 +1,207 @@
+/// \file
+/// \brief Lock-free bounded select-friendly queue.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_MPMC_QUEUE_H_
+#define ARPC_MPMC_QUEUE_H_
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "arpc/awaitable.h"
+#include "arpc/errors.h"
+#include "arpc/flag.h"
+#include "arpc/select.h"
+
+namespace arpc {
+
+/// Bounded multi-producer, multi-consumer queue, with the same interface as
+/// `queue<T>`.
+///
+/// Items live in a fixed ring buffer of `size` cells, each one with a sequence
+/// number telling producers and consumers whose turn it is, so putting and
+/// getting only take a compare-and-swap. The flags backing `can_get()` and
+/// `can_put()` are only touched when the queue goes from or to empty or full,
+/// so steady-state hand-offs make no system calls and take no locks.
+template <typename T>
+class mpmc_queue {
+ public:
+  using size_type = std::size_t;
+  using value_type = T;
+
+  /// \param size The number of items the queue can hold. Must be at least 1.
+  explicit mpmc_queue(size_type size)
+      : max_size_(size), cells_(new cell[size]) {
+    for (size_type i = 0; i < max_size_; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    update_flags();
+  }
+  ~mpmc_queue() {
+    while (try_get()) {
+    }
+  }
+
+  mpmc_queue(const mpmc_queue&) = delete;
+  mpmc_queue& operator=(const mpmc_queue&) = delete;
+
+  size_type size() const {
+    auto size = size_.load(std::memory_order_acquire);
+    if (size <= 0) return 0;
+    return std::min(static_cast<size_type>(size), max_size_);
+  }
+  size_type max_size() const { return max_size_; }
+  size_type capacity() const { return max_size_; }
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() == max_size_; }
+
+  /// Put an item if there's room. `u` is only moved from on success.
+  template <typename U>
+  bool try_put(U&& u) {
+    auto pos = put_pos_.load(std::memory_order_relaxed);
+    cell* c;
+    while (true) {
+      c = &cells_[pos % max_size_];
+      auto seq = c->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq - pos);
+      if (diff == 0) {
+        if (put_pos_.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = put_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    new (&c->storage) T(std::forward<U>(u));
+    c->sequence.store(pos + 1, std::memory_order_release);
+
+    auto size = size_.fetch_add(1, std::memory_order_acq_rel);
+    if (size <= 0 || size + 1 >= static_cast<std::ptrdiff_t>(max_size_)) {
+      update_flags();
+    }
+    return true;
+  }
+  std::optional<value_type> try_get() {
+    auto pos = get_pos_.load(std::memory_order_relaxed);
+    cell* c;
+    while (true) {
+      c = &cells_[pos % max_size_];
+      auto seq = c->sequence.load(std::memory_order_acquire);
+      auto diff = static_cast<std::ptrdiff_t>(seq - (pos + 1));
+      if (diff == 0) {
+        if (get_pos_.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return std::nullopt;
+      } else {
+        pos = get_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    auto* item = std::launder(reinterpret_cast<T*>(&c->storage));
+    std::optional<value_type> result(std::move(*item));
+    item->~T();
+    c->sequence.store(pos + max_size_, std::memory_order_release);
+
+    auto size = size_.fetch_sub(1, std::memory_order_acq_rel);
+    if (size <= 1 || size >= static_cast<std::ptrdiff_t>(max_size_)) {
+      update_flags();
+    }
+    return result;
+  }
+  template <typename U>
+  void maybe_put(U&& u) {
+    if (!try_put(std::forward<U>(u))) throw errors::try_again("Queue is full");
+  }
+  value_type maybe_get() {
+    auto result = try_get();
+    if (!result) throw errors::try_again("Queue is empty");
+    return std::move(*result);
+  }
+  template <typename U>
+  void put(U&& u) {
+    auto [res] = select(async_put(std::forward<U>(u)));
+    *res;
+  }
+  value_type get() {
+    auto [res] = select(async_get());
+    return std::move(*res);
+  }
+  template <typename U>
+  awaitable<void> async_put(U&& u) {
+    return std::move(
+        can_put().then(std::move([u(std::forward<U>(u)), this]() mutable {
+          maybe_put(std::forward<U>(u));
+        })));
+  }
+  awaitable<value_type> async_get() {
+    return std::move(
+        can_get().then(std::move([this]() { return std::move(maybe_get()); })));
+  }
+  awaitable<void> can_put() { return can_put_.async_wait(); }
+  awaitable<void> can_get() { return can_get_.async_wait(); }
+
+ private:
+  struct cell {
+    std::atomic<size_type> sequence;
+    std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+  };
+
+  void update_flags() {
+    // As in semaphore, derive the flags from the latest count under the lock,
+    // since concurrent transitions can finish out of order. The count can
+    // briefly go out of [0, max_size_] while a getter overtakes the putter
+    // whose item it took.
+    std::scoped_lock lock(mu_);
+    auto size = size_.load(std::memory_order_acquire);
+    if (size <= 0) {
+      can_get_.reset();
+    } else {
+      can_get_.set();
+    }
+    if (size >= static_cast<std::ptrdiff_t>(max_size_)) {
+      can_put_.reset();
+    } else {
+      can_put_.set();
+    }
+  }
+
+  const size_type max_size_;
+  std::unique_ptr<cell[]> cells_;
+  alignas(64) std::atomic<size_type> put_pos_ = 0;
+  alignas(64) std::atomic<size_type> get_pos_ = 0;
+  alignas(64) std::atomic<std::ptrdiff_t> size_ = 0;
+  std::mutex mu_;
+  flag can_get_, can_put_;
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_MPMC_QUEUE_H_
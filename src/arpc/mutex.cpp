@@ -20,49 +20,60 @@
 ///   under the License.
 
 #include "arpc/mutex.h"
-#include <unistd.h>
-#include <utility>
-#include "arpc/context.h"
 #include "arpc/errors.h"
-#include "arpc/pipe.h"
 #include "arpc/select.h"
 
 namespace arpc {
 
-mutex::mutex() {
-  pipe(pipe_);
-  pipe_[0].make_non_blocking();
-  pipe_[1].make_non_blocking();
-  pipe_[1].write("*", 1);
-}
+mutex::mutex() {}
 
 void mutex::lock() {
+  for (int i = 0; i < spin_count; i++) {
+    if (state_.load(std::memory_order_relaxed) == 0 && try_lock()) return;
+  }
   auto [res] = select(async_lock());
   *res;
 }
 
 void mutex::maybe_lock() {
-  char c;
-  pipe_[0].maybe_read(&c, 1);
+  if (!try_lock()) throw errors::try_again("Mutex is locked");
 }
 
 bool mutex::try_lock() {
-  try {
-    maybe_lock();
-    return true;
-  } catch (const errors::try_again&) {
-    return false;
-  }
+  int expected = 0;
+  return state_.compare_exchange_strong(expected, 1, std::memory_order_acquire,
+                                        std::memory_order_relaxed);
 }
 
 void mutex::unlock() {
-  shield shield;
-  pipe_[1].write("*", 1);
+  if (state_.exchange(0, std::memory_order_release) == 2) wake_.set();
+}
+
+void mutex::mark_contended() {
+  // Reset before looking at the state: an unlock() happening after this will
+  // see the contended state and set the flag again.
+  wake_.reset();
+  int expected = 1;
+  if (!state_.compare_exchange_strong(expected, 2, std::memory_order_relaxed) &&
+      expected == 0) {
+    wake_.set();
+  }
+}
+
+awaitable<void> mutex::can_lock() {
+  mark_contended();
+  return wake_.async_wait();
 }
 
-awaitable<void> mutex::can_lock() { return pipe_[0].can_read(); }
 awaitable<void> mutex::async_lock() {
-  return can_lock().then([this]() { maybe_lock(); });
+  return can_lock().then([this]() {
+    wake_.reset();
+    // Take the lock as contended, as we can't know whether there are other
+    // waiters left.
+    if (state_.exchange(2, std::memory_order_acquire) != 0) {
+      throw errors::try_again("Mutex is locked");
+    }
+  });
 }
 
 }  // namespace arpc
@@ -22,11 +22,17 @@
 #ifndef ARPC_MUTEX_H_
 #define ARPC_MUTEX_H_
 
+#include <atomic>
 #include "arpc/awaitable.h"
-#include "arpc/channel.h"
+#include "arpc/flag.h"
 
 namespace arpc {
 
+/// Mutex that can be waited on in `select()` alongside other awaitables.
+///
+/// Locking and unlocking an uncontended mutex is a single atomic operation.
+/// `lock()` spins briefly before falling back to waiting, and only contended
+/// unlocks wake waiters, which is the only time a descriptor is involved.
 class mutex {
  public:
   mutex();
@@ -39,7 +45,15 @@ class mutex {
   awaitable<void> async_lock();
 
  private:
-  channel pipe_[2];
+  // Number of times lock() re-checks the mutex before waiting in select().
+  static constexpr int spin_count = 100;
+
+  // Flag waiters as present, so that the next unlock() wakes them.
+  void mark_contended();
+
+  // 0: unlocked, 1: locked, 2: locked and maybe waited on.
+  std::atomic<int> state_ = 0;
+  flag wake_;
 };
 
 }  // namespace arpc
@@ -0,0 +1,350 @@
+/// \file
+/// \brief Descriptor readiness engine backing select().
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/poller.h"
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif  // __linux__
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "arpc/fiber.h"
+#include "arpc/uring.h"
+
+namespace arpc {
+
+namespace {
+
+// Descriptors get reused by the kernel as soon as they are closed, and epoll
+// drops closed descriptors from its interest set on its own. To notice, every
+// close bumps the epoch of the descriptor's slot; collisions only cause an
+// unneeded re-registration.
+constexpr std::size_t fd_epoch_slots = 4096;
+std::atomic<std::uint32_t> fd_epochs[fd_epoch_slots];
+
+std::atomic<std::uint32_t>& fd_epoch(int fd) {
+  return fd_epochs[static_cast<std::size_t>(fd) % fd_epoch_slots];
+}
+
+// Timeout for poll(2) and friends, rounded up to whole milliseconds.
+int to_poll_timeout(std::chrono::nanoseconds timeout) {
+  if (timeout < std::chrono::nanoseconds::zero()) return -1;
+  auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+  return static_cast<int>(
+      std::min<decltype(ms)>(ms, std::numeric_limits<int>::max()));
+}
+
+// Plain poll(2), submitting the operations queued in the thread's io_uring
+// first.
+int plain_poll(pollfd* fds, std::size_t nfds,
+               std::chrono::nanoseconds timeout) {
+  auto* ring = uring::current();
+  if (!ring || !ring->submit()) {
+    return ::poll(fds, nfds, to_poll_timeout(timeout));
+  }
+
+  // Operations completed since the last wait and their completions were
+  // reaped, so the ring's descriptor needn't be readable: report it ready.
+  auto is_ring = [ring](const pollfd& p) { return p.fd == ring->fd(); };
+  if (std::none_of(fds, fds + nfds, is_ring)) {
+    return ::poll(fds, nfds, to_poll_timeout(timeout));
+  }
+  int res = ::poll(fds, nfds, 0);
+  if (res < 0) return res;
+  for (std::size_t i = 0; i < nfds; i++) {
+    if (!is_ring(fds[i])) continue;
+    if (!fds[i].revents) res++;
+    fds[i].revents |= POLLIN;
+  }
+  return res;
+}
+
+#ifdef __linux__
+constexpr std::size_t no_index = std::numeric_limits<std::size_t>::max();
+
+std::uint32_t to_epoll_events(short events) {  // NOLINT(runtime/int)
+  std::uint32_t res = 0;
+  if (events & POLLIN) res |= EPOLLIN;
+  if (events & POLLOUT) res |= EPOLLOUT;
+  return res;
+}
+
+short to_poll_events(std::uint32_t events) {  // NOLINT(runtime/int)
+  short res = 0;  // NOLINT(runtime/int)
+  if (events & EPOLLIN) res |= POLLIN;
+  if (events & EPOLLOUT) res |= POLLOUT;
+  if (events & EPOLLERR) res |= POLLERR;
+  if (events & EPOLLHUP) res |= POLLHUP;
+  return res;
+}
+#endif  // __linux__
+
+}  // namespace
+
+namespace {
+// Flags being set from static destructors can still call select() after the
+// thread-local pollers are gone; plain poll() is used from then on.
+thread_local bool scope_pollers_destroyed = false;
+
+struct scope_pollers {
+  ~scope_pollers() { scope_pollers_destroyed = true; }
+
+  std::vector<std::unique_ptr<poller>> by_level;
+  std::size_t level = 0;
+};
+
+thread_local scope_pollers current_scope_pollers;
+}  // namespace
+
+poller::scope::scope() : poller_(nullptr) {
+  // Fibers wait in their loop's reactor instead.
+  if (scope_pollers_destroyed || fiber_loop::current()) return;
+  auto& pollers = current_scope_pollers;
+  if (pollers.by_level.size() <= pollers.level) {
+    pollers.by_level.push_back(std::make_unique<poller>());
+  }
+  poller_ = pollers.by_level[pollers.level++].get();
+}
+
+poller::scope::~scope() {
+  if (poller_) current_scope_pollers.level--;
+}
+
+int poller::scope::poll(pollfd* fds, std::size_t nfds,
+                        std::chrono::nanoseconds timeout) {
+  if (poller_) return poller_->poll(fds, nfds, timeout);
+  if (auto* loop = fiber_loop::current()) return loop->poll(fds, nfds, timeout);
+  return plain_poll(fds, nfds, timeout);
+}
+
+bool poller::scope::checks_cancellation() const {
+  return !poller_ && fiber_loop::current();
+}
+
+void poller::forget(int fd) noexcept {
+  if (fd >= 0) fd_epoch(fd).fetch_add(1, std::memory_order_release);
+}
+
+std::uint32_t poller::epoch(int fd) noexcept {
+  return fd >= 0 ? fd_epoch(fd).load(std::memory_order_acquire) : 0;
+}
+
+#ifdef __linux__
+
+poller::poller()
+    : epoll_fd_(::epoll_create1(EPOLL_CLOEXEC)),
+      timer_fd_(::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) {
+  if (epoll_fd_ && timer_fd_) {
+    // The timer stays registered; it's only armed for precise timeouts.
+    epoll_event ev = {EPOLLIN, {}};
+    ev.data.fd = *timer_fd_;
+    if (::epoll_ctl(*epoll_fd_, EPOLL_CTL_ADD, *timer_fd_, &ev)) {
+      timer_fd_.reset();
+    }
+  }
+}
+
+poller::~poller() {
+  if (ring_) ring_->unwatch(*epoll_fd_);
+}
+
+int poller::poll(pollfd* fds, std::size_t nfds,
+                 std::chrono::nanoseconds timeout) {
+  if (epoll_fd_) return epoll(fds, nfds, timeout);
+  return plain_poll(fds, nfds, timeout);
+}
+
+int poller::epoll_wait(std::chrono::nanoseconds timeout) {
+  auto max_events = static_cast<int>(events_.size());
+  bool whole_ms = (timeout % std::chrono::milliseconds(1)).count() == 0;
+  if (!timer_fd_ || timeout <= std::chrono::nanoseconds::zero() || whole_ms) {
+    return ::epoll_wait(*epoll_fd_, events_.data(), max_events,
+                        to_poll_timeout(timeout));
+  }
+
+  itimerspec spec = {};
+  spec.it_value.tv_sec = timeout / std::chrono::seconds(1);
+  spec.it_value.tv_nsec = (timeout % std::chrono::seconds(1)).count();
+  if (::timerfd_settime(*timer_fd_, 0, &spec, nullptr)) {
+    return ::epoll_wait(*epoll_fd_, events_.data(), max_events,
+                        to_poll_timeout(timeout));
+  }
+
+  int res = ::epoll_wait(*epoll_fd_, events_.data(), max_events, -1);
+  int saved_errno = errno;
+  // Disarming also discards any expiration, so it won't wake up later calls.
+  itimerspec disarm = {};
+  ::timerfd_settime(*timer_fd_, 0, &disarm, nullptr);
+  errno = saved_errno;
+  return res;
+}
+
+int poller::ring_wait(std::chrono::nanoseconds timeout, bool& ring_ready) {
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+  auto max_events = static_cast<int>(events_.size());
+  do {
+    bool epoll_ready = false;
+    int res = ring_->wait(watches_.empty() ? -1 : *epoll_fd_, timeout,
+                          epoll_ready);
+    if (res < 0) return res;
+    ring_ready = (res > 0);
+    int num_events =
+        epoll_ready ? ::epoll_wait(*epoll_fd_, events_.data(), max_events, 0)
+                    : 0;
+    if (num_events != 0 || ring_ready) return num_events;
+
+    // Woken up by something else, like a cancelled operation.
+    if (timeout >= std::chrono::nanoseconds::zero()) {
+      timeout = deadline - std::chrono::steady_clock::now();
+      if (timeout <= std::chrono::nanoseconds::zero()) return 0;
+    }
+  } while (true);
+}
+
+bool poller::sync(int fd, watch& w) {
+  auto epoch = fd_epoch(fd).load(std::memory_order_acquire);
+  if (w.registered && w.epoch != epoch) {
+    // The descriptor was closed (and maybe reused) since we registered it.
+    ::epoll_ctl(*epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    w.registered = false;
+  }
+  if (w.registered && w.events == w.wanted) return true;
+
+  epoll_event ev = {w.wanted, {}};
+  ev.data.fd = fd;
+  int res = ::epoll_ctl(*epoll_fd_,
+                        w.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+  if (res && errno == ENOENT) {
+    res = ::epoll_ctl(*epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+  } else if (res && errno == EEXIST) {
+    res = ::epoll_ctl(*epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+  }
+  w.registered = (res == 0);
+  w.events = w.wanted;
+  w.epoch = epoch;
+  return w.registered;
+}
+
+int poller::epoll(pollfd* fds, std::size_t nfds,
+                  std::chrono::nanoseconds timeout) {
+  ++generation_;
+  next_.assign(nfds, no_index);
+
+  // The thread's io_uring is waited for directly, not through epoll.
+  auto* ring = uring::current();
+  int ring_fd = ring ? ring->fd() : -1;
+  bool want_ring = false;
+
+  // Merge the requested events per descriptor, chaining the entries that share
+  // one so that we can map the kernel events back to all of them.
+  for (std::size_t i = 0; i < nfds; i++) {
+    auto& p = fds[i];
+    p.revents = 0;
+    if (p.fd < 0) continue;
+    if (p.fd == ring_fd) {
+      want_ring = true;
+      continue;
+    }
+    auto& w = watches_[p.fd];
+    if (w.generation != generation_) {
+      w.generation = generation_;
+      w.wanted = 0;
+      w.first = no_index;
+    }
+    w.wanted |= to_epoll_events(p.events);
+    next_[i] = w.first;
+    w.first = i;
+  }
+
+  // Bring the kernel's interest set in line with the requested one.
+  bool have_immediate = false;
+  for (auto it = watches_.begin(); it != watches_.end();) {
+    auto fd = it->first;
+    auto& w = it->second;
+    if (w.generation != generation_) {
+      if (w.registered) ::epoll_ctl(*epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+      it = watches_.erase(it);
+      continue;
+    }
+    if (!sync(fd, w)) {
+      // epoll refuses regular files (which poll() reports as always ready) and
+      // invalid descriptors (which poll() flags with POLLNVAL).
+      short revents = (errno == EPERM) ? (POLLIN | POLLOUT)  // NOLINT
+                                       : POLLNVAL;
+      for (auto i = w.first; i != no_index; i = next_[i]) {
+        fds[i].revents = revents & (fds[i].events | POLLNVAL);
+      }
+      have_immediate = true;
+    }
+    ++it;
+  }
+
+  // One more event for the timer.
+  events_.resize(watches_.size() + 1);
+  if (have_immediate) timeout = std::chrono::nanoseconds::zero();
+  bool ring_ready = false;
+  int num_events;
+  if (want_ring) {
+    if (ring_.get() != ring) {
+      if (ring_) ring_->unwatch(*epoll_fd_);
+      ring_ = ring->shared_from_this();
+    }
+    num_events = ring_wait(timeout, ring_ready);
+  } else {
+    if (ring) ring->submit();
+    num_events = epoll_wait(timeout);
+  }
+  if (num_events < 0) return num_events;
+
+  for (int e = 0; e < num_events; e++) {
+    auto it = watches_.find(events_[e].data.fd);
+    if (it == watches_.end()) continue;
+    auto revents = to_poll_events(events_[e].events);
+    for (auto i = it->second.first; i != no_index; i = next_[i]) {
+      fds[i].revents |= revents & (fds[i].events | POLLERR | POLLHUP);
+    }
+  }
+
+  int num_ready = 0;
+  for (std::size_t i = 0; i < nfds; i++) {
+    if (ring_ready && fds[i].fd == ring_fd) fds[i].revents |= POLLIN;
+    if (fds[i].revents) num_ready++;
+  }
+  return num_ready;
+}
+
+#else  // __linux__
+
+poller::poller() {}
+
+poller::~poller() {}
+
+int poller::poll(pollfd* fds, std::size_t nfds,
+                 std::chrono::nanoseconds timeout) {
+  return plain_poll(fds, nfds, timeout);
+}
+
+#endif  // __linux__
+
+}  // namespace arpc
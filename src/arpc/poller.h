@@ -0,0 +1,133 @@
+/// \file
+/// \brief Descriptor readiness engine backing select().
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_POLLER_H_
+#define ARPC_POLLER_H_
+
+#ifndef ESP_PLATFORM
+#include <poll.h>
+#else  // ESP_PLATFORM
+#include <sys/poll.h>
+#endif  // ESP_PLATFORM
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif  // __linux__
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "arpc/channel.h"
+#include "arpc/container/flat_map.h"
+
+namespace arpc {
+
+class uring;
+
+/// Readiness engine with the same contract as `poll(2)`, but with nanosecond
+/// timeouts.
+///
+/// On Linux the descriptors are kept registered in an epoll instance across
+/// calls, and only the differences with the previous call are sent to the
+/// kernel. Waiting then costs time proportional to the number of changes and
+/// of ready descriptors instead of the size of the whole set. Timeouts that
+/// aren't a whole number of milliseconds are implemented with a timerfd, so
+/// they aren't rounded. Elsewhere (or if epoll can't be set up) this falls
+/// back to plain `poll(2)`, rounding timeouts up to the next millisecond.
+///
+/// When `uring` is enabled, the operations queued in the thread's ring are
+/// submitted before waiting. If the ring's descriptor is among those to wait
+/// for, the wait itself is done by the ring, in the same system call, with the
+/// epoll instance watched by it.
+class poller {
+ public:
+  poller();
+  ~poller();
+  poller(const poller&) = delete;
+  poller& operator=(const poller&) = delete;
+
+  /// Wait for events in `fds`, filling in their `revents` fields.
+  ///
+  /// A negative `timeout` waits forever.
+  ///
+  /// \return The number of entries with non-zero `revents`, 0 on timeout or a
+  ///   negative number on error (with `errno` set).
+  int poll(pollfd* fds, std::size_t nfds, std::chrono::nanoseconds timeout);
+
+  /// Scope of a `select()` call, holding the poller for its thread and
+  /// nesting level. Nested calls (made from react functions) get their own
+  /// poller so that they don't disturb the interest set of the outer ones.
+  /// In a fiber, the scope waits through the fiber's `fiber_loop` instead.
+  class scope {
+   public:
+    scope();
+    ~scope();
+    scope(const scope&) = delete;
+    scope& operator=(const scope&) = delete;
+
+    /// Same as `poller::poll()` on the scope's poller.
+    int poll(pollfd* fds, std::size_t nfds, std::chrono::nanoseconds timeout);
+
+    /// Whether `poll()` itself checks the current context's cancellation, as
+    /// fiber loops do, so that callers needn't wait on `wait_cancelled()`.
+    bool checks_cancellation() const;
+
+   private:
+    poller* poller_;
+  };
+
+  /// Notify all pollers that a descriptor is about to be closed, so that the
+  /// same descriptor number gets registered anew when it's reused.
+  static void forget(int fd) noexcept;
+
+  /// Counter that changes whenever `forget()` is called for `fd` (and maybe
+  /// for a few other descriptors), to tell whether it was closed in between.
+  static std::uint32_t epoch(int fd) noexcept;
+
+ private:
+#ifdef __linux__
+  struct watch {
+    std::uint64_t generation = 0;
+    std::uint32_t epoch = 0;
+    std::uint32_t wanted = 0;
+    std::uint32_t events = 0;
+    bool registered = false;
+    std::size_t first = 0;
+  };
+
+  int epoll(pollfd* fds, std::size_t nfds, std::chrono::nanoseconds timeout);
+  int epoll_wait(std::chrono::nanoseconds timeout);
+  int ring_wait(std::chrono::nanoseconds timeout, bool& ring_ready);
+  bool sync(int fd, watch& w);
+
+  channel epoll_fd_;
+  channel timer_fd_;
+  std::uint64_t generation_ = 0;
+  flat_map<int, watch> watches_;
+  std::vector<std::size_t> next_;
+  std::vector<epoll_event> events_;
+  std::shared_ptr<uring> ring_;
+#endif  // __linux__
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_POLLER_H_
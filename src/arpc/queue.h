@@ -24,6 +24,7 @@
 
 #include <limits>
 #include <mutex>
+#include <optional>
 #include <queue>
 #include <utility>
 #include "arpc/awaitable.h"
@@ -50,29 +51,38 @@ class queue {
   size_type capacity() const { return max_size_; }
   bool empty() const {
     std::scoped_lock lock(mu_);
-    return data_.empty() == 0;
+    return data_.empty();
   }
   bool full() const {
     std::scoped_lock lock(mu_);
     return data_.size() == max_size_;
   }
   template <typename U>
-  void maybe_put(U&& u) {
+  bool try_put(U&& u) {
     std::scoped_lock lock(mu_);
-    if (data_.size() == max_size_) throw errors::try_again("Queue is full");
+    if (data_.size() == max_size_) return false;
     data_.push(std::forward<U>(u));
     update_flags();
+    return true;
   }
-  value_type maybe_get() {
+  std::optional<value_type> try_get() {
     std::scoped_lock lock(mu_);
-    value_type result;
-    if (data_.size() == 0) throw errors::try_again("Queue is empty");
-    result = std::move(data_.front());
+    if (data_.size() == 0) return std::nullopt;
+    std::optional<value_type> result(std::move(data_.front()));
     data_.pop();
     update_flags();
     return result;
   }
   template <typename U>
+  void maybe_put(U&& u) {
+    if (!try_put(std::forward<U>(u))) throw errors::try_again("Queue is full");
+  }
+  value_type maybe_get() {
+    auto result = try_get();
+    if (!result) throw errors::try_again("Queue is empty");
+    return std::move(*result);
+  }
+  template <typename U>
   void put(U&& u) {
     auto [res] = select(async_put(std::forward<U>(u)));
     *res;
@@ -136,17 +146,25 @@ class queue<void> {
     std::scoped_lock lock(mu_);
     return size_ == max_size_;
   }
-  void maybe_put() {
+  bool try_put() {
     std::scoped_lock lock(mu_);
-    if (size_ == max_size_) throw errors::try_again("Queue is full");
+    if (size_ == max_size_) return false;
     size_++;
     update_flags();
+    return true;
   }
-  void maybe_get() {
+  bool try_get() {
     std::scoped_lock lock(mu_);
-    if (size_ == 0) throw errors::try_again("Queue is empty");
+    if (size_ == 0) return false;
     size_--;
     update_flags();
+    return true;
+  }
+  void maybe_put() {
+    if (!try_put()) throw errors::try_again("Queue is full");
+  }
+  void maybe_get() {
+    if (!try_get()) throw errors::try_again("Queue is empty");
   }
   void put() {
     auto [res] = select(async_put());
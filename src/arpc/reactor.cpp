@@ -0,0 +1,349 @@
+/// \file
+/// \brief Persistent set of one-shot awaitables dispatched on readiness.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/reactor.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif  // __linux__
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <exception>
+#include <optional>
+#include <utility>
+#include "arpc/clock.h"
+#include "arpc/errors.h"
+
+namespace arpc {
+
+namespace {
+
+#ifdef __linux__
+// Events handled by a single dispatch; any others are left for the next one.
+constexpr int max_events = 64;
+#endif  // __linux__
+
+}  // namespace
+
+reactor::reactor()
+#ifdef __linux__
+    : epoll_fd_(::epoll_create1(EPOLL_CLOEXEC))
+#endif  // __linux__
+{
+  wake_fd_ = wake_.async_wait().get_fd();
+#ifdef __linux__
+  if (!epoll_fd_) throw_io_error("Error creating the reactor's epoll instance");
+  // The wake-up flag stays registered, level-triggered.
+  epoll_event ev = {EPOLLIN, {}};
+  ev.data.fd = wake_fd_;
+  if (::epoll_ctl(*epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev))
+    throw_io_error("Error registering the reactor's wake-up descriptor");
+#endif  // __linux__
+}
+
+reactor::~reactor() {}
+
+reactor::key reactor::arm(awaitable<void> a) {
+  if (a.timeout() > std::chrono::nanoseconds::zero())
+    throw errors::invalid_argument("Reactor awaitables can't have timeouts");
+
+  std::uint64_t id;
+  {
+    std::scoped_lock lock(mu_);
+    id = ++next_id_;
+    locations_[id] = dispatching_location;
+  }
+  return arm(entry{id, std::move(a)});
+}
+
+reactor::key reactor::arm(entry e) {
+  auto& a = e.a;
+  if (a.timeout() == std::chrono::nanoseconds::zero() ||
+      (a.get_ready_fn() && a.get_ready_fn()())) {
+    return make_immediate(std::move(e));
+  }
+
+  int fd = a.get_fd();
+  std::optional<entry> dropped;
+  std::scoped_lock lock(mu_);
+  auto location = locations_.find(e.id);
+  if (fd < 0 || location == locations_.end()) {
+    // Can never become ready, or was disarmed while being dispatched.
+    if (location != locations_.end()) locations_.erase(location);
+    dropped.emplace(std::move(e));
+    return {};
+  }
+
+  location->second = fd;
+  auto& w = watches_[fd];
+  key k{fd, e.id};
+  (a.for_write() ? w.writers : w.readers).push_back(std::move(e));
+  size_++;
+  sync(fd, w);
+  return k;
+}
+
+bool reactor::disarm(const key& k) {
+  std::optional<entry> dropped;
+  std::scoped_lock lock(mu_);
+
+  auto location = locations_.find(k.id);
+  if (location == locations_.end()) return false;
+  int fd = location->second;
+  locations_.erase(location);
+  // Dispatches skip entries no longer in `locations_`.
+  if (fd == dispatching_location) return true;
+
+  // Awaitables can't be move-assigned, so the others are moved to a new vector.
+  auto take = [&dropped, &k](std::vector<entry>& entries) {
+    auto it = std::find_if(entries.begin(), entries.end(),
+                           [&k](const entry& e) { return e.id == k.id; });
+    if (it == entries.end()) return false;
+    std::vector<entry> kept;
+    kept.reserve(entries.size() - 1);
+    for (auto& e : entries) {
+      if (e.id == k.id) {
+        dropped.emplace(std::move(e));
+      } else {
+        kept.push_back(std::move(e));
+      }
+    }
+    entries.swap(kept);
+    return true;
+  };
+
+  if (fd == immediate_location) {
+    if (!take(immediate_)) return false;
+    if (immediate_.empty()) wake_.reset();
+  } else {
+    auto it = watches_.find(fd);
+    if (it == watches_.end()) return false;
+    auto& w = it->second;
+    if (!take(w.readers) && !take(w.writers)) return false;
+    if (w.readers.empty() && w.writers.empty()) {
+#ifdef __linux__
+      ::epoll_ctl(*epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+#endif  // __linux__
+      watches_.erase(it);
+    } else {
+      sync(fd, w);
+    }
+  }
+  size_--;
+  return true;
+}
+
+awaitable<void> reactor::async_dispatch() {
+#ifdef __linux__
+  return awaitable<void>(*epoll_fd_).then([this]() { dispatch(); });
+#else   // __linux__
+  return polling(std::chrono::milliseconds(1))
+      .ready_when([this]() { return any_ready(); })
+      .then([this]() { dispatch(); });
+#endif  // __linux__
+}
+
+void reactor::clear() {
+  std::unordered_map<int, watch> watches;
+  std::vector<entry> immediate;
+  {
+    std::scoped_lock lock(mu_);
+    watches.swap(watches_);
+    immediate.swap(immediate_);
+    locations_.clear();
+#ifdef __linux__
+    for (const auto& [fd, w] : watches) {
+      ::epoll_ctl(*epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+    }
+#endif  // __linux__
+    size_ = 0;
+    wake_.reset();
+  }
+  // The react functions of the awaitables might own objects whose destruction
+  // needs the reactor, so they are dropped without holding the lock.
+}
+
+std::size_t reactor::size() const {
+  std::scoped_lock lock(mu_);
+  return size_;
+}
+
+void reactor::dispatch() {
+  // Threads running a loop in coarse mode read the clock once per iteration.
+  deadline_clock::refresh();
+  std::vector<entry> ready;
+  {
+    std::scoped_lock lock(mu_);
+
+#ifdef __linux__
+    epoll_event events[max_events];
+    int num_events = ::epoll_wait(*epoll_fd_, events, max_events, 0);
+    if (num_events < 0 && errno != EINTR)
+      throw_io_error("Error waiting for reactor events");
+    for (int i = 0; i < num_events; i++) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_) continue;
+      auto ev = events[i].events;
+      collect(fd, ev & (EPOLLIN | EPOLLHUP | EPOLLERR),
+              ev & (EPOLLOUT | EPOLLHUP | EPOLLERR), ready);
+    }
+#else   // __linux__
+    auto fds = pollfds();
+    if (::poll(fds.data(), fds.size(), 0) < 0 && errno != EINTR)
+      throw_io_error("Error waiting for reactor events");
+    for (const auto& p : fds) {
+      collect(p.fd, p.revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL),
+              p.revents & (POLLOUT | POLLHUP | POLLERR | POLLNVAL), ready);
+    }
+#endif  // __linux__
+
+    if (wake_) {
+      wake_.reset();
+      size_ -= immediate_.size();
+      for (auto& e : immediate_) {
+        locations_[e.id] = dispatching_location;
+        ready.push_back(std::move(e));
+      }
+      immediate_.clear();
+    }
+  }
+
+  std::exception_ptr first_error;
+  for (auto& e : ready) {
+    // Awaitables armed again keep their id, so that they can still be
+    // disarmed with the same key. arm() drops those disarmed meanwhile.
+    if (e.a.get_ready_fn() && !e.a.get_ready_fn()()) {
+      arm(std::move(e));
+      continue;
+    }
+    {
+      // Past this point disarm() can't stop the react function.
+      std::scoped_lock lock(mu_);
+      if (locations_.erase(e.id) == 0) continue;
+    }
+    try {
+      e.a.get_react_fn()();
+    } catch (const errors::try_again&) {
+      {
+        std::scoped_lock lock(mu_);
+        locations_[e.id] = dispatching_location;
+      }
+      arm(std::move(e));
+    } catch (...) {
+      if (!first_error) first_error = std::current_exception();
+    }
+  }
+  if (first_error) std::rethrow_exception(first_error);
+}
+
+void reactor::collect(int fd, bool readable, bool writable,
+                      std::vector<entry>& ready) {
+  auto it = watches_.find(fd);
+  if (it == watches_.end()) return;
+  auto& w = it->second;
+
+  if (readable) {
+    size_ -= w.readers.size();
+    for (auto& e : w.readers) {
+      locations_[e.id] = dispatching_location;
+      ready.push_back(std::move(e));
+    }
+    w.readers.clear();
+  }
+  if (writable) {
+    size_ -= w.writers.size();
+    for (auto& e : w.writers) {
+      locations_[e.id] = dispatching_location;
+      ready.push_back(std::move(e));
+    }
+    w.writers.clear();
+  }
+
+  if (w.readers.empty() && w.writers.empty()) {
+    // The one-shot registration stays in the epoll instance, disabled.
+    watches_.erase(it);
+  } else {
+    sync(fd, w);
+  }
+}
+
+void reactor::sync(int fd, watch& w) {
+#ifdef __linux__
+  epoll_event ev = {EPOLLONESHOT, {}};
+  if (!w.readers.empty()) ev.events |= EPOLLIN;
+  if (!w.writers.empty()) ev.events |= EPOLLOUT;
+  ev.data.fd = fd;
+  if (!::epoll_ctl(*epoll_fd_, EPOLL_CTL_MOD, fd, &ev)) return;
+  if (errno == ENOENT && !::epoll_ctl(*epoll_fd_, EPOLL_CTL_ADD, fd, &ev))
+    return;
+
+  // Descriptors that epoll can't watch (like regular files) are always ready.
+  for (auto* entries : {&w.readers, &w.writers}) {
+    for (auto& e : *entries) {
+      locations_[e.id] = immediate_location;
+      immediate_.push_back(std::move(e));
+    }
+  }
+  watches_.erase(fd);
+  wake_.set();
+#endif  // __linux__
+}
+
+reactor::key reactor::make_immediate(entry e) {
+  std::optional<entry> dropped;
+  std::scoped_lock lock(mu_);
+  auto location = locations_.find(e.id);
+  if (location == locations_.end()) {
+    // Disarmed while being dispatched.
+    dropped.emplace(std::move(e));
+    return {};
+  }
+  location->second = immediate_location;
+  key k{immediate_location, e.id};
+  immediate_.push_back(std::move(e));
+  size_++;
+  wake_.set();
+  return k;
+}
+
+#ifndef __linux__
+bool reactor::any_ready() {
+  if (wake_) return true;
+
+  std::scoped_lock lock(mu_);
+  auto fds = pollfds();
+  return ::poll(fds.data(), fds.size(), 0) > 0;
+}
+
+std::vector<pollfd> reactor::pollfds() const {
+  std::vector<pollfd> fds;
+  fds.reserve(watches_.size());
+  for (const auto& [fd, w] : watches_) {
+    short events = 0;  // NOLINT(runtime/int)
+    if (!w.readers.empty()) events |= POLLIN;
+    if (!w.writers.empty()) events |= POLLOUT;
+    fds.push_back({fd, events, 0});
+  }
+  return fds;
+}
+#endif  // __linux__
+
+}  // namespace arpc
@@ -0,0 +1,135 @@
+/// \file
+/// \brief Persistent set of one-shot awaitables dispatched on readiness.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_REACTOR_H_
+#define ARPC_REACTOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "arpc/awaitable.h"
+#include "arpc/channel.h"
+#include "arpc/flag.h"
+#include "arpc/poller.h"
+
+namespace arpc {
+
+/// Set of awaitables that stay registered until they become ready, so that a
+/// loop serving many of them doesn't have to build a new `select()` over all
+/// of them for every event.
+///
+/// Awaitables are armed once with `arm()`, from any thread. The awaitable
+/// returned by `async_dispatch()` becomes ready when any of them may be, and
+/// reacting to it calls the react functions of those that are, each of them
+/// only once: to keep waiting on the same condition, arm a new awaitable
+/// (typically when the state it depends on changes). Awaitables that turn out
+/// not to be ready after all, or whose react function throws
+/// `errors::try_again`, are armed again. Descriptors mustn't be closed while
+/// awaitables are armed on them.
+///
+/// On Linux the armed descriptors are kept in an epoll instance with one-shot
+/// registrations, so the cost of an event doesn't depend on how many
+/// awaitables are armed. Elsewhere the armed descriptors are polled every
+/// millisecond.
+class reactor {
+ public:
+  reactor();
+  ~reactor();
+  reactor(const reactor&) = delete;
+  reactor& operator=(const reactor&) = delete;
+
+  /// Identifies an armed awaitable, to disarm it. It keeps doing so when the
+  /// awaitable is armed again, wherever it ends up.
+  struct key {
+    int fd = -1;
+    std::uint64_t id = 0;
+  };
+
+  /// Wait for `a` to be ready and then call its react function from a
+  /// dispatch. Timeouts aren't supported.
+  key arm(awaitable<void> a);
+
+  /// Drop an armed awaitable without calling it. An awaitable being dispatched
+  /// is dropped unless its react function has already been called.
+  ///
+  /// \return Whether it was still armed.
+  bool disarm(const key& k);
+
+  /// Awaitable that's ready when armed awaitables may be ready. Reacting to it
+  /// calls the react functions of those that are.
+  ///
+  /// If some of them throw, the rest are still called and the first exception
+  /// is rethrown at the end.
+  awaitable<void> async_dispatch();
+
+  /// Drop all the armed awaitables without calling them.
+  void clear();
+
+  /// Number of awaitables currently armed.
+  std::size_t size() const;
+
+ private:
+  struct entry {
+    std::uint64_t id;
+    awaitable<void> a;
+  };
+
+  struct watch {
+    std::vector<entry> readers;
+    std::vector<entry> writers;
+  };
+
+  // Where entries are found in `locations_`: the descriptor they're watched
+  // on, or one of these.
+  static constexpr int immediate_location = -1;
+  static constexpr int dispatching_location = -2;
+
+  key arm(entry e);
+  void dispatch();
+  void collect(int fd, bool readable, bool writable,
+               std::vector<entry>& ready);
+  void sync(int fd, watch& w);
+  key make_immediate(entry e);
+#ifndef __linux__
+  bool any_ready();
+  std::vector<pollfd> pollfds() const;
+#endif  // __linux__
+
+  mutable std::mutex mu_;
+  std::size_t size_ = 0;
+  std::uint64_t next_id_ = 0;
+  std::unordered_map<int, watch> watches_;
+  std::vector<entry> immediate_;
+  // Location of every armed entry by id, including those taken out for a
+  // dispatch and not yet called. Entries missing from it have been disarmed.
+  std::unordered_map<std::uint64_t, int> locations_;
+  flag wake_;
+  int wake_fd_ = -1;
+#ifdef __linux__
+  channel epoll_fd_;
+#endif  // __linux__
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_REACTOR_H_
@@ -0,0 +1,62 @@
+/// \file
+/// \brief Queue of requests ordered by priority and deadline.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/request_scheduler.h"
+#include <algorithm>
+
+namespace arpc {
+
+bool request_scheduler::less_urgent::operator()(const entry& a,
+                                                const entry& b) const {
+  if (a.priority != b.priority) return a.priority < b.priority;
+  if (a.deadline != b.deadline) return a.deadline > b.deadline;
+  return a.sequence > b.sequence;
+}
+
+void request_scheduler::submit(fn_type fn, int priority,
+                               std::optional<time_point> deadline) {
+  std::scoped_lock lock(mu_);
+  heap_.push_back(entry{priority, deadline.value_or(time_point::max()),
+                        next_sequence_++, std::move(fn)});
+  std::push_heap(heap_.begin(), heap_.end(), less_urgent{});
+}
+
+bool request_scheduler::run_next() {
+  fn_type fn;
+  {
+    std::scoped_lock lock(mu_);
+    if (heap_.empty()) return false;
+    std::pop_heap(heap_.begin(), heap_.end(), less_urgent{});
+    fn = std::move(heap_.back().fn);
+    heap_.pop_back();
+  }
+  fn();
+  return true;
+}
+
+std::size_t request_scheduler::size() {
+  std::scoped_lock lock(mu_);
+  return heap_.size();
+}
+
+bool request_scheduler::empty() { return size() == 0; }
+
+}  // namespace arpc
@@ -0,0 +1,89 @@
+/// \file
+/// \brief Queue of requests ordered by priority and deadline.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_REQUEST_SCHEDULER_H_
+#define ARPC_REQUEST_SCHEDULER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <utility>
+#include <vector>
+#include "arpc/clock.h"
+#include "function2/function2.hpp"
+
+namespace arpc {
+
+/// Queue of functions run in order of priority, then of deadline.
+///
+/// Among functions of the same priority, those with the earliest deadline run
+/// first, then those without a deadline, and ties go in the order they were
+/// pushed. Under overload, this lets requests close to their deadline run
+/// before those that can wait, instead of all of them waiting in FIFO order
+/// until it's too late.
+///
+/// The scheduler has no threads of its own: each call to `run_next()` runs
+/// the most urgent function queued at that point, so an executor can be handed
+/// one call to `run_next()` per function pushed.
+class request_scheduler {
+ public:
+  using time_point = deadline_clock::time_point;
+
+  /// Queue `f` with the given priority (higher runs first) and deadline.
+  template <typename F>
+  void push(F&& f, int priority = 0,
+            std::optional<time_point> deadline = std::nullopt) {
+    submit(fn_type(std::forward<F>(f)), priority, deadline);
+  }
+
+  /// Run the most urgent function queued, if any.
+  /// \return Whether there was one to run.
+  bool run_next();
+
+  std::size_t size();
+  bool empty();
+
+ private:
+  using fn_type = fu2::unique_function<void()>;
+
+  struct entry {
+    int priority;
+    time_point deadline;
+    std::uint64_t sequence;
+    fn_type fn;
+  };
+
+  // Heap order, with the most urgent entry on top.
+  struct less_urgent {
+    bool operator()(const entry& a, const entry& b) const;
+  };
+
+  void submit(fn_type fn, int priority, std::optional<time_point> deadline);
+
+  std::mutex mu_;
+  std::vector<entry> heap_;
+  std::uint64_t next_sequence_ = 0;
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_REQUEST_SCHEDULER_H_
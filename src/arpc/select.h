@@ -40,42 +40,56 @@
 #include "arpc/context.h"
 #include "arpc/errors.h"
 #include "arpc/mpt.h"
+#include "arpc/poller.h"
 #include "arpc/result_holder.h"
 
 namespace arpc {
 
 namespace detail {
 
+template <typename A>
+result_holder<typename A::return_type> react_one(A& a) {
+  result_holder<typename A::return_type> res;
+
+  try {
+    if constexpr (std::is_same_v<typename A::return_type, void>) {
+      a.get_react_fn()();
+      res.set_value();
+    } else {
+      res.set_value(std::move(a.get_react_fn()()));
+    }
+  } catch (const errors::try_again&) {
+  } catch (...) {
+    res.set_exception(std::current_exception());
+  }
+
+  return res;
+}
+
 template <typename A>
 result_holder<typename A::return_type> make_one_select_result(A& a, const pollfd& fd,
                                                               bool was_timeout,
-                                                              std::chrono::milliseconds min_timeout,
+                                                              std::chrono::nanoseconds min_timeout,
                                                               bool min_timeout_is_polling) {
   bool active;
   if (was_timeout) {
-    active = (a.timeout() >= std::chrono::milliseconds::zero() &&
+    active = (a.timeout() >= std::chrono::nanoseconds::zero() &&
               (a.timeout() <= min_timeout || (min_timeout_is_polling && a.for_polling())));
   } else {
     active = (fd.revents != 0);
   }
-
-  result_holder<typename A::return_type> res;
-
-  if (active) {
-    try {
-      if constexpr (std::is_same_v<typename A::return_type, void>) {
-        a.get_react_fn()();
-        res.set_value();
-      } else {
-        res.set_value(std::move(a.get_react_fn()()));
-      }
-    } catch (const errors::try_again&) {
-    } catch (...) {
-      res.set_exception(std::current_exception());
-    }
+  if (active && a.get_ready_fn()) {
+    active = a.get_ready_fn()();
   }
 
-  return res;
+  if (!active) return {};
+  return react_one(a);
+}
+
+template <typename A>
+result_holder<typename A::return_type> make_one_ready_result(A& a) {
+  if (!a.get_ready_fn() || !a.get_ready_fn()()) return {};
+  return react_one(a);
 }
 
 template <typename T>
@@ -96,18 +110,19 @@ struct select_input_helper<awaitable<T>> {
   static constexpr bool has_static_size = true;
   static constexpr std::size_t size(const awaitable<T>&) { return 1; }
   static result_type make_result(awaitable<T>& a, const pollfd* fd, bool was_timeout,
-                                 std::chrono::milliseconds min_timeout,
+                                 std::chrono::nanoseconds min_timeout,
                                  bool min_timeout_is_polling) {
     return make_one_select_result(a, *fd, was_timeout, min_timeout, min_timeout_is_polling);
   }
+  static result_type make_ready_result(awaitable<T>& a) { return make_one_ready_result(a); }
   static void fill_fds(const awaitable<T>& a, pollfd* fds) { *fds = make_pollfd(a); }
-  static auto timeout_info(const awaitable<T>& a, std::chrono::milliseconds elapsed) {
+  static auto timeout_info(const awaitable<T>& a, std::chrono::nanoseconds elapsed) {
     auto timeout = a.timeout();
     bool is_polling = a.for_polling();
 
-    if (timeout >= std::chrono::milliseconds::zero()) {
+    if (timeout >= std::chrono::nanoseconds::zero()) {
       if (is_polling) {
-        timeout = std::max(timeout - elapsed, std::chrono::milliseconds::zero());
+        timeout = std::max(timeout - elapsed, std::chrono::nanoseconds::zero());
       }
     }
 
@@ -121,7 +136,7 @@ struct select_input_helper<std::vector<awaitable<T>>> {
   static constexpr bool has_static_size = false;
   static constexpr std::size_t size(const std::vector<awaitable<T>>& v) { return v.size(); }
   static result_type make_result(std::vector<awaitable<T>>& v, const pollfd* fd, bool was_timeout,
-                                 std::chrono::milliseconds min_timeout,
+                                 std::chrono::nanoseconds min_timeout,
                                  bool min_timeout_is_polling) {
     result_type res;
     res.reserve(v.size());
@@ -131,24 +146,32 @@ struct select_input_helper<std::vector<awaitable<T>>> {
     }
     return res;
   }
+  static result_type make_ready_result(std::vector<awaitable<T>>& v) {
+    result_type res;
+    res.reserve(v.size());
+    for (auto& a : v) {
+      res.push_back(make_one_ready_result(a));
+    }
+    return res;
+  }
   static void fill_fds(const std::vector<awaitable<T>>& v, pollfd* fds) {
     for (const auto& a : v) {
       *fds++ = make_pollfd(a);
     }
   }
-  static auto timeout_info(const std::vector<awaitable<T>>& v, std::chrono::milliseconds elapsed) {
-    auto min_timeout = std::chrono::milliseconds(-1);
+  static auto timeout_info(const std::vector<awaitable<T>>& v, std::chrono::nanoseconds elapsed) {
+    auto min_timeout = std::chrono::nanoseconds(-1);
     bool min_timeout_is_polling = false;
 
     for (const auto& a : v) {
       auto timeout = a.timeout();
       bool is_polling = a.for_polling();
 
-      if (timeout >= std::chrono::milliseconds::zero()) {
+      if (timeout >= std::chrono::nanoseconds::zero()) {
         if (is_polling) {
-          timeout = std::max(timeout - elapsed, std::chrono::milliseconds::zero());
+          timeout = std::max(timeout - elapsed, std::chrono::nanoseconds::zero());
         }
-        if (min_timeout < std::chrono::milliseconds::zero() || timeout < min_timeout) {
+        if (min_timeout < std::chrono::nanoseconds::zero() || timeout < min_timeout) {
           min_timeout = timeout;
           min_timeout_is_polling = is_polling;
         }
@@ -210,13 +233,19 @@ constexpr std::size_t select_inputs_static_size(const std::tuple<Args...>& await
 template <typename... Args, std::size_t... ints>
 std::tuple<typename select_input<Args>::result_type...> make_select_result(
     std::tuple<Args...>& awaitables, const pollfd* pollfds, bool was_timeout,
-    std::chrono::milliseconds min_timeout, bool min_timeout_is_polling,
+    std::chrono::nanoseconds min_timeout, bool min_timeout_is_polling,
     mpt::index_sequence<ints...>) {
   return {std::move(select_input<Args>::make_result(
       mpt::at<ints>(awaitables), pollfds + pollfds_index<ints>(awaitables), was_timeout,
       min_timeout, min_timeout_is_polling))...};
 }
 
+template <typename... Args, std::size_t... ints>
+std::tuple<typename select_input<Args>::result_type...> make_ready_select_result(
+    std::tuple<Args...>& awaitables, mpt::index_sequence<ints...>) {
+  return {std::move(select_input<Args>::make_ready_result(mpt::at<ints>(awaitables)))...};
+}
+
 template <typename... Args, std::size_t... ints>
 void make_select_pollfds_helper(const std::tuple<Args...>& awaitables, pollfd* fds,
                                 mpt::index_sequence<ints...>) {
@@ -241,27 +270,54 @@ auto make_select_pollfds(const std::tuple<Args...>& awaitables) {
 
 }  // namespace detail
 
+/// Wait until at least one of the awaitables is ready, and react to it.
+///
+/// Awaitables known to be ready in user space (through their ready function)
+/// are reacted to without polling, and without building the awaitables for the
+/// current context's cancellation and deadline. The context's cancellation and
+/// deadline are still checked first.
 template <typename... Args>
-[[nodiscard]] auto select(Args&&... args) {
+[[nodiscard]] std::tuple<typename detail::select_input<Args>::result_type...> select(
+    Args&&... args) {
   auto& current_context = context::current();
+  if (current_context.is_cancelled()) {
+    throw errors::cancelled("Context is cancelled");
+  }
+  if (auto left = current_context.deadline_left(); left && *left <= context::duration::zero()) {
+    throw errors::deadline_exceeded("Deadline exceeded");
+  }
+
+  {
+    auto inputs = std::forward_as_tuple(args...);
+    auto res(detail::make_ready_select_result(inputs, mpt::make_index_sequence<sizeof...(Args)>{}));
+    bool active = mpt::accumulate(false, res, [](bool so_far, const auto& val) {
+      return so_far || detail::select_output<decltype(val)>::is_active(val);
+    });
+    if (active) return res;
+  }
+
+  poller::scope engine;
 
+  // Waiting on the context's cancellation takes a descriptor, which fibers
+  // leave to their loop.
   constexpr std::size_t n = sizeof...(Args) + 2;
-  auto a = std::tuple<Args..., awaitable<void>, awaitable<void>>(std::forward<Args>(args)...,
-                                                                 current_context.wait_cancelled(),
-                                                                 current_context.wait_deadline());
+  auto a = std::tuple<Args..., awaitable<void>, awaitable<void>>(
+      std::forward<Args>(args)...,
+      engine.checks_cancellation() ? never() : current_context.wait_cancelled(),
+      current_context.wait_deadline());
 
-  std::chrono::milliseconds elapsed = std::chrono::milliseconds::zero();
+  std::chrono::nanoseconds elapsed = std::chrono::nanoseconds::zero();
   auto last = std::chrono::steady_clock::now();
 
   do {
     // Find whether we have a timeout to apply, and whether it's a polling one.
     auto [min_timeout, min_timeout_is_polling] = mpt::accumulate(
-        std::pair(std::chrono::milliseconds(-1), false), a, [elapsed](auto prev, const auto& a) {
+        std::pair(std::chrono::nanoseconds(-1), false), a, [elapsed](auto prev, const auto& a) {
           auto& [min_timeout, min_timeout_is_polling] = prev;
           auto [timeout, is_polling] = detail::select_input<decltype(a)>::timeout_info(a, elapsed);
 
-          if (timeout >= std::chrono::milliseconds::zero()) {
-            if (min_timeout < std::chrono::milliseconds::zero() || timeout < min_timeout) {
+          if (timeout >= std::chrono::nanoseconds::zero()) {
+            if (min_timeout < std::chrono::nanoseconds::zero() || timeout < min_timeout) {
               min_timeout = timeout;
               min_timeout_is_polling = is_polling;
             }
@@ -272,7 +328,7 @@ template <typename... Args>
 
     auto fds(detail::make_select_pollfds(a));
 
-    int pres = poll(fds.data(), fds.size(), min_timeout / std::chrono::milliseconds(1));
+    int pres = engine.poll(fds.data(), fds.size(), min_timeout);
     if (pres < 0) throw_io_error("Error in select");
 
     auto res(detail::make_select_result(a, fds.data(), pres == 0, min_timeout,
@@ -293,7 +349,7 @@ template <typename... Args>
     }
 
     auto now = std::chrono::steady_clock::now();
-    elapsed += std::chrono::duration_cast<std::chrono::milliseconds>(now - last);
+    elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(now - last);
     last = now;
   } while (true);
 }
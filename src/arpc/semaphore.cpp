@@ -0,0 +1,108 @@
+/// \file
+/// \brief select-friendly semaphore objects.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/semaphore.h"
+#include "arpc/errors.h"
+#include "arpc/select.h"
+
+namespace arpc {
+
+semaphore::semaphore(size_type size) : max_size_(size) { update_flags(); }
+
+semaphore::size_type semaphore::size() const {
+  return size_.load(std::memory_order_acquire);
+}
+
+bool semaphore::empty() const { return size() == 0; }
+
+bool semaphore::full() const { return size() == max_size_; }
+
+bool semaphore::try_put() {
+  auto size = size_.load(std::memory_order_relaxed);
+  do {
+    if (size == max_size_) return false;
+  } while (!size_.compare_exchange_weak(size, size + 1,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed));
+  if (size == 0 || size + 1 == max_size_) update_flags();
+  return true;
+}
+
+bool semaphore::try_get() {
+  auto size = size_.load(std::memory_order_relaxed);
+  do {
+    if (size == 0) return false;
+  } while (!size_.compare_exchange_weak(size, size - 1,
+                                        std::memory_order_acq_rel,
+                                        std::memory_order_relaxed));
+  if (size == max_size_ || size == 1) update_flags();
+  return true;
+}
+
+void semaphore::maybe_put() {
+  if (!try_put()) throw errors::try_again("Semaphore is full");
+}
+
+void semaphore::maybe_get() {
+  if (!try_get()) throw errors::try_again("Semaphore is empty");
+}
+
+void semaphore::put() {
+  auto [res] = select(async_put());
+  *res;
+}
+
+void semaphore::get() {
+  auto [res] = select(async_get());
+  *res;
+}
+
+awaitable<void> semaphore::async_put() {
+  return can_put().then([this]() { maybe_put(); });
+}
+
+awaitable<void> semaphore::async_get() {
+  return can_get().then([this]() { maybe_get(); });
+}
+
+awaitable<void> semaphore::can_put() { return can_put_.async_wait(); }
+
+awaitable<void> semaphore::can_get() { return can_get_.async_wait(); }
+
+void semaphore::update_flags() {
+  // Concurrent transitions can finish out of order, so the flags are always
+  // derived from the latest count under the lock rather than from the
+  // transition that triggered the update.
+  std::scoped_lock lock(mu_);
+  auto size = size_.load(std::memory_order_acquire);
+  if (size == 0) {
+    can_get_.reset();
+  } else {
+    can_get_.set();
+  }
+  if (size == max_size_) {
+    can_put_.reset();
+  } else {
+    can_put_.set();
+  }
+}
+
+}  // namespace arpc
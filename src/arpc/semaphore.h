@@ -22,12 +22,49 @@
 #ifndef ARPC_SEMAPHORE_H_
 #define ARPC_SEMAPHORE_H_
 
-#include "arpc/queue.h"
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include "arpc/awaitable.h"
+#include "arpc/flag.h"
 
 namespace arpc {
 
-/// A semaphore is just a queue<void>.
-using semaphore = queue<void>;
+/// Bounded counting semaphore, with the same interface as a `queue<void>`.
+///
+/// The count is kept in an atomic, so putting and getting are lock-free and
+/// make no system calls unless the count goes from or to empty or full, which
+/// is when the flags backing `can_get()` and `can_put()` need to change.
+class semaphore {
+ public:
+  using size_type = std::size_t;
+  using value_type = void;
+
+  explicit semaphore(size_type size);
+  size_type size() const;
+  size_type max_size() const { return max_size_; }
+  size_type capacity() const { return max_size_; }
+  bool empty() const;
+  bool full() const;
+  bool try_put();
+  bool try_get();
+  void maybe_put();
+  void maybe_get();
+  void put();
+  void get();
+  awaitable<void> async_put();
+  awaitable<void> async_get();
+  awaitable<void> can_put();
+  awaitable<void> can_get();
+
+ private:
+  void update_flags();
+
+  std::mutex mu_;
+  std::atomic<size_type> size_ = 0;
+  const size_type max_size_;
+  flag can_get_, can_put_;
+};
 
 }  // namespace arpc
 
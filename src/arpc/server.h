@@ -23,8 +23,11 @@
 #define ARPC_SERVER_H_
 
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <limits>
 #include <memory>
@@ -32,19 +35,26 @@
 #include <optional>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
+#include "arpc/affinity.h"
 #include "arpc/binary_codecs.h"
+#include "arpc/clock.h"
 #include "arpc/connection.h"
 #include "arpc/container/flat_map.h"
 #include "arpc/executor.h"
-#include "arpc/flag.h"
+#include "arpc/fiber.h"
 #include "arpc/future.h"
 #include "arpc/message_defs.h"
 #include "arpc/mpt.h"
 #include "arpc/object_name.h"
 #include "arpc/packet_protocols.h"
 #include "arpc/queue.h"
+#include "arpc/reactor.h"
+#include "arpc/request_scheduler.h"
 #include "arpc/result_holder.h"
 #include "arpc/select.h"
 #include "arpc/semaphore.h"
@@ -53,6 +63,7 @@
 #include "arpc/thread.h"
 #include "arpc/type_hash.h"
 #include "arpc/usage_lock.h"
+#include "function2/function2.hpp"
 
 namespace arpc {
 
@@ -80,12 +91,14 @@ class connection_producer {
 
   ~connection_producer() { stop(); }
 
-  void start() {
+  /// \param cpus CPUs to pin the acceptor thread to, or empty for no pinning.
+  void start(const cpu_set& cpus = {}) {
     std::scoped_lock lock(mu_);
 
     if (!acceptor_.joinable()) {
       acceptor_ = daemon_thread(&connection_producer::produce, this);
     }
+    set_affinity(acceptor_, cpus);
   }
 
   void stop() {
@@ -97,6 +110,13 @@ class connection_producer {
     }
   }
 
+  /// \return The CPUs the acceptor thread may run on, or an empty set if it's not running.
+  cpu_set get_affinity() {
+    std::scoped_lock lock(mu_);
+
+    return acceptor_.joinable() ? arpc::get_affinity(acceptor_) : cpu_set();
+  }
+
   awaitable<std::unique_ptr<connection_type>> get_connection() { return output_.async_get(); }
 
   void return_connection(std::unique_ptr<connection_type> returned) {
@@ -124,7 +144,8 @@ using listener_connection_producer =
     connection_producer<listener_connection_factory<PacketProtocol>>;
 
 struct server_options {
-  // Timeout applied to each request (defaults to 1 hour).
+  // Timeout applied to each request from when it arrives (defaults to 1 hour). Requests that
+  // time out while queued are answered with `deadline_exceeded` without running them.
   std::optional<std::chrono::milliseconds> request_timeout = std::chrono::hours(1);
 
   // Number of threads in the server's thread pool.
@@ -133,6 +154,92 @@ struct server_options {
   // Queue size for the server requests (default negative for unlimited, zero for same as
   // num_worker_threads).
   int queue_size = -1;
+
+  // Number of independent shards serving connections. Each one accepts connections through its
+  // own connection producer, built from the server's constructor arguments (so these must allow
+  // binding the same address several times, like `reuse_port` for listeners), and serves them
+  // with its own reactor thread and thread pool. The worker threads are split evenly among the
+  // shards, and each one gets a request queue of `queue_size`.
+  unsigned int num_shards = 1;
+
+  // CPUs to pin each shard's reactor thread to, with shard i using entry i modulo the number of
+  // entries. Empty for no pinning.
+  std::vector<cpu_set> reactor_cpus;
+
+  // CPUs to pin each shard's acceptor thread to, as for `reactor_cpus`.
+  std::vector<cpu_set> acceptor_cpus;
+
+  // CPUs to pin the worker threads to. Workers are numbered across shards, so that worker j of
+  // shard i uses entry i * (workers per shard) + j modulo the number of entries. Empty for no
+  // pinning.
+  std::vector<cpu_set> worker_cpus;
+
+  // Do all the work for a connection (receiving requests, executing them and sending the
+  // responses) on a single worker of its shard, chosen when the connection is accepted, rather
+  // than on whichever worker is free. Along with `worker_cpus`, this keeps each connection's
+  // state in the caches of one CPU, but a slow request holds up the other connections on its
+  // worker.
+  bool colocate_connections = false;
+
+  // Give each shard an adaptive pool of worker threads within these bounds, instead of a fixed
+  // number of them. The pool grows while requests wait for a free worker (for instance, because
+  // handlers block on calls to other servers) and shrinks back once workers go idle. The bounds
+  // apply to each shard, and replace `num_worker_threads` (also for numbering workers in
+  // `worker_cpus`). Connections aren't colocated, as workers come and go.
+  std::optional<thread_pool::adaptive_options> adaptive_workers;
+
+  // Number of threads per shard running request handlers in fibers, or zero to run them on the
+  // shard's worker threads. In a fiber, a handler blocked in `select()` (waiting on a nested
+  // call's future, for instance) gives up its thread to other handlers until it can go on, so a
+  // few threads can serve many such requests at once. Receiving requests and sending responses
+  // stays on the worker threads.
+  unsigned int num_fiber_threads = 0;
+
+  // CPUs to pin the fiber threads to, numbered across shards as for `worker_cpus` but separately
+  // from the workers: fiber thread j of shard i uses entry i * `num_fiber_threads` + j modulo the
+  // number of entries. Empty for no pinning.
+  std::vector<cpu_set> fiber_cpus;
+
+  // Stack size for each fiber running a request handler.
+  std::size_t fiber_stack_size = fiber_loop::default_stack_size;
+
+  // Run each shard's reactor thread and fiber threads with `deadline_clock` in coarse mode, so
+  // that they read the clock once per loop iteration rather than for every deadline. Handlers in
+  // fibers then only see time advance when they block, so those spinning on inputs that are
+  // always ready don't notice their deadline passing until they do.
+  bool coarse_clock = false;
+
+  // Run queued requests in order of their object's priority and then of their deadline (the
+  // earliest of the client's and `request_timeout`), rather than in the order they arrive. Under
+  // overload, this serves requests that can still make it in time before those that can wait.
+  // Requests run on whichever worker or fiber thread is free, even with
+  // `colocate_connections`. Inline methods aren't queued, so they aren't scheduled.
+  bool schedule_requests = false;
+};
+
+// Options for an object registered in a server.
+struct object_options {
+  // Run the object's methods inline, on the worker thread that received the request, and send
+  // the response from that thread too when no other response is being sent on the connection.
+  // This saves two thread hops per request, which dominate the latency of very cheap methods
+  // (counters, cache lookups), but the connection doesn't receive further requests until the
+  // method returns, so it only suits methods that never block.
+  bool run_inline = false;
+
+  // Names of methods to run inline as with `run_inline`, leaving the object's other methods to
+  // run on the worker threads as usual.
+  std::vector<std::string> inline_methods;
+
+  // Priority of the object's requests with `server_options::schedule_requests`. Requests with
+  // higher priorities run first.
+  int priority = 0;
+};
+
+// Where the threads of a server shard may run, as returned by `server::placement()`.
+struct shard_placement {
+  cpu_set reactor;
+  cpu_set acceptor;
+  std::vector<cpu_set> workers;
 };
 
 template <typename ImplClass>
@@ -153,9 +260,20 @@ template <typename Encoder = little_endian_binary_encoder,
           typename ConnectionProducer = listener_connection_producer<PacketProtocol>>
 class server {
  private:
-  using method_fn = std::function<std::string(rpc_defs::request_id_type, std::string)>;
+  // Methods hand their encoded response to a callback rather than return it,
+  // so those returning a future can do so once it completes.
+  using respond_fn = fu2::unique_function<void(std::string)>;
+  using method_fn = std::function<void(rpc_defs::request_id_type, std::string, respond_fn)>;
   using method_fn_key = std::tuple<std::string, traits::type_hash_t>;
-  using method_fn_map = flat_map<method_fn_key, method_fn>;
+
+  struct method_entry {
+    method_fn fn;
+    bool run_inline = false;
+    int priority = 0;
+    // Set instead of `fn` when no method matches a request.
+    std::exception_ptr error;
+  };
+  using method_fn_map = flat_map<method_fn_key, method_entry>;
 
   struct object_entry {
     std::shared_ptr<void> ref;
@@ -165,228 +283,466 @@ class server {
 
   using connection_key = std::size_t;
   using connection_type = typename ConnectionProducer::connection_type;
-  class connection_wrapper {
+  using request_key = std::pair<connection_key, rpc_defs::request_id_type>;
+
+  class shard;
+
+  // A connection is only ever in one of two places as far as receiving goes:
+  // armed in its shard's reactor waiting for data, or being read by a task in
+  // the shard's thread pool, which arms it again when done. Responses are queued and
+  // written by a single task at a time, started by the first response queued
+  // while none is running. The connection is removed once receiving fails and
+  // no response is being written.
+  class connection_wrapper : public std::enable_shared_from_this<connection_wrapper> {
    public:
-    explicit connection_wrapper(server& server, connection_key key,
+    explicit connection_wrapper(shard& shard, connection_key key,
                                 std::unique_ptr<connection_type> connection)
-        : server_(server), key_(key), connection_(std::move(connection)) {
-      can_receive_.set();
-      can_send_.set();
-    }
-
-    awaitable<void> receive() {
-      std::scoped_lock lock(mu_);
-      if (failed_receive_) {
-        return never();
-      }
-
-      if (!can_receive_) {
-        return can_receive_.async_wait();
-      }
-
-      return connection_->data_available().then([this]() {
-        can_receive_.reset();
-
-        server_.pool_.run([this]() {
-          try {
-            auto request = connection_->receive();
-            string_input_stream request_is(request);
-
-            // A decoder for the header.
-            Decoder header_decoder(request_is);
-            rpc_defs::message_type message_type;
-            header_decoder(message_type);
-            rpc_defs::request_id_type req_id;
-            header_decoder(req_id);
-
-            switch (message_type) {
-              case rpc_defs::message_type::REQUEST:
-                request.erase(0, request_is.pos());
-                server_.queue_request(request_key{key_, req_id}, request);
-                break;
-              case rpc_defs::message_type::CANCEL_REQUEST:
-                server_.cancel_request(request_key{key_, req_id});
-                break;
-              default:
-                // Unknown message received.
-                throw errors::data_mismatch("Received unknown message type");
-                break;
-            }
+        : shard_(shard), key_(key), connection_(std::move(connection)) {}
 
-            receive_done();
-          } catch (...) {
-            receive_done(true);
-          }
-        });
-      });
+    void start_receive() {
+      shard_.reactor_.arm(connection_->data_available().then([self = this->shared_from_this()]() {
+        self->run([self]() { self->receive(); });
+      }));
     }
 
-    awaitable<void> send() {
-      std::scoped_lock lock(mu_);
-      if (failed_send_) {
-        return never();
-      }
-
-      if (!can_send_) {
-        return can_send_.async_wait();
+    // Run `f` on the shard's pool, on this connection's worker if connections are colocated.
+    template <typename F>
+    void run(F&& f) {
+      if (shard_.server_.options_.colocate_connections && shard_.pool_) {
+        shard_.pool_->run_on(key_, std::forward<F>(f));
+      } else {
+        shard_.run(std::forward<F>(f));
       }
+    }
 
-      return responses_.async_get().then([this](std::string response) {
-        can_send_.reset();
-
-        server_.pool_.run([this, response(std::move(response))]() mutable {
-          try {
-            connection_->send(std::move(response));
+    // Queue `response` for sending. If none is being sent and `send_inline` is true, send it
+    // right away on the calling thread rather than on the pool.
+    void add_response(std::string response, bool send_inline = false) {
+      {
+        std::scoped_lock lock(mu_);
+        if (removed_ || failed_send_) {
+          return;
+        }
 
-            send_done();
-          } catch (...) {
-            send_done(true);
-          }
-        });
-      });
-    }
+        responses_.push_back(std::move(response));
+        if (sending_) {
+          return;
+        }
+        sending_ = true;
+      }
 
-    awaitable<void> remove() {
-      return can_remove_.async_wait().then([this]() {
-        server_.acceptor_->return_connection(std::move(connection_));
-        server_.connections_.erase(key_);
-      });
+      if (send_inline) {
+        send();
+      } else {
+        run([self = this->shared_from_this()]() { self->send(); });
+      }
     }
 
-    void add_response(std::string response) { responses_.put(std::move(response)); }
-
    private:
-    void receive_done(bool failed = false) {
-      bool removed = false;
-      {
-        std::scoped_lock lock(mu_);
-        if (failed) {
-          failed_receive_ = true;
+    void receive() {
+      try {
+        auto request = connection_->receive();
+        string_input_stream request_is(request);
+
+        // A decoder for the header.
+        Decoder header_decoder(request_is);
+        rpc_defs::message_type message_type;
+        header_decoder(message_type);
+        rpc_defs::request_id_type req_id;
+        header_decoder(req_id);
+
+        switch (message_type) {
+          case rpc_defs::message_type::REQUEST:
+            request.erase(0, request_is.pos());
+            shard_.queue_request(this->shared_from_this(), request_key{key_, req_id}, request);
+            break;
+          case rpc_defs::message_type::CANCEL_REQUEST:
+            shard_.cancel_request(request_key{key_, req_id});
+            break;
+          default:
+            // Unknown message received.
+            throw errors::data_mismatch("Received unknown message type");
+            break;
         }
-        if (failed_send_ || (can_send_ && failed)) {
+      } catch (...) {
+        bool remove = false;
+        {
+          std::scoped_lock lock(mu_);
           failed_receive_ = true;
-          removed = true;
+          if (!sending_ && !removed_) {
+            removed_ = remove = true;
+          }
         }
-        can_receive_.set();
-      }
-      if (removed) {
-        can_remove_.set();
+        if (remove) {
+          shard_.remove_connection(key_, std::move(connection_));
+        }
+        return;
       }
+
+      start_receive();
     }
 
-    void send_done(bool failed = false) {
-      bool removed = false;
-      {
-        std::scoped_lock lock(mu_);
-        if (failed) {
-          failed_send_ = true;
+    void send() {
+      while (true) {
+        std::string response;
+        {
+          std::scoped_lock lock(mu_);
+          if (responses_.empty()) {
+            sending_ = false;
+            if (!failed_receive_ || removed_) {
+              return;
+            }
+            removed_ = true;
+            break;
+          }
+          response = std::move(responses_.front());
+          responses_.pop_front();
         }
-        if (failed_receive_ || (can_receive_ && failed)) {
+
+        try {
+          connection_->send(std::move(response));
+        } catch (...) {
+          std::scoped_lock lock(mu_);
           failed_send_ = true;
-          removed = true;
+          responses_.clear();
         }
-        can_send_.set();
-      }
-      if (removed) {
-        can_remove_.set();
       }
+
+      shard_.remove_connection(key_, std::move(connection_));
     }
 
-    server& server_;
+    shard& shard_;
     connection_key key_;
-    std::mutex mu_;
     std::unique_ptr<connection_type> connection_;
-    queue<std::string> responses_;
+    std::mutex mu_;
+    std::deque<std::string> responses_;
+    bool sending_ = false, removed_ = false;
     bool failed_receive_ = false, failed_send_ = false;
-    flag can_receive_, can_send_, can_remove_;
   };
 
-  using connection_map = flat_map<connection_key, std::unique_ptr<connection_wrapper>>;
+  using connection_map = flat_map<connection_key, std::shared_ptr<connection_wrapper>>;
 
-  using request_key = std::pair<connection_key, rpc_defs::request_id_type>;
-  using request_result = std::pair<request_key, std::string>;
   class request_wrapper {
    public:
-    explicit request_wrapper(server& server, future<request_result> result)
-        : server_(server), result_(std::move(result)), context_(context::top(), false) {}
+    request_wrapper() : context_(context::top(), false) {}
 
     context& get_context() { return context_; }
 
-    awaitable<void> finish() {
-      return result_.async_get().then([this](request_result result) {
-        auto& [request_key, data] = result;
-        auto cit = server_.connections_.find(request_key.first);
-        if (cit != server_.connections_.end()) {
-          cit->second->add_response(std::move(data));
-        }
-
-        server_.remove_request(request_key);
-      });
-    }
-
    private:
-    server& server_;
-    future<request_result> result_;
     context context_;
   };
   using request_map = flat_map<request_key, std::unique_ptr<request_wrapper>>;
 
-  void cancel_request(const request_key& key) {
-    std::scoped_lock lock(requests_mu_);
+  // Connections never move from the shard that accepted them, and each shard
+  // has its own acceptor, reactor, thread pool and maps, so that shards only
+  // share the registered objects.
+  class shard {
+   public:
+    shard(server& server, unsigned int index, unsigned int num_worker_threads)
+        : server_(server), index_(index) {
+      if (const auto& adaptive = server.options_.adaptive_workers) {
+        adaptive_pool_.emplace(*adaptive, server.options_.queue_size,
+                               thread_cpus(server.options_.worker_cpus, index,
+                                           adaptive->max_threads));
+      } else {
+        pool_.emplace(num_worker_threads, server.options_.queue_size,
+                      thread_cpus(server.options_.worker_cpus, index, num_worker_threads));
+      }
+      if (server.options_.num_fiber_threads > 0) {
+        fibers_.emplace(server.options_.num_fiber_threads, server.options_.fiber_stack_size,
+                        thread_cpus(server.options_.fiber_cpus, index,
+                                    server.options_.num_fiber_threads),
+                        server.options_.coarse_clock);
+      }
+      if (server.options_.schedule_requests) {
+        scheduler_.emplace();
+      }
+    }
+
+    ~shard() { stop(); }
+
+    void start() {
+      if (!acceptor_) {
+        server_.acceptor_factory_(acceptor_);
+      }
+
+      if (!reactor_thread_.joinable()) {
+        reactor_thread_ = daemon_thread(&shard::react, this);
+        set_affinity(reactor_thread_, pick_cpus(server_.options_.reactor_cpus, index_));
+      }
 
-    auto it = requests_.find(key);
-    if (it != requests_.end()) {
-      it->second->get_context().cancel();
+      acceptor_->start(pick_cpus(server_.options_.acceptor_cpus, index_));
     }
-  }
 
-  void remove_request(const request_key& key) {
-    std::scoped_lock lock(requests_mu_);
+    void stop() {
+      if (acceptor_) {
+        acceptor_->stop();
+      }
 
-    requests_.erase(key);
-  }
+      if (reactor_thread_.joinable()) {
+        reactor_thread_.get_context().cancel();
+        reactor_thread_.join();
+      }
+
+      // The armed awaitables hold references to the connections.
+      reactor_.clear();
+      {
+        std::scoped_lock connections_lock(connections_mu_);
+        connections_.clear();
+      }
+
+      acceptor_.reset();
+    }
+
+    shard_placement placement() {
+      shard_placement result;
+      if (reactor_thread_.joinable()) {
+        result.reactor = get_affinity(reactor_thread_);
+      }
+      if (acceptor_) {
+        result.acceptor = acceptor_->get_affinity();
+      }
+      result.workers = pool_ ? pool_->worker_affinity() : adaptive_pool_->worker_affinity();
+      return result;
+    }
+
+   private:
+    friend class connection_wrapper;
+
+    // Run `f` on whichever worker of the shard's pool is free.
+    template <typename F>
+    void run(F&& f) {
+      if (pool_) {
+        pool_->run(std::forward<F>(f));
+      } else {
+        adaptive_pool_->run(std::forward<F>(f));
+      }
+    }
+
+    static cpu_set pick_cpus(const std::vector<cpu_set>& cpus, std::size_t index) {
+      return cpus.empty() ? cpu_set() : cpus[index % cpus.size()];
+    }
+
+    // CPUs for the `num_threads` threads of a shard, numbered across shards.
+    static std::vector<cpu_set> thread_cpus(const std::vector<cpu_set>& cpus, unsigned int index,
+                                            unsigned int num_threads) {
+      std::vector<cpu_set> result;
+      if (!cpus.empty()) {
+        for (unsigned int i = 0; i < num_threads; i++) {
+          result.push_back(pick_cpus(cpus, index * num_threads + i));
+        }
+      }
+      return result;
+    }
 
-  void queue_request(const request_key& key, std::string request) {
-    std::scoped_lock lock(requests_mu_);
+    void remove_connection(connection_key key, std::unique_ptr<connection_type> connection) {
+      std::scoped_lock lock(connections_mu_);
 
-    if (requests_.count(key) > 0) {
-      // A previous request with the same key was already registered... dupe?
-      // Just drop the new one.
-      return;
+      // Connections dropped by stop() aren't returned to the producer.
+      if (connections_.erase(key) > 0) {
+        acceptor_->return_connection(std::move(connection));
+      }
+    }
+
+    void cancel_request(const request_key& key) {
+      std::scoped_lock lock(requests_mu_);
+
+      auto it = requests_.find(key);
+      if (it != requests_.end()) {
+        it->second->get_context().cancel();
+      }
     }
 
-    promise<request_result> promise;
-    auto wrapper_ptr = std::make_unique<request_wrapper>(*this, promise.get_future());
+    void remove_request(const request_key& key) {
+      std::scoped_lock lock(requests_mu_);
+
+      requests_.erase(key);
+    }
+
+    void queue_request(std::shared_ptr<connection_wrapper> connection, const request_key& key,
+                       std::string request) {
+      // Find the method on the receiving thread, to know where to run it.
+      auto method = server_.find_method(request);
+      bool run_inline = method.run_inline;
+      int priority = method.priority;
+      // Queued requests time out counting from their arrival, not from when they run.
+      std::optional<deadline_clock::time_point> deadline;
+      if (!run_inline) {
+        deadline = server_.request_deadline(request);
+      }
+
+      auto wrapper_ptr = std::make_unique<request_wrapper>();
+
+      // The response goes straight to the connection from the worker thread,
+      // without waking up the reactor.
+      auto& connection_ref = *connection;
+      auto handle = [this, connection(std::move(connection)), key, method(std::move(method)),
+                     request(std::move(request)), deadline,
+                     &parent_context(wrapper_ptr->get_context())]() mutable {
+        // The request is removed once its response is queued, which for
+        // methods returning a future can be after the handler returns, and
+        // the handler's context is gone, which removing it waits for.
+        auto remaining = std::make_shared<std::atomic<int>>(2);
+        auto done = [this, key, remaining]() {
+          if (remaining->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            remove_request(key);
+          }
+        };
+        try {
+          {
+            // Inline methods also send their response inline, but only from the receiving
+            // thread while it runs them: a future they return may be completed by another
+            // thread in the meantime, or later.
+            auto inline_thread =
+                method.run_inline ? std::this_thread::get_id() : std::thread::id();
+            context ctx(parent_context);
+            server_.execute(key.second, method, std::move(request), deadline,
+                            [connection, done, remaining,
+                             inline_thread](std::string response) {
+                              bool send_inline =
+                                  inline_thread == std::this_thread::get_id() &&
+                                  remaining->load(std::memory_order_acquire) == 2;
+                              try {
+                                connection->add_response(std::move(response), send_inline);
+                              } catch (...) {
+                                // Nothing can be sent back.
+                              }
+                              done();
+                            });
+          }
+          done();
+        } catch (...) {
+          // Nothing can be sent back.
+          remove_request(key);
+        }
+      };
+
+      {
+        std::scoped_lock lock(requests_mu_);
+
+        if (requests_.count(key) > 0) {
+          // A previous request with the same key was already registered... dupe?
+          // Just drop the new one.
+          return;
+        }
+
+        requests_.insert({key, std::move(wrapper_ptr)});
+      }
+
+      // Further requests on the connection wait until this one is done, as
+      // the connection is only received from again once this returns.
+      if (run_inline) {
+        handle();
+        return;
+      }
 
-    pool_.run([this, promise(std::move(promise)), key, request(std::move(request)),
-               &parent_context(wrapper_ptr->get_context())]() mutable {
+      // Queueing may block while the pool's queue is full, which can only drain as handlers
+      // finish and remove their requests, so it's done without holding `requests_mu_`.
+      if (scheduler_) {
+        // Each task run picks the most urgent request queued by then, so the request stays
+        // registered even if queueing its task fails: another task will run it.
+        scheduler_->push(std::move(handle), priority, deadline);
+        auto run_next = [this]() { scheduler_->run_next(); };
+        if (fibers_) {
+          fibers_->run(std::move(run_next));
+        } else {
+          run(std::move(run_next));
+        }
+        return;
+      }
       try {
-        context ctx(parent_context);
-        promise.set_value(request_result{key, std::move(execute(key.second, std::move(request)))});
+        if (fibers_) {
+          fibers_->run(std::move(handle));
+        } else {
+          connection_ref.run(std::move(handle));
+        }
       } catch (...) {
-        promise.set_exception(std::current_exception());
+        remove_request(key);
+        throw;
       }
-    });
+    }
 
-    requests_.insert({key, std::move(wrapper_ptr)});
-  }
+    awaitable<void> get_new_connection() {
+      return acceptor_->get_connection().then(
+          [this](std::unique_ptr<connection_type> new_connection) {
+            std::shared_ptr<connection_wrapper> wrapper;
+            {
+              std::scoped_lock lock(connections_mu_);
+
+              while (connections_.count(++next_connection_key_) > 0) {
+                // Ensure we prevent connection counter cycle collisions.
+              }
+              wrapper = std::make_shared<connection_wrapper>(*this, next_connection_key_,
+                                                           std::move(new_connection));
+              connections_.insert({next_connection_key_, wrapper});
+            }
+            wrapper->start_receive();
+          });
+    }
+
+    void react() {
+      std::optional<deadline_clock::coarse_scope> coarse;
+      if (server_.options_.coarse_clock) {
+        coarse.emplace();
+      }
+      while (true) {
+        auto [new_connection, dispatched] =
+            select(get_new_connection(), reactor_.async_dispatch());
+        if (new_connection) {
+          *new_connection;
+        }
+        if (dispatched) {
+          *dispatched;
+        }
+      }
+    }
+
+    server& server_;
+    unsigned int index_;
+    std::optional<ConnectionProducer> acceptor_;
+    connection_key next_connection_key_ = 0;
+    std::mutex connections_mu_;
+    connection_map connections_;
+    std::mutex requests_mu_;
+    request_map requests_;
+    reactor reactor_;
+    daemon_thread reactor_thread_;
+    // Outlives the pools, which may still have tasks running from it.
+    std::optional<request_scheduler> scheduler_;
+    // Only one of these is used, depending on `server_options::adaptive_workers`.
+    std::optional<work_stealing_pool> pool_;
+    std::optional<thread_pool> adaptive_pool_;
+    std::optional<fiber_pool> fibers_;
+  };
 
   template <typename Interface>
   static void register_object_interface(object_entry& entry,
-                                        const std::shared_ptr<Interface>& ref) {
-    mpt::for_each(typename Interface::extended_interfaces{}, [&entry, &ref](auto wrapped) {
-      using extended_interface = typename decltype(wrapped)::type;
-      register_object_interface(entry, std::static_pointer_cast<extended_interface>(ref));
-    });
-
-    mpt::for_each(typename Interface::method_descriptors{}, [&entry, &ref](auto wrapped) {
+                                        const std::shared_ptr<Interface>& ref,
+                                        const object_options& options) {
+    mpt::for_each(typename Interface::extended_interfaces{},
+                  [&entry, &ref, &options](auto wrapped) {
+                    using extended_interface = typename decltype(wrapped)::type;
+                    register_object_interface(
+                        entry, std::static_pointer_cast<extended_interface>(ref), options);
+                  });
+
+    mpt::for_each(typename Interface::method_descriptors{}, [&entry, &ref, &options](auto wrapped) {
       using method_info = typename decltype(wrapped)::type;
       constexpr auto method_hash = traits::type_hash_v<typename method_info::method_type>;
 
-      entry.methods[method_fn_key{method_info::name(), method_hash}] =
-          [ref](rpc_defs::request_id_type req_id, std::string request) {
+      auto& method = entry.methods[method_fn_key{method_info::name(), method_hash}];
+      method.run_inline = options.run_inline ||
+                          std::find(options.inline_methods.begin(), options.inline_methods.end(),
+                                    method_info::name()) != options.inline_methods.end();
+      method.priority = options.priority;
+      method.fn =
+          [ref](rpc_defs::request_id_type req_id, std::string request, respond_fn respond) {
             using return_type = typename method_info::return_type;
-            result_holder<return_type> result;
+            using value_type = future_value_t<return_type>;
+            result_holder<value_type> result;
+            // Only used for methods returning futures.
+            std::optional<std::conditional_t<is_future_v<return_type>, return_type, bool>>
+                pending;
 
             try {
               // Decode the call arguments.
@@ -399,7 +755,11 @@ class server {
               args_decoder(args);
 
               // Call the method and set the result value.
-              if constexpr (std::is_same_v<void, return_type>) {
+              if constexpr (is_future_v<return_type>) {
+                pending.emplace(
+                    std::apply(method_info::method_ptr,
+                               std::tuple_cat(std::forward_as_tuple(*ref), std::move(args))));
+              } else if constexpr (std::is_same_v<void, return_type>) {
                 std::apply(method_info::method_ptr,
                            std::tuple_cat(std::forward_as_tuple(*ref), std::move(args)));
                 result.set_value();
@@ -414,35 +774,63 @@ class server {
               result.set_exception(std::current_exception());
             }
 
-            std::string response;
-            string_output_stream request_os(response);
-
-            {
-              // An encoder for the header.
-              Encoder header_encoder(request_os);
-              // Message type: RPC request.
-              header_encoder(rpc_defs::message_type::RESPONSE);
-              // Request ID.
-              header_encoder(req_id);
-            }
-
-            {
-              // An encoder for the result.
-              Encoder result_encoder(request_os);
-              // Result.
-              result_encoder(result);
+            if constexpr (is_future_v<return_type>) {
+              if (pending) {
+                // Respond from whichever thread completes the future; the
+                // worker is free to take other requests meanwhile.
+                pending->on_complete([req_id, respond(std::move(respond))](
+                                         result_holder<value_type> result) mutable {
+                      std::string response;
+                      try {
+                        response = encode_response(req_id, result);
+                      } catch (...) {
+                        // Nobody up the stack can respond instead.
+                        result_holder<void> exception_result;
+                        exception_result.set_exception(std::current_exception());
+                        response = encode_response(req_id, exception_result);
+                      }
+                      respond(std::move(response));
+                    });
+                return;
+              }
             }
-
-            return response;
+            respond(encode_response(req_id, result));
           };
     });
   }
 
-  std::string execute(rpc_defs::request_id_type req_id, std::string request) {
+  template <typename T>
+  static std::string encode_response(rpc_defs::request_id_type req_id,
+                                     const result_holder<T>& result) {
+    std::string response;
+    string_output_stream response_os(response);
+
+    {
+      // An encoder for the header.
+      Encoder header_encoder(response_os);
+      // Message type: RPC response.
+      header_encoder(rpc_defs::message_type::RESPONSE);
+      // Request ID.
+      header_encoder(req_id);
+    }
+
+    {
+      // An encoder for the result.
+      Encoder result_encoder(response_os);
+      // Result.
+      result_encoder(result);
+    }
+
+    return response;
+  }
+
+  // Find the method called by `request`, and trim its object and method names from it. If
+  // there's none, the entry holds the error to respond with.
+  method_entry find_method(std::string& request) {
     try {
       string_input_stream request_is(request);
 
-      // A decoder for the method id and the context.
+      // A decoder for the method id.
       Decoder method_decoder(request_is);
       // Name of the remote object.
       std::string object_name;
@@ -454,108 +842,93 @@ class server {
       traits::type_hash_t method_hash;
       method_decoder(method_hash);
 
-      method_fn method;
-      {
-        std::scoped_lock lock(objects_mu_);
-
-        // Find the object entry.
-        auto oit = objects_.find(object_name);
-        if (oit == objects_.end()) {
-          throw errors::not_found("Object not found");
-        }
+      request.erase(0, request_is.pos());
 
-        // Find the method function.
-        auto mit = oit->second.methods.find({method_name, method_hash});
-        if (mit == oit->second.methods.end()) {
-          throw errors::not_found("Method not found in object");
-        }
+      std::scoped_lock lock(objects_mu_);
 
-        method = mit->second;
+      // Find the object entry.
+      auto oit = objects_.find(object_name);
+      if (oit == objects_.end()) {
+        throw errors::not_found("Object not found");
       }
 
-      // Current context.
-      context ctx;
-      method_decoder(ctx);
-
-      // Set any timeout.
-      if (options_.request_timeout) {
-        ctx.set_timeout(*options_.request_timeout);
+      // Find the method function.
+      auto mit = oit->second.methods.find({method_name, method_hash});
+      if (mit == oit->second.methods.end()) {
+        throw errors::not_found("Method not found in object");
       }
 
-      // What remains is the arguments for the actual object method. Trim the
-      // request data and call the method.
-      request.erase(0, request_is.pos());
-      return method(req_id, std::move(request));
+      return mit->second;
     } catch (...) {
-      // We directly return the result here if we caught an exception before
-      // getting to the object's function.
-      result_holder<void> exception_result;
-      exception_result.set_exception(std::current_exception());
-
-      std::string result_str;
-      string_output_stream result_is(result_str);
+      method_entry result;
+      result.error = std::current_exception();
+      return result;
+    }
+  }
 
-      {
-        // A encoder for the header.
-        Encoder header_encoder(result_is);
-        // Message type: RPC request.
-        header_encoder(rpc_defs::message_type::RESPONSE);
-        // Request ID.
-        header_encoder(req_id);
-      }
+  // When `request`, trimmed by `find_method()`, times out: the earliest of its context's
+  // deadline and `request_timeout` from now.
+  std::optional<deadline_clock::time_point> request_deadline(const std::string& request) {
+    auto now = deadline_clock::now();
+    std::optional<deadline_clock::time_point> deadline;
+    if (options_.request_timeout) {
+      deadline = now + *options_.request_timeout;
+    }
 
-      {
-        // A encoder for the result.
-        Encoder result_encoder(result_is);
-        // Result.
-        result_encoder(exception_result);
+    try {
+      string_input_stream request_is(request);
+      Decoder context_decoder(request_is);
+      if (auto left = context::load_deadline_left(context_decoder)) {
+        deadline = std::min(deadline.value_or(deadline_clock::time_point::max()), now + *left);
       }
-
-      return result_str;
+    } catch (...) {
+      // Any decoding errors are reported when executing the request.
     }
-  }
 
-  awaitable<void> get_new_connection() {
-    return acceptor_->get_connection().then(
-        [this](std::unique_ptr<connection_type> new_connection) {
-          while (connections_.count(++next_connection_key_) > 0) {
-            // Ensure we prevent connection counter cycle collisions.
-          }
-          connections_.insert(
-              {next_connection_key_, std::make_unique<connection_wrapper>(
-                                         *this, next_connection_key_, std::move(new_connection))});
-        });
+    return deadline;
   }
 
-  void react() {
-    std::vector<awaitable<void>> awaitables;
-    while (true) {
-      awaitables.clear();
-
-      awaitables.push_back(get_new_connection());
-
-      for (auto& cit : connections_) {
-        auto& wrapper = cit.second;
-        awaitables.push_back(wrapper->receive());
-        awaitables.push_back(wrapper->send());
-        awaitables.push_back(wrapper->remove());
+  // Call `respond` with the response to `request`, which may happen after
+  // returning for methods returning a future. A `deadline` computed by `request_deadline()` when
+  // the request arrived replaces the request timeout counted from now.
+  void execute(rpc_defs::request_id_type req_id, const method_entry& method, std::string request,
+               std::optional<deadline_clock::time_point> deadline, respond_fn respond) {
+    try {
+      if (method.error) {
+        std::rethrow_exception(method.error);
       }
-      {
-        std::scoped_lock lock(requests_mu_);
 
-        for (auto& rit : requests_) {
-          auto& wrapper = rit.second;
-          awaitables.push_back(wrapper->finish());
-        }
-      }
+      string_input_stream request_is(request);
 
-      auto [events] = select(awaitables);
+      // A decoder for the context.
+      Decoder context_decoder(request_is);
 
-      for (auto& event : events) {
-        if (event) {
-          *event;
+      // Current context.
+      context ctx;
+      context_decoder(ctx);
+
+      if (deadline) {
+        // Don't run requests that have already timed out while queued.
+        if (deadline_clock::now() >= *deadline) {
+          throw errors::deadline_exceeded("Request deadline exceeded before running it");
         }
+        ctx.set_deadline(std::chrono::time_point_cast<context::duration>(*deadline));
+      } else if (options_.request_timeout) {
+        // Set any timeout.
+        ctx.set_timeout(*options_.request_timeout);
       }
+
+      // What remains is the arguments for the actual object method. Trim the
+      // request data and call the method.
+      request.erase(0, request_is.pos());
+      method.fn(req_id, std::move(request), std::move(respond));
+    } catch (...) {
+      // We directly respond here if we caught an exception before getting to
+      // the object's function.
+      if (!respond) throw;
+      result_holder<void> exception_result;
+      exception_result.set_exception(std::current_exception());
+      respond(encode_response(req_id, exception_result));
     }
   }
 
@@ -563,23 +936,31 @@ class server {
   template <typename... Args>
   explicit server(const server_options& options, Args&&... args)
       : options_(options),
-        acceptor_factory_([args_tuple = std::make_tuple(std::forward<Args>(args)...), this]() {
-          return std::apply([this](const auto&... args) { acceptor_.emplace(args...); },
+        acceptor_factory_([args_tuple = std::make_tuple(std::forward<Args>(args)...)](
+                              std::optional<ConnectionProducer>& acceptor) {
+          return std::apply([&acceptor](const auto&... args) { acceptor.emplace(args...); },
                             args_tuple);
-        }),
-        pool_(options_.num_worker_threads, options_.queue_size) {}
+        }) {
+    auto num_shards = std::max(options_.num_shards, 1U);
+    auto num_worker_threads = std::max(options_.num_worker_threads / num_shards, 1U);
+    shards_.reserve(num_shards);
+    for (unsigned int i = 0; i < num_shards; i++) {
+      shards_.push_back(std::make_unique<shard>(*this, i, num_worker_threads));
+    }
+  }
 
   ~server() { stop(); }
 
   template <typename Impl, typename Name>
-  void register_object(Name&& name, server_object<Impl>& object) {
+  void register_object(Name&& name, server_object<Impl>& object,
+                       const object_options& options = {}) {
     std::scoped_lock lock(objects_mu_);
 
     auto key = object_name<ObjectNameEncoder>(std::forward<Name>(name));
     auto& entry = objects_[key];
     entry.ref = object.get_ref();
 
-    register_object_interface(entry, object.get_ref());
+    register_object_interface(entry, object.get_ref(), options);
   }
 
   template <typename Impl>
@@ -606,32 +987,30 @@ class server {
   void start() {
     std::scoped_lock lock(mu_);
 
-    if (!acceptor_) {
-      acceptor_factory_();
-    }
-
-    if (!reactor_.joinable()) {
-      reactor_ = daemon_thread(&server::react, this);
+    for (auto& s : shards_) {
+      s->start();
     }
-
-    acceptor_->start();
   }
 
   void stop() {
     std::scoped_lock lock(mu_);
 
-    if (acceptor_) {
-      acceptor_->stop();
-    }
-
-    if (reactor_.joinable()) {
-      reactor_.get_context().cancel();
-      reactor_.join();
+    for (auto& s : shards_) {
+      s->stop();
     }
+  }
 
-    connections_.clear();
+  /// \return Where the threads of each shard may run. The reactor and acceptor sets are empty
+  ///   for shards that aren't running.
+  std::vector<shard_placement> placement() {
+    std::scoped_lock lock(mu_);
 
-    acceptor_.reset();
+    std::vector<shard_placement> result;
+    result.reserve(shards_.size());
+    for (auto& s : shards_) {
+      result.push_back(s->placement());
+    }
+    return result;
   }
 
  private:
@@ -639,14 +1018,8 @@ class server {
   std::mutex mu_;
   std::mutex objects_mu_;
   object_map objects_;
-  std::optional<ConnectionProducer> acceptor_;
-  std::function<void()> acceptor_factory_;
-  connection_key next_connection_key_ = 0;
-  connection_map connections_;
-  std::mutex requests_mu_;
-  request_map requests_;
-  daemon_thread reactor_;
-  thread_pool pool_;
+  std::function<void(std::optional<ConnectionProducer>&)> acceptor_factory_;
+  std::vector<std::unique_ptr<shard>> shards_;
 };
 
 }  // namespace arpc
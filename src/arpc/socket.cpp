@@ -66,11 +66,12 @@ channel dial(endpoint name, bool non_blocking) {
 }
 
 listener::listener(endpoint name, bool reuse_addr, bool non_blocking,
-                   int backlog)
+                   int backlog, bool reuse_port)
     : non_blocking_(non_blocking) {
   auto addr_list = address_resolver::get().resolve(std::move(name.passive()));
   for (const auto& addr : addr_list) {
     auto s = socket(addr);
+    if (reuse_port) s.reuse_port();
     s.make_non_blocking(non_blocking_)
         .reuse_addr(reuse_addr)
         .bind(addr)
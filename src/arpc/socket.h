@@ -37,7 +37,8 @@ class listener {
  public:
   explicit listener(endpoint name, bool reuse_addr = true,
                     bool non_blocking = true,
-                    int backlog = channel::default_backlog);
+                    int backlog = channel::default_backlog,
+                    bool reuse_port = false);
 
   channel accept();
 
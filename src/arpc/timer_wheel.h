@@ -0,0 +1,267 @@
+/// \file
+/// \brief Hierarchical timer wheel.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_TIMER_WHEEL_H_
+#define ARPC_TIMER_WHEEL_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace arpc {
+
+/// \brief Hierarchical timing wheel holding values to be expired at given
+/// times.
+///
+/// Time is divided in ticks of a configurable resolution. Each level of the
+/// wheel has 64 slots, each covering 64 times as many ticks as those of the
+/// level below, and timers are moved down the levels as their time comes
+/// closer. Adding and removing timers is O(1) and expiring them is amortized
+/// O(1) per timer, however many timers are pending. Timers farther away than
+/// the wheel's span (about 30 hours at the default 100us resolution) are kept
+/// in an overflow list.
+///
+/// Timers never expire before their time, but may expire up to one tick
+/// later. Not thread-safe.
+template <typename T, typename Clock = std::chrono::steady_clock>
+class timer_wheel {
+ public:
+  using value_type = T;
+  using clock = Clock;
+  using time_point = typename Clock::time_point;
+  using duration = std::chrono::nanoseconds;
+
+  static constexpr duration default_resolution = std::chrono::microseconds(100);
+
+  explicit timer_wheel(duration resolution = default_resolution,
+                       time_point origin = Clock::now())
+      : resolution_(std::max(resolution, duration(1))), origin_(origin) {}
+
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /// Add a timer for `value` expiring at `when`.
+  void add(time_point when, T value) {
+    insert({std::max(tick_for(when), now_tick_), std::move(value)});
+    size_++;
+  }
+
+  /// Remove a timer previously added with the same `when` and `value`.
+  /// \return Whether the timer was found.
+  bool remove(time_point when, const T& value) {
+    auto tick = std::max(tick_for(when), now_tick_);
+    auto [level, slot] = position(tick);
+    if (level == num_levels) {
+      if (!erase(overflow_, tick, value)) return false;
+    } else {
+      auto& entries = slots_[level][slot];
+      if (!erase(entries, tick, value)) return false;
+      if (entries.empty()) occupied_[level] &= ~(std::uint64_t(1) << slot);
+    }
+    size_--;
+    return true;
+  }
+
+  /// Remove all timers.
+  void clear() {
+    for (auto& level : slots_) {
+      for (auto& entries : level) entries.clear();
+    }
+    for (auto& occupied : occupied_) occupied = 0;
+    overflow_.clear();
+    size_ = 0;
+  }
+
+  /// Time at which the earliest timer expires, if there's any.
+  std::optional<time_point> next_expiry() const {
+    for (int level = 0; level < num_levels; level++) {
+      // The current slot of the upper levels is always empty.
+      auto from = index(level, now_tick_) + (level == 0 ? 0 : 1);
+      auto slot = first_occupied(level, from);
+      if (slot < num_slots) return time_for(min_tick(slots_[level][slot]));
+    }
+    if (!overflow_.empty()) return time_for(min_tick(overflow_));
+    return std::nullopt;
+  }
+
+  /// Remove the timers expiring at or before `now`, calling `fn` with the
+  /// value of each of them.
+  template <typename F>
+  void expire(time_point now, F&& fn) {
+    if (now < origin_) return;
+    std::uint64_t target = (now - origin_) / resolution_;
+    std::vector<entry> expired;
+    while (size_ > 0 && now_tick_ <= target) {
+      take_current(expired);
+      auto next = next_event_tick();
+      if (next > target) break;
+      advance_to(next);
+    }
+    // Nothing left to move down the levels until the target, so skip ahead.
+    now_tick_ = std::max(now_tick_, target);
+    for (auto& e : expired) fn(std::move(e.value));
+  }
+
+ private:
+  static constexpr int slot_bits = 6;
+  static constexpr int num_slots = 1 << slot_bits;
+  static constexpr std::uint64_t slot_mask = num_slots - 1;
+  static constexpr int num_levels = 5;
+
+  struct entry {
+    std::uint64_t tick;
+    T value;
+  };
+
+  static std::uint64_t index(int level, std::uint64_t tick) {
+    return (tick >> (slot_bits * level)) & slot_mask;
+  }
+
+  // Ticks are counted from the origin and rounded up.
+  std::uint64_t tick_for(time_point when) const {
+    if (when <= origin_) return 0;
+    auto offset = std::chrono::ceil<duration>(when - origin_);
+    return (offset.count() + resolution_.count() - 1) / resolution_.count();
+  }
+
+  time_point time_for(std::uint64_t tick) const {
+    return origin_ + std::chrono::ceil<typename Clock::duration>(
+                         resolution_ * static_cast<duration::rep>(tick));
+  }
+
+  // The level of a timer is the lowest one whose slots span all the ticks
+  // that it shares with the current tick. The position of a timer is thus
+  // fully determined by its tick and the current tick.
+  std::pair<int, std::uint64_t> position(std::uint64_t tick) const {
+    auto diff = tick ^ now_tick_;
+    for (int level = 0; level < num_levels; level++) {
+      if ((diff >> (slot_bits * (level + 1))) == 0) {
+        return {level, index(level, tick)};
+      }
+    }
+    return {num_levels, 0};
+  }
+
+  void insert(entry e) {
+    auto [level, slot] = position(e.tick);
+    if (level < num_levels) {
+      slots_[level][slot].push_back(std::move(e));
+      occupied_[level] |= std::uint64_t(1) << slot;
+    } else {
+      overflow_.push_back(std::move(e));
+    }
+  }
+
+  static bool erase(std::vector<entry>& entries, std::uint64_t tick,
+                    const T& value) {
+    for (auto it = entries.begin(); it != entries.end(); ++it) {
+      if (it->tick == tick && it->value == value) {
+        *it = std::move(entries.back());
+        entries.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static std::uint64_t min_tick(const std::vector<entry>& entries) {
+    auto it = std::min_element(
+        entries.begin(), entries.end(),
+        [](const entry& a, const entry& b) { return a.tick < b.tick; });
+    return it->tick;
+  }
+
+  // First occupied slot of a level at or after `from`, or num_slots.
+  int first_occupied(int level, std::uint64_t from) const {
+    if (from >= static_cast<std::uint64_t>(num_slots)) return num_slots;
+    auto bits = occupied_[level] & (~std::uint64_t(0) << from);
+    return bits ? __builtin_ctzll(bits) : num_slots;
+  }
+
+  // Take the timers in the current slot of the lowest level.
+  void take_current(std::vector<entry>& expired) {
+    auto slot = index(0, now_tick_);
+    auto& entries = slots_[0][slot];
+    if (entries.empty()) return;
+    size_ -= entries.size();
+    std::move(entries.begin(), entries.end(), std::back_inserter(expired));
+    entries.clear();
+    occupied_[0] &= ~(std::uint64_t(1) << slot);
+  }
+
+  // The next tick after the current one where there are timers to expire or
+  // to move down the levels.
+  std::uint64_t next_event_tick() const {
+    for (int level = 0; level < num_levels; level++) {
+      auto slot = first_occupied(level, index(level, now_tick_) + 1);
+      if (slot < num_slots) {
+        auto span_bits = slot_bits * (level + 1);
+        return ((now_tick_ >> span_bits) << span_bits) +
+               (static_cast<std::uint64_t>(slot) << (slot_bits * level));
+      }
+    }
+    if (!overflow_.empty()) {
+      auto span_bits = slot_bits * num_levels;
+      return ((now_tick_ >> span_bits) + 1) << span_bits;
+    }
+    return ~std::uint64_t(0);
+  }
+
+  // Move to `tick`, moving down the timers of the slots that start there.
+  void advance_to(std::uint64_t tick) {
+    now_tick_ = tick;
+    if ((now_tick_ & ((std::uint64_t(1) << (slot_bits * num_levels)) - 1)) ==
+        0) {
+      std::vector<entry> entries;
+      entries.swap(overflow_);
+      for (auto& e : entries) insert(std::move(e));
+    }
+    for (int level = num_levels - 1; level > 0; level--) {
+      if ((now_tick_ & ((std::uint64_t(1) << (slot_bits * level)) - 1)) != 0) {
+        continue;
+      }
+      auto slot = index(level, now_tick_);
+      std::vector<entry> entries;
+      entries.swap(slots_[level][slot]);
+      occupied_[level] &= ~(std::uint64_t(1) << slot);
+      for (auto& e : entries) insert(std::move(e));
+    }
+  }
+
+  const duration resolution_;
+  const time_point origin_;
+  // Timers before this tick have expired; those at it expire on the next call
+  // to expire().
+  std::uint64_t now_tick_ = 0;
+  std::size_t size_ = 0;
+  std::uint64_t occupied_[num_levels] = {};
+  std::vector<entry> slots_[num_levels][num_slots];
+  std::vector<entry> overflow_;
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_TIMER_WHEEL_H_
@@ -38,6 +38,9 @@
 
 namespace arpc {
 
+template <typename T>
+class future;
+
 /// Trait classes for type hashing, based on 32-bit FNV-1.
 namespace traits {
 
@@ -254,6 +257,13 @@ struct new_type_hash<::arpc::field_descriptor<mptr>, Seen> {
       type_hash_v<typename ::arpc::field_descriptor<mptr>::data_type, Seen>;
 };
 
+// A future is sent as the value it holds, so methods returning `future<T>`
+// and `T` are interchangeable on the wire.
+template <typename T, typename Seen>
+struct new_type_hash<::arpc::future<T>, Seen> {
+  static constexpr type_hash_t value = type_hash_v<T, Seen>;
+};
+
 template <typename R, typename... A, typename Seen>
 struct new_type_hash<R(A...), Seen> {
   static constexpr type_hash_t value =
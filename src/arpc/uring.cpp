@@ -0,0 +1,612 @@
+/// \file
+/// \brief Completion-based I/O through Linux's io_uring.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/uring.h"
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include "arpc/errors.h"
+#include "arpc/poller.h"
+
+namespace arpc {
+
+namespace {
+std::atomic<bool> uring_enabled = false;
+
+// Channels can still be read from thread-local destructors after the ring of
+// the thread is gone; they use the readiness path from then on.
+thread_local bool thread_uring_destroyed = false;
+
+struct thread_uring {
+  ~thread_uring() { thread_uring_destroyed = true; }
+
+  std::shared_ptr<uring> ring;
+  bool failed = false;
+};
+
+thread_local thread_uring current_thread_uring;
+
+// What operations completed after their awaitables were destroyed got, to be
+// handed to the next read or accept on the same descriptor.
+struct leftover {
+  std::string data;
+  std::vector<int> accepted;
+};
+
+struct leftover_table {
+  std::mutex mu;
+  std::unordered_map<int, leftover> by_fd;
+  std::atomic<std::size_t> size = 0;
+};
+
+// Never destroyed, so that channels closed by static destructors can use it.
+leftover_table& leftovers() {
+  static auto* table = new leftover_table();
+  return *table;
+}
+
+void keep_leftover(int fd, std::uint32_t epoch, bool is_read, const void* buf,
+                   int result) {
+  auto& table = leftovers();
+  std::scoped_lock lock(table.mu);
+  auto [it, added] = table.by_fd.try_emplace(fd);
+  if (added) table.size.fetch_add(1, std::memory_order_relaxed);
+  // Pairs with the fence in forget(): either we see the descriptor's new epoch
+  // or it sees the entry and waits for us to drop it.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (poller::epoch(fd) != epoch) {
+    // The descriptor was closed meanwhile, so whatever reuses its number
+    // mustn't get this.
+    if (!is_read) ::close(result);
+  } else if (is_read) {
+    it->second.data.append(static_cast<const char*>(buf), result);
+  } else {
+    it->second.accepted.push_back(result);
+  }
+  if (it->second.data.empty() && it->second.accepted.empty()) {
+    table.by_fd.erase(it);
+    table.size.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+}  // namespace
+
+std::optional<std::size_t> uring::take_read(int fd, void* buf,
+                                            std::size_t len) {
+  auto& table = leftovers();
+  if (!table.size.load(std::memory_order_acquire)) return std::nullopt;
+  std::scoped_lock lock(table.mu);
+  auto it = table.by_fd.find(fd);
+  if (it == table.by_fd.end() || it->second.data.empty()) return std::nullopt;
+  auto& data = it->second.data;
+  auto num = std::min(len, data.size());
+  std::memcpy(buf, data.data(), num);
+  data.erase(0, num);
+  if (data.empty() && it->second.accepted.empty()) {
+    table.by_fd.erase(it);
+    table.size.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return num;
+}
+
+int uring::take_accept(int fd) {
+  auto& table = leftovers();
+  if (!table.size.load(std::memory_order_acquire)) return -1;
+  std::scoped_lock lock(table.mu);
+  auto it = table.by_fd.find(fd);
+  if (it == table.by_fd.end() || it->second.accepted.empty()) return -1;
+  auto& accepted = it->second.accepted;
+  int res = accepted.front();
+  accepted.erase(accepted.begin());
+  if (accepted.empty() && it->second.data.empty()) {
+    table.by_fd.erase(it);
+    table.size.fetch_sub(1, std::memory_order_relaxed);
+  }
+  return res;
+}
+
+void uring::forget(int fd) noexcept {
+  auto& table = leftovers();
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (!table.size.load(std::memory_order_relaxed)) return;
+  std::scoped_lock lock(table.mu);
+  auto it = table.by_fd.find(fd);
+  if (it == table.by_fd.end()) return;
+  for (int accepted : it->second.accepted) ::close(accepted);
+  table.by_fd.erase(it);
+  table.size.fetch_sub(1, std::memory_order_relaxed);
+}
+
+bool uring::enable(bool enable) {
+  if (enable && !available()) return false;
+  uring_enabled.store(enable, std::memory_order_relaxed);
+  return enable;
+}
+
+bool uring::enabled() { return uring_enabled.load(std::memory_order_relaxed); }
+
+uring* uring::current() {
+  if (!enabled() || thread_uring_destroyed) return nullptr;
+  auto& current = current_thread_uring;
+  if (!current.ring && !current.failed) {
+    std::shared_ptr<uring> ring(new uring());
+    if (ring->ring_fd_) {
+      current.ring = std::move(ring);
+    } else {
+      current.failed = true;
+    }
+  }
+  return current.ring.get();
+}
+
+int uring::fd() const { return ring_fd_.get(); }
+
+#if defined(__linux__) && defined(IORING_FEAT_EXT_ARG)
+
+namespace {
+constexpr unsigned sq_entries = 256;
+constexpr unsigned cq_entries = 4096;
+
+// The low bits of the user data of a completion tell what it's for. Zero is
+// for cancellations, which report nothing of interest.
+constexpr std::uint64_t watch_tag = 1;
+constexpr std::uint64_t poll_tag = 2;
+constexpr std::uint64_t tag_mask = 3;
+
+void set_poll_events(io_uring_sqe* sqe, std::uint32_t events) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  events = (events << 16) | (events >> 16);
+#endif
+  sqe->poll32_events = events;
+}
+}  // namespace
+
+struct uring::operation {
+  enum class state { idle, queued, submitted, completed };
+
+  std::uint8_t opcode;
+  int fd;
+  void* buf;
+  std::uint32_t len = 0;
+  socklen_t* addr_size = nullptr;
+  std::uint32_t epoch;
+  // Wait for readiness in the kernel before running the operation. Older
+  // kernels fail operations on non-blocking descriptors with EAGAIN instead.
+  bool poll_first = false;
+  state st = state::idle;
+  int result = 0;
+};
+
+struct uring::watch {
+  int fd;
+  bool armed = false;
+  bool ready = false;
+};
+
+bool uring::available() {
+  static const bool res = static_cast<bool>(uring().ring_fd_);
+  return res;
+}
+
+uring::uring() {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = cq_entries;
+  ring_fd_.reset(
+      static_cast<int>(::syscall(__NR_io_uring_setup, sq_entries, &params)));
+  if (!ring_fd_) return;
+
+  constexpr auto needed_features =
+      IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+  if ((params.features & needed_features) != needed_features) {
+    ring_fd_.reset();
+    return;
+  }
+
+  ring_size_ = std::max<std::size_t>(
+      params.sq_off.array + params.sq_entries * sizeof(unsigned),
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+  void* ring = ::mmap(nullptr, ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, *ring_fd_, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED) {
+    ring_fd_.reset();
+    return;
+  }
+  ring_ = ring;
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, *ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    ring_fd_.reset();
+    return;
+  }
+  sqes_ = sqes;
+
+  auto* base = static_cast<char*>(ring_);
+  sq_head_ = reinterpret_cast<unsigned*>(base + params.sq_off.head);
+  sq_tail_ = reinterpret_cast<unsigned*>(base + params.sq_off.tail);
+  sq_flags_ = reinterpret_cast<unsigned*>(base + params.sq_off.flags);
+  sq_mask_ = *reinterpret_cast<unsigned*>(base + params.sq_off.ring_mask);
+  sq_entries_ = params.sq_entries;
+  cq_head_ = reinterpret_cast<unsigned*>(base + params.cq_off.head);
+  cq_tail_ = reinterpret_cast<unsigned*>(base + params.cq_off.tail);
+  cq_mask_ = *reinterpret_cast<unsigned*>(base + params.cq_off.ring_mask);
+  cqes_ = base + params.cq_off.cqes;
+
+  // Submission queue entries are always used in order.
+  auto* array = reinterpret_cast<unsigned*>(base + params.sq_off.array);
+  for (unsigned i = 0; i < sq_entries_; i++) array[i] = i;
+}
+
+uring::~uring() {
+  if (sqes_) ::munmap(sqes_, sqes_size_);
+  if (ring_) ::munmap(ring_, ring_size_);
+}
+
+awaitable<int> uring::read(int fd, void* buf, std::size_t len) {
+  auto op = std::make_shared<operation>();
+  op->opcode = IORING_OP_READ;
+  op->fd = fd;
+  op->buf = buf;
+  op->len = static_cast<std::uint32_t>(
+      std::min<std::size_t>(len, std::numeric_limits<std::uint32_t>::max()));
+  op->epoch = poller::epoch(fd);
+  return make_awaitable(std::move(op));
+}
+
+awaitable<int> uring::accept(int fd, sockaddr* addr, socklen_t* addr_size) {
+  auto op = std::make_shared<operation>();
+  op->opcode = IORING_OP_ACCEPT;
+  op->fd = fd;
+  op->buf = addr;
+  op->addr_size = addr_size;
+  op->epoch = poller::epoch(fd);
+  return make_awaitable(std::move(op));
+}
+
+awaitable<int> uring::make_awaitable(std::shared_ptr<operation> op) {
+  // Once the awaitable and all the functions composed with it are gone, the
+  // operation is abandoned.
+  std::shared_ptr<operation> handle(
+      op.get(),
+      [ring = shared_from_this(), op](operation*) { ring->abandon(*op); });
+  return awaitable<void>(*ring_fd_)
+      .ready_when([this, handle]() { return poll(*handle); })
+      .then([this, handle]() { return take(*handle); });
+}
+
+bool uring::poll(operation& op) {
+  std::scoped_lock lock(mu_);
+  if (op.st == operation::state::idle) {
+    int leftover = -1;
+    if (op.opcode == IORING_OP_READ) {
+      if (auto num = take_read(op.fd, op.buf, op.len)) leftover = *num;
+    } else if ((leftover = take_accept(op.fd)) >= 0 && op.buf) {
+      ::getpeername(leftover, static_cast<sockaddr*>(op.buf), op.addr_size);
+    }
+    if (leftover >= 0) {
+      op.result = leftover;
+      op.st = operation::state::completed;
+      return true;
+    }
+
+    op.st = operation::state::queued;
+    queued_.push_back(&op);
+    if (current_thread_uring.ring.get() != this) {
+      // The poller of another thread won't submit it for us.
+      flush();
+      enter(pending_sqes(), 0, 0, std::chrono::nanoseconds(-1));
+    }
+  }
+  if (op.st != operation::state::completed) reap();
+  return op.st == operation::state::completed;
+}
+
+int uring::take(operation& op) {
+  std::scoped_lock lock(mu_);
+  op.st = operation::state::idle;
+  op.poll_first = false;
+  return op.result;
+}
+
+void uring::abandon(operation& op) noexcept {
+  std::unique_lock lock(mu_);
+  if (op.st == operation::state::submitted) {
+    cancel(reinterpret_cast<std::uint64_t>(&op));
+    if (op.poll_first) cancel(reinterpret_cast<std::uint64_t>(&op) | poll_tag);
+    enter(pending_sqes(), 0, 0, std::chrono::nanoseconds(-1));
+    while (op.st == operation::state::submitted) {
+      lock.unlock();
+      enter(0, 1, IORING_ENTER_GETEVENTS, std::chrono::milliseconds(1));
+      lock.lock();
+      reap();
+    }
+  }
+  if (op.st == operation::state::queued) {
+    queued_.erase(std::remove(queued_.begin(), queued_.end(), &op),
+                  queued_.end());
+  }
+  bool keep = (op.st == operation::state::completed &&
+               (op.opcode == IORING_OP_READ ? op.result > 0 : op.result >= 0));
+  op.st = operation::state::idle;
+  lock.unlock();
+
+  if (keep) {
+    keep_leftover(op.fd, op.epoch, op.opcode == IORING_OP_READ, op.buf,
+                  op.result);
+  }
+}
+
+int uring::wait(int watched_fd, std::chrono::nanoseconds timeout,
+                bool& watched_ready) {
+  std::unique_lock lock(mu_);
+  reap();
+
+  watch* w = nullptr;
+  if (watched_fd >= 0) {
+    auto it = std::find_if(
+        watches_.begin(), watches_.end(),
+        [watched_fd](const auto& w) { return w->fd == watched_fd; });
+    if (it == watches_.end()) {
+      watches_.push_back(std::make_unique<watch>());
+      watches_.back()->fd = watched_fd;
+      it = std::prev(watches_.end());
+    }
+    w = it->get();
+    if (!w->armed && !w->ready && reserve_sqes(1)) {
+      auto* sqe = static_cast<io_uring_sqe*>(next_sqe(0));
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = watched_fd;
+      set_poll_events(sqe, POLLIN);
+      sqe->user_data = reinterpret_cast<std::uint64_t>(w) | watch_tag;
+      commit_sqes(1);
+      w->armed = true;
+    }
+  }
+  flush();
+
+  auto to_submit = pending_sqes();
+  bool pending = (completed_ != reported_) || (w && w->ready);
+  int res = 0;
+  int saved_errno = 0;
+  if (to_submit || !pending) {
+    lock.unlock();
+    res = pending ? enter(to_submit, 0, 0, timeout)
+                  : enter(to_submit, 1, IORING_ENTER_GETEVENTS, timeout);
+    saved_errno = errno;
+    lock.lock();
+    reap();
+  }
+  if (res < 0 && saved_errno != ETIME) {
+    errno = saved_errno;
+    return res;
+  }
+
+  watched_ready = w && w->ready;
+  if (w) w->ready = false;
+  bool completed = (completed_ != reported_);
+  reported_ = completed_;
+  return completed ? 1 : 0;
+}
+
+bool uring::submit() {
+  std::scoped_lock lock(mu_);
+  flush();
+  if (auto to_submit = pending_sqes()) {
+    enter(to_submit, 0, 0, std::chrono::nanoseconds(-1));
+  }
+  bool completed = (completed_ != reported_);
+  reported_ = completed_;
+  return completed;
+}
+
+void uring::unwatch(int watched_fd) noexcept {
+  std::unique_lock lock(mu_);
+  auto find = [this, watched_fd]() {
+    return std::find_if(
+        watches_.begin(), watches_.end(),
+        [watched_fd](const auto& w) { return w->fd == watched_fd; });
+  };
+  auto it = find();
+  if (it == watches_.end()) return;
+  auto* w = it->get();
+  if (w->armed) {
+    cancel(reinterpret_cast<std::uint64_t>(w) | watch_tag);
+    enter(pending_sqes(), 0, 0, std::chrono::nanoseconds(-1));
+    while (w->armed) {
+      lock.unlock();
+      enter(0, 1, IORING_ENTER_GETEVENTS, std::chrono::milliseconds(1));
+      lock.lock();
+      reap();
+    }
+  }
+  watches_.erase(find());
+}
+
+void uring::cancel(std::uint64_t user_data) {
+  if (!reserve_sqes(1)) return;
+  auto* sqe = static_cast<io_uring_sqe*>(next_sqe(0));
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = user_data;
+  commit_sqes(1);
+}
+
+void uring::flush() {
+  std::size_t done = 0;
+  for (; done < queued_.size(); done++) {
+    auto& op = *queued_[done];
+    unsigned count = op.poll_first ? 2 : 1;
+    if (!reserve_sqes(count)) break;
+
+    auto* sqe = static_cast<io_uring_sqe*>(next_sqe(0));
+    if (op.poll_first) {
+      sqe->opcode = IORING_OP_POLL_ADD;
+      sqe->fd = op.fd;
+      sqe->flags = IOSQE_IO_LINK;
+      set_poll_events(sqe, POLLIN);
+      sqe->user_data = reinterpret_cast<std::uint64_t>(&op) | poll_tag;
+      sqe = static_cast<io_uring_sqe*>(next_sqe(1));
+    }
+    sqe->opcode = op.opcode;
+    sqe->fd = op.fd;
+    sqe->addr = reinterpret_cast<std::uint64_t>(op.buf);
+    if (op.opcode == IORING_OP_READ) {
+      sqe->len = op.len;
+      // Read from the current position, like read(2).
+      sqe->off = ~std::uint64_t(0);
+    } else {
+      sqe->addr2 = reinterpret_cast<std::uint64_t>(op.addr_size);
+    }
+    sqe->user_data = reinterpret_cast<std::uint64_t>(&op);
+    commit_sqes(count);
+    op.st = operation::state::submitted;
+  }
+  queued_.erase(queued_.begin(), queued_.begin() + done);
+}
+
+void uring::reap() {
+  auto* cqes = static_cast<io_uring_cqe*>(cqes_);
+  do {
+    auto head = *cq_head_;
+    auto tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+      const auto& cqe = cqes[head & cq_mask_];
+      auto user_data = cqe.user_data;
+      if (user_data == 0) continue;
+      switch (user_data & tag_mask) {
+        case watch_tag: {
+          auto* w = reinterpret_cast<watch*>(user_data & ~tag_mask);
+          w->armed = false;
+          w->ready = true;
+          break;
+        }
+        case poll_tag:
+          // The linked operation reports the outcome.
+          break;
+        default: {
+          auto* op = reinterpret_cast<operation*>(user_data);
+          if (cqe.res == -EAGAIN) {
+            op->poll_first = true;
+            op->st = operation::state::queued;
+            queued_.push_back(op);
+          } else {
+            op->result = cqe.res;
+            op->st = operation::state::completed;
+            completed_++;
+          }
+        }
+      }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    // Completions that didn't fit in the queue are moved in by the kernel on
+    // the next call to io_uring_enter(2) that gets events.
+  } while ((__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) &
+            IORING_SQ_CQ_OVERFLOW) &&
+           enter(0, 0, IORING_ENTER_GETEVENTS, std::chrono::nanoseconds(-1)) >=
+               0);
+}
+
+int uring::enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+                 std::chrono::nanoseconds timeout) {
+  __kernel_timespec ts;
+  io_uring_getevents_arg arg;
+  std::memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz = _NSIG / 8;
+  if (timeout >= std::chrono::nanoseconds::zero()) {
+    ts.tv_sec = timeout / std::chrono::seconds(1);
+    ts.tv_nsec = (timeout % std::chrono::seconds(1)).count();
+    arg.ts = reinterpret_cast<std::uint64_t>(&ts);
+  }
+  return static_cast<int>(::syscall(__NR_io_uring_enter, *ring_fd_, to_submit,
+                                    min_complete, flags | IORING_ENTER_EXT_ARG,
+                                    &arg, sizeof(arg)));
+}
+
+unsigned uring::pending_sqes() const {
+  return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+bool uring::reserve_sqes(unsigned count) {
+  if (sq_entries_ - pending_sqes() < count) {
+    // Make room by passing what's queued to the kernel.
+    enter(pending_sqes(), 0, 0, std::chrono::nanoseconds(-1));
+  }
+  return sq_entries_ - pending_sqes() >= count;
+}
+
+void* uring::next_sqe(unsigned index) {
+  auto* sqe =
+      &static_cast<io_uring_sqe*>(sqes_)[(*sq_tail_ + index) & sq_mask_];
+  std::memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+void uring::commit_sqes(unsigned count) {
+  // The kernel may be reading the queue from another thread's wait().
+  __atomic_store_n(sq_tail_, *sq_tail_ + count, __ATOMIC_RELEASE);
+}
+
+#else  // defined(__linux__) && defined(IORING_FEAT_EXT_ARG)
+
+struct uring::operation {};
+struct uring::watch {};
+
+bool uring::available() { return false; }
+
+uring::uring() {}
+
+uring::~uring() {}
+
+awaitable<int> uring::read(int fd, void* buf, std::size_t len) {
+  throw errors::not_implemented("io_uring is not available");
+}
+
+awaitable<int> uring::accept(int fd, sockaddr* addr, socklen_t* addr_size) {
+  throw errors::not_implemented("io_uring is not available");
+}
+
+int uring::wait(int watched_fd, std::chrono::nanoseconds timeout,
+                bool& watched_ready) {
+  watched_ready = false;
+  return 0;
+}
+
+bool uring::submit() { return false; }
+
+void uring::unwatch(int watched_fd) noexcept {}
+
+#endif  // defined(__linux__) && defined(IORING_FEAT_EXT_ARG)
+
+}  // namespace arpc
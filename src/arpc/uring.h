@@ -0,0 +1,155 @@
+/// \file
+/// \brief Completion-based I/O through Linux's io_uring.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_URING_H_
+#define ARPC_URING_H_
+
+#include <sys/socket.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+#include "arpc/awaitable.h"
+#include "arpc/channel.h"
+
+namespace arpc {
+
+/// Completion-based I/O engine backed by an io_uring instance per thread.
+///
+/// Once enabled, `channel::async_read()` and `channel::async_accept()` run
+/// their system call in the kernel instead of waiting for readiness and then
+/// issuing it. Operations are queued in user space when `select()` first
+/// checks them, and the poller of the thread submits all the queued ones in
+/// the same system call that waits for events. Completions are reaped in user
+/// space. When io_uring is unavailable (not Linux, a kernel older than 5.11,
+/// or a sandbox forbidding it), channels keep using the readiness path.
+///
+/// An operation is tied to the ring of the thread that created its awaitable,
+/// and completions are only waited for efficiently from that thread. If the
+/// awaitable is destroyed with the operation in flight, the operation is
+/// cancelled; data that was read (into the caller's buffer, which must thus
+/// outlive the awaitable) or connections that were accepted by then are handed
+/// to the next read or accept on the same channel, so nothing gets lost.
+class uring : public std::enable_shared_from_this<uring> {
+ public:
+  ~uring();
+  uring(const uring&) = delete;
+  uring& operator=(const uring&) = delete;
+
+  /// Whether io_uring can be used in this process.
+  static bool available();
+
+  /// Start (or stop) using io_uring for channel reads and accepts.
+  ///
+  /// \return Whether io_uring is now in use.
+  static bool enable(bool enable = true);
+
+  /// Whether io_uring is in use.
+  static bool enabled();
+
+  /// The ring of the current thread, or `nullptr` if io_uring isn't in use.
+  static uring* current();
+
+  /// Awaitable returning the result of a `read(2)` call, or `-errno`.
+  awaitable<int> read(int fd, void* buf, std::size_t len);
+
+  /// Awaitable returning the result of an `accept(2)` call, or `-errno`.
+  awaitable<int> accept(int fd, sockaddr* addr, socklen_t* addr_size);
+
+  /// Take data read for `fd` by an operation whose awaitable was destroyed.
+  static std::optional<std::size_t> take_read(int fd, void* buf,
+                                              std::size_t len);
+
+  /// Take a connection accepted from `fd` by an operation whose awaitable was
+  /// destroyed, or -1 if there's none.
+  static int take_accept(int fd);
+
+  /// Drop anything held for `fd`, which is about to be closed.
+  static void forget(int fd) noexcept;
+
+  /// Descriptor that becomes readable when operations complete.
+  int fd() const;
+
+  /// Submit the queued operations.
+  ///
+  /// \return Whether operations completed since the last call to `submit()`
+  ///   or `wait()`, so that the ring's descriptor must be taken as ready.
+  bool submit();
+
+  /// Submit the queued operations and wait for any operation to complete, or
+  /// for `watched_fd` to become readable, for up to `timeout` (forever if
+  /// negative).
+  ///
+  /// \return 1 if operations completed (as in `submit()`), 0 if not, or a
+  ///   negative number on error (with `errno` set).
+  int wait(int watched_fd, std::chrono::nanoseconds timeout,
+           bool& watched_ready);
+
+  /// Stop watching `watched_fd` in `wait()`.
+  void unwatch(int watched_fd) noexcept;
+
+ private:
+  struct operation;
+  struct watch;
+
+  uring();
+
+  awaitable<int> make_awaitable(std::shared_ptr<operation> op);
+  bool poll(operation& op);
+  int take(operation& op);
+  void abandon(operation& op) noexcept;
+  void cancel(std::uint64_t user_data);
+  void flush();
+  void reap();
+  int enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+            std::chrono::nanoseconds timeout);
+  unsigned pending_sqes() const;
+  bool reserve_sqes(unsigned count);
+  void* next_sqe(unsigned index);
+  void commit_sqes(unsigned count);
+
+  std::mutex mu_;
+  channel ring_fd_;
+  void* ring_ = nullptr;
+  std::size_t ring_size_ = 0;
+  void* sqes_ = nullptr;
+  std::size_t sqes_size_ = 0;
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_flags_ = nullptr;
+  unsigned sq_mask_ = 0;
+  unsigned sq_entries_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned cq_mask_ = 0;
+  void* cqes_ = nullptr;
+  std::vector<operation*> queued_;
+  std::vector<std::unique_ptr<watch>> watches_;
+  std::uint64_t completed_ = 0;
+  std::uint64_t reported_ = 0;
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_URING_H_
@@ -0,0 +1,172 @@
+/// \file
+/// \brief Combinators completing when several futures do.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_WHEN_H_
+#define ARPC_WHEN_H_
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "arpc/errors.h"
+#include "arpc/future.h"
+#include "arpc/result_holder.h"
+
+namespace arpc {
+
+/// Results of the futures completed by `when_any()` and `when_n()`, each one
+/// with the index of its future in the input.
+template <typename T>
+using indexed_result = std::pair<std::size_t, result_holder<T>>;
+
+namespace detail {
+
+template <typename R>
+struct when_state {
+  explicit when_state(std::size_t count) : remaining(count) {}
+
+  // Set the combined result once `remaining` drops to zero.
+  void complete_one() {
+    if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      result.set_value(std::move(results));
+    }
+  }
+
+  R results;
+  std::atomic<std::size_t> remaining;
+  promise<R> result;
+};
+
+template <typename T>
+struct when_n_state : when_state<std::vector<indexed_result<T>>> {
+  explicit when_n_state(std::size_t n)
+      : when_state<std::vector<indexed_result<T>>>(n) {
+    this->results.resize(n);
+  }
+
+  // Completions past the first `n` are dropped.
+  std::atomic<std::size_t> next_slot = 0;
+};
+
+}  // namespace detail
+
+/// Wait for all the futures in `futures`.
+///
+/// Each future reports its completion through `future::on_complete()` to a
+/// shared counter, so no descriptor is polled for any of them. Wait on the
+/// returned future as usual, which honors the current context's cancellation
+/// and deadline; abandoning it leaves the inputs to complete on their own.
+///
+/// \return A future for the results of all the futures, in input order.
+template <typename T>
+future<std::vector<result_holder<T>>> when_all(std::vector<future<T>> futures) {
+  using result_type = std::vector<result_holder<T>>;
+  auto state =
+      std::make_shared<detail::when_state<result_type>>(futures.size());
+  auto f = state->result.get_future();
+  if (futures.empty()) {
+    state->result.set_value(result_type());
+    return f;
+  }
+
+  state->results.resize(futures.size());
+  for (std::size_t i = 0; i < futures.size(); i++) {
+    futures[i].on_complete([state, i](result_holder<T> result) {
+      state->results[i] = std::move(result);
+      state->complete_one();
+    });
+  }
+  return f;
+}
+
+/// Wait for all of `futures`, which can be of different types.
+///
+/// \return A future for a tuple with the results of all the futures.
+template <typename... Ts>
+future<std::tuple<result_holder<Ts>...>> when_all(future<Ts>... futures) {
+  using result_type = std::tuple<result_holder<Ts>...>;
+  auto state =
+      std::make_shared<detail::when_state<result_type>>(sizeof...(Ts));
+  auto f = state->result.get_future();
+  if constexpr (sizeof...(Ts) == 0) {
+    state->result.set_value(result_type());
+  } else {
+    auto watch = [&state](auto& future, auto& slot) {
+      future.on_complete([state, &slot](auto result) {
+        slot = std::move(result);
+        state->complete_one();
+      });
+    };
+    std::apply(
+        [&](auto&... slots) { (watch(futures, slots), ...); }, state->results);
+  }
+  return f;
+}
+
+/// Wait for the first `n` of `futures` to complete.
+///
+/// \return A future for the results of the first `n` futures to complete, in
+///   completion order, along with their indices in `futures`.
+template <typename T>
+future<std::vector<indexed_result<T>>> when_n(std::size_t n,
+                                              std::vector<future<T>> futures) {
+  if (n > futures.size()) {
+    throw errors::invalid_argument("Waiting for more futures than given");
+  }
+
+  auto state = std::make_shared<detail::when_n_state<T>>(n);
+  auto f = state->result.get_future();
+  if (n == 0) {
+    state->result.set_value(std::vector<indexed_result<T>>());
+    return f;
+  }
+
+  for (std::size_t i = 0; i < futures.size(); i++) {
+    futures[i].on_complete([state, i](result_holder<T> result) {
+      auto slot = state->next_slot.fetch_add(1, std::memory_order_relaxed);
+      if (slot >= state->results.size()) return;
+      state->results[slot] = {i, std::move(result)};
+      state->complete_one();
+    });
+  }
+  return f;
+}
+
+/// Wait for the first of `futures` to complete.
+///
+/// \return A future for the result of the first future to complete, along
+///   with its index in `futures`.
+template <typename T>
+future<indexed_result<T>> when_any(std::vector<future<T>> futures) {
+  if (futures.empty()) {
+    throw errors::invalid_argument("Waiting for any of no futures");
+  }
+  return when_n(1, std::move(futures))
+      .then([](std::vector<indexed_result<T>> results) {
+        return std::move(results.front());
+      });
+}
+
+}  // namespace arpc
+
+#endif  // ARPC_WHEN_H_
@@ -0,0 +1,155 @@
+/// \file
+/// \brief Lock-free deque owned by one thread and stolen from by others.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#ifndef ARPC_WORK_STEALING_DEQUE_H_
+#define ARPC_WORK_STEALING_DEQUE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace arpc {
+
+/// \brief Chase-Lev deque of pointers.
+///
+/// The owner thread pushes and pops at the bottom (so it sees its own items in
+/// LIFO order), while any other thread can steal from the top. None of the
+/// operations lock, and pushing only allocates when the deque grows. Arrays
+/// replaced when growing are kept until the deque is destroyed, since thieves
+/// might still be reading from them.
+///
+/// The deque doesn't own the pointed-to items.
+template <typename T>
+class work_stealing_deque {
+ public:
+  explicit work_stealing_deque(std::size_t capacity = 256) {
+    std::size_t c = 1;
+    while (c < capacity) c <<= 1;
+    arrays_.push_back(std::make_unique<array>(c));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+  }
+
+  work_stealing_deque(const work_stealing_deque&) = delete;
+  work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+
+  /// Add `item` at the bottom. Only for the owner.
+  void push(T* item) {
+    auto b = bottom_.load(std::memory_order_relaxed);
+    auto t = top_.load(std::memory_order_acquire);
+    auto* a = array_.load(std::memory_order_relaxed);
+    if (b - t > static_cast<std::int64_t>(a->mask)) a = grow(a, t, b);
+    a->put(b, item);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /// Take the item at the bottom. Only for the owner.
+  /// \return The item, or `nullptr` if the deque is empty.
+  T* pop() {
+    auto b = bottom_.load(std::memory_order_relaxed) - 1;
+    auto* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto t = top_.load(std::memory_order_relaxed);
+
+    if (t > b) {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T* item = a->get(b);
+    if (t == b) {
+      // Last item: race against thieves for it.
+      if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                        std::memory_order_relaxed)) {
+        item = nullptr;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return item;
+  }
+
+  /// Take the item at the top. Safe from any thread.
+  /// \return The item, or `nullptr` if the deque is empty or another thread
+  ///   took it first.
+  T* steal() {
+    auto t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto b = bottom_.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+
+    auto* a = array_.load(std::memory_order_acquire);
+    T* item = a->get(t);
+    if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                      std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return item;
+  }
+
+  /// Whether the deque looks empty. Only a hint when other threads use it.
+  bool empty() const {
+    auto b = bottom_.load(std::memory_order_relaxed);
+    auto t = top_.load(std::memory_order_relaxed);
+    return b <= t;
+  }
+
+  /// Approximate number of items.
+  std::size_t size() const {
+    auto b = bottom_.load(std::memory_order_relaxed);
+    auto t = top_.load(std::memory_order_relaxed);
+    return b > t ? static_cast<std::size_t>(b - t) : 0;
+  }
+
+ private:
+  struct array {
+    explicit array(std::size_t capacity)
+        : mask(capacity - 1), items(new std::atomic<T*>[capacity]) {}
+
+    T* get(std::int64_t i) const {
+      return items[i & mask].load(std::memory_order_relaxed);
+    }
+    void put(std::int64_t i, T* item) {
+      items[i & mask].store(item, std::memory_order_relaxed);
+    }
+
+    const std::size_t mask;
+    std::unique_ptr<std::atomic<T*>[]> items;
+  };
+
+  array* grow(array* a, std::int64_t t, std::int64_t b) {
+    arrays_.push_back(std::make_unique<array>((a->mask + 1) * 2));
+    auto* bigger = arrays_.back().get();
+    for (auto i = t; i < b; i++) bigger->put(i, a->get(i));
+    array_.store(bigger, std::memory_order_release);
+    return bigger;
+  }
+
+  alignas(64) std::atomic<std::int64_t> top_{0};
+  alignas(64) std::atomic<std::int64_t> bottom_{0};
+  std::atomic<array*> array_;
+  std::vector<std::unique_ptr<array>> arrays_;
+};
+
+}  // namespace arpc
+
+#endif  // ARPC_WORK_STEALING_DEQUE_H_
@@ -0,0 +1,62 @@
+/// \file
+/// \brief Test for the `arpc/affinity.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/affinity.h"
+#include <thread>
+#include "arpc/errors.h"
+#include "catch2/catch.hpp"
+
+TEST_CASE("thread affinity") {
+  auto allowed = arpc::get_affinity();
+  REQUIRE(!allowed.empty());
+  auto first = arpc::cpu_set{*allowed.begin()};
+
+  SECTION("of the current thread") {
+    SECTION("can be set and read back") {
+      arpc::set_affinity(first);
+      REQUIRE(arpc::get_affinity() == first);
+      arpc::set_affinity(allowed);
+      REQUIRE(arpc::get_affinity() == allowed);
+    }
+    SECTION("is left alone by an empty set") {
+      arpc::set_affinity(arpc::cpu_set());
+      REQUIRE(arpc::get_affinity() == allowed);
+    }
+    SECTION("can't be set to unknown CPUs") {
+      REQUIRE_THROWS_AS(arpc::set_affinity(arpc::cpu_set{1U << 20}),
+                        arpc::errors::invalid_argument);
+    }
+  }
+  SECTION("of other threads can be set and read back") {
+    std::thread th([]() {});
+    arpc::set_affinity(th, first);
+    REQUIRE(arpc::get_affinity(th) == first);
+    th.join();
+  }
+  SECTION("is inherited by new threads") {
+    arpc::set_affinity(first);
+    arpc::cpu_set seen;
+    std::thread th([&seen]() { seen = arpc::get_affinity(); });
+    th.join();
+    arpc::set_affinity(allowed);
+    REQUIRE(seen == first);
+  }
+}
@@ -21,7 +21,11 @@
 
 #include "arpc/awaitable.h"
 #include <chrono>
+#include "arpc/channel.h"
+#include "arpc/context.h"
 #include "arpc/errors.h"
+#include "arpc/pipe.h"
+#include "arpc/select.h"
 #include "catch2/catch.hpp"
 
 TEST_CASE("read file construction") {
@@ -154,3 +158,56 @@ TEST_CASE("awaitable react functions") {
     REQUIRE_THROWS_AS(a.get_react_fn()(), arpc::errors::cancelled);
   }
 }
+
+TEST_CASE("awaitable ready functions") {
+  SECTION("are absent by default") { REQUIRE(!arpc::never().get_ready_fn()); }
+  SECTION("always is ready") {
+    auto a = arpc::always();
+    REQUIRE(a.get_ready_fn()());
+  }
+  SECTION("are kept when composing") {
+    bool ready = false;
+    auto a = arpc::never()
+                 .ready_when([&ready]() { return ready; })
+                 .then([]() { return 13; });
+    REQUIRE(!a.get_ready_fn()());
+    ready = true;
+    REQUIRE(a.get_ready_fn()());
+  }
+  SECTION("let select react without polling") {
+    bool reacted = false;
+    auto [res] = arpc::select(arpc::never()
+                                  .ready_when([]() { return true; })
+                                  .then([&reacted]() { reacted = true; }));
+    REQUIRE(res);
+    REQUIRE(reacted);
+  }
+  SECTION("don't bypass the context cancellation") {
+    arpc::context ctx;
+    ctx.cancel();
+    REQUIRE_THROWS_AS(arpc::select(arpc::always()), arpc::errors::cancelled);
+  }
+  SECTION("don't bypass the context deadline") {
+    arpc::context ctx;
+    ctx.set_timeout(std::chrono::milliseconds(0));
+    REQUIRE_THROWS_AS(arpc::select(arpc::always()),
+                      arpc::errors::deadline_exceeded);
+  }
+  SECTION("keep select from reacting while not ready") {
+    arpc::channel fds[2], other_fds[2];
+    arpc::pipe(fds);
+    arpc::pipe(other_fds);
+    fds[1].write("*", 1);
+    other_fds[1].write("*", 1);
+    bool reacted = false;
+    auto [not_ready, ready] =
+        arpc::select(fds[0]
+                         .can_read()
+                         .ready_when([]() { return false; })
+                         .then([&reacted]() { reacted = true; }),
+                     other_fds[0].can_read());
+    REQUIRE(!not_ready);
+    REQUIRE(ready);
+    REQUIRE(!reacted);
+  }
+}
@@ -0,0 +1,90 @@
+/// \file
+/// \brief Test for the `arpc/clock.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/clock.h"
+#include <chrono>
+#include <thread>
+#include "arpc/awaitable.h"
+#include "arpc/context.h"
+#include "arpc/reactor.h"
+#include "arpc/select.h"
+#include "catch2/catch.hpp"
+
+TEST_CASE("deadline clock") {
+  SECTION("never goes back") {
+    auto previous = arpc::deadline_clock::now();
+    for (int i = 0; i < 1000; i++) {
+      auto now = arpc::deadline_clock::now();
+      REQUIRE(now >= previous);
+      previous = now;
+    }
+  }
+  SECTION("advances with the steady clock") {
+    auto start = arpc::deadline_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(arpc::deadline_clock::now() - start >=
+            std::chrono::milliseconds(10));
+  }
+  SECTION("in coarse mode") {
+    arpc::deadline_clock::coarse_scope coarse;
+    auto cached = arpc::deadline_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    SECTION("returns the cached time") {
+      REQUIRE(arpc::deadline_clock::now() == cached);
+    }
+    SECTION("advances on refresh") {
+      arpc::deadline_clock::refresh();
+      REQUIRE(arpc::deadline_clock::now() - cached >=
+              std::chrono::milliseconds(10));
+    }
+    SECTION("advances on reactor dispatch") {
+      arpc::reactor r;
+      r.arm(arpc::always());
+      auto [dispatched] = arpc::select(r.async_dispatch());
+      *dispatched;
+      REQUIRE(arpc::deadline_clock::now() - cached >=
+              std::chrono::milliseconds(10));
+    }
+    SECTION("is only used by this thread") {
+      arpc::deadline_clock::time_point other;
+      std::thread th([&other]() { other = arpc::deadline_clock::now(); });
+      th.join();
+      REQUIRE(other - cached >= std::chrono::milliseconds(10));
+    }
+  }
+  SECTION("leaves coarse mode at the end of the scope") {
+    { arpc::deadline_clock::coarse_scope coarse; }
+    auto start = arpc::deadline_clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    REQUIRE(arpc::deadline_clock::now() > start);
+  }
+}
+
+TEST_CASE("context deadlines use the deadline clock") {
+  arpc::context ctx;
+  ctx.set_timeout(std::chrono::seconds(10));
+  auto left = ctx.deadline_left();
+  REQUIRE(left);
+  REQUIRE(*left <= std::chrono::seconds(10));
+  REQUIRE(*left > std::chrono::seconds(9));
+  REQUIRE(*ctx.deadline() - arpc::deadline_clock::now() <=
+          std::chrono::seconds(10));
+}
@@ -0,0 +1,170 @@
+/// \file
+/// \brief Test for the `arpc/context.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/context.h"
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include "arpc/binary_codecs.h"
+#include "arpc/errors.h"
+#include "arpc/flag.h"
+#include "arpc/select.h"
+#include "arpc/serializable.h"
+#include "arpc/string_adapters.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+#include "catch2/catch.hpp"
+
+struct context_value : arpc::dynamic<context_value> {
+  int value = 0;
+
+  ARPC_FIELDS(value);
+};
+ARPC_REGISTER(context_value);
+
+TEST_CASE("context data") {
+  arpc::context parent;
+  context_value v;
+  v.value = 1;
+  parent.set(v);
+
+  SECTION("is inherited") {
+    arpc::context child;
+    REQUIRE(child.get<context_value>().value == 1);
+  }
+  SECTION("changes in children don't affect their parents") {
+    {
+      arpc::context child;
+      v.value = 2;
+      child.set(v);
+      REQUIRE(child.get<context_value>().value == 2);
+      REQUIRE(parent.get<context_value>().value == 1);
+      child.reset<context_value>();
+      REQUIRE(child.get<context_value>().value == 0);
+    }
+    REQUIRE(parent.get<context_value>().value == 1);
+  }
+  SECTION("changes in parents don't affect existing children") {
+    arpc::context child(parent, false);
+    parent.reset_all();
+    REQUIRE(parent.get<context_value>().value == 0);
+    REQUIRE(child.get<context_value>().value == 1);
+  }
+}
+
+TEST_CASE("context deadline loading") {
+  std::string saved;
+  arpc::context ctx;
+
+  SECTION("without a deadline") {
+    {
+      arpc::string_output_stream os(saved);
+      arpc::little_endian_binary_encoder encoder(os);
+      encoder(ctx);
+    }
+    arpc::string_input_stream is(saved);
+    arpc::little_endian_binary_decoder decoder(is);
+    REQUIRE(!arpc::context::load_deadline_left(decoder));
+  }
+  SECTION("with a deadline") {
+    ctx.set_timeout(std::chrono::seconds(10));
+    {
+      arpc::string_output_stream os(saved);
+      arpc::little_endian_binary_encoder encoder(os);
+      encoder(ctx);
+    }
+    arpc::string_input_stream is(saved);
+    arpc::little_endian_binary_decoder decoder(is);
+    auto left = arpc::context::load_deadline_left(decoder);
+    REQUIRE(left);
+    REQUIRE(*left > std::chrono::seconds(9));
+    REQUIRE(*left <= std::chrono::seconds(10));
+  }
+}
+
+TEST_CASE("context cancellation") {
+  arpc::context parent;
+
+  SECTION("reaches children") {
+    arpc::context child;
+    arpc::context grandchild;
+    REQUIRE(!grandchild.is_cancelled());
+    parent.cancel();
+    REQUIRE(child.is_cancelled());
+    REQUIRE(grandchild.is_cancelled());
+  }
+  SECTION("doesn't reach parents") {
+    {
+      arpc::context child;
+      child.cancel();
+    }
+    REQUIRE(!parent.is_cancelled());
+  }
+  SECTION("doesn't go through shields") {
+    arpc::shield shielded;
+    arpc::context child;
+    parent.cancel();
+    REQUIRE(!shielded.is_cancelled());
+    REQUIRE(!child.is_cancelled());
+  }
+  SECTION("wakes up children waiting on it") {
+    arpc::context child;
+    arpc::thread th([&parent]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      parent.cancel();
+    });
+    REQUIRE_THROWS_AS(arpc::wait(arpc::never()), arpc::errors::cancelled);
+    th.join();
+  }
+  SECTION("of parents is seen by children waiting later") {
+    arpc::context child(parent, false);
+    parent.cancel();
+    // Wait from a thread whose own context isn't cancelled.
+    bool woken = false;
+    arpc::daemon_thread th([&child, &woken]() {
+      auto [cancelled] = arpc::select(child.wait_cancelled());
+      woken = static_cast<bool>(cancelled);
+    });
+    th.join();
+    REQUIRE(woken);
+  }
+}
+
+TEST_CASE("contexts wait for their children") {
+  arpc::flag child_created;
+  std::atomic<bool> child_done = false;
+  arpc::thread th;
+  {
+    arpc::context parent(arpc::context::current(), false);
+    th = arpc::thread(
+        [&child_created, &child_done](arpc::context& parent) {
+          arpc::context child(parent, false);
+          child_created.set();
+          arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+          child_done = true;
+        },
+        std::ref(parent));
+    child_created.wait();
+  }
+  REQUIRE(child_done);
+  th.join();
+}
@@ -0,0 +1,170 @@
+/// \file
+/// \brief Test for the `arpc/coroutine.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/coroutine.h"
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "arpc/awaitable.h"
+#include "arpc/channel.h"
+#include "arpc/context.h"
+#include "arpc/errors.h"
+#include "arpc/future.h"
+#include "arpc/pipe.h"
+#include "arpc/select.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+#include "catch2/catch.hpp"
+
+namespace {
+arpc::task<int> answer() { co_return 42; }
+
+arpc::task<int> twice() {
+  int a = co_await answer();
+  int b = co_await answer();
+  co_return a + b;
+}
+
+arpc::task<int> failing() {
+  throw std::runtime_error("oops");
+  co_return 0;
+}
+
+arpc::task<std::string> read_some(arpc::channel& c) {
+  char buf[16];
+  auto n = co_await c.async_read(buf, sizeof(buf));
+  co_return std::string(buf, n);
+}
+
+arpc::task<void> sleep_for(std::chrono::milliseconds d) {
+  co_await arpc::timeout(d);
+}
+}  // namespace
+
+TEST_CASE("coroutine tasks") {
+  arpc::event_loop loop;
+
+  SECTION("tasks return values") { REQUIRE(loop.run(answer()) == 42); }
+  SECTION("tasks await other tasks") { REQUIRE(loop.run(twice()) == 84); }
+  SECTION("exceptions reach the awaiting coroutine") {
+    REQUIRE_THROWS_AS(loop.run(failing()), std::runtime_error);
+  }
+  SECTION("awaiting outside of an event loop throws") {
+    REQUIRE_THROWS_AS(arpc::event_loop::current(), arpc::errors::invalid_state);
+  }
+}
+
+TEST_CASE("coroutines waiting for awaitables") {
+  arpc::event_loop loop;
+  arpc::channel fds[2];
+  arpc::pipe(fds);
+  fds[0].make_non_blocking();
+  fds[1].make_non_blocking();
+
+  SECTION("descriptors") {
+    arpc::thread th([&fds]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      fds[1].write("abc", 3);
+    });
+    REQUIRE(loop.run(read_some(fds[0])) == "abc");
+    th.join();
+  }
+  SECTION("timeouts") {
+    auto start = std::chrono::steady_clock::now();
+    loop.run(sleep_for(std::chrono::milliseconds(10)));
+    REQUIRE(std::chrono::steady_clock::now() - start >=
+            std::chrono::milliseconds(10));
+  }
+  SECTION("co_select returns the first ready input") {
+    auto t = [](arpc::channel& c) -> arpc::task<bool> {
+      char buf[16];
+      auto [n, timed_out] = co_await arpc::co_select(
+          c.async_read(buf, sizeof(buf)),
+          arpc::timeout(std::chrono::milliseconds(5)));
+      co_return !n && timed_out;
+    };
+    REQUIRE(loop.run(t(fds[0])));
+    // The read that lost doesn't consume data written later.
+    fds[1].write("x", 1);
+    REQUIRE(loop.run(read_some(fds[0])) == "x");
+  }
+  SECTION("inputs ready in user space are reacted to right away") {
+    auto t = []() -> arpc::task<int> {
+      auto [a, b] =
+          co_await arpc::co_select(arpc::never().then([]() { return 1; }),
+                                   arpc::always().then([]() { return 2; }));
+      co_return a ? *a : *b;
+    };
+    REQUIRE(loop.run(t()) == 2);
+  }
+  SECTION("futures") {
+    arpc::promise<int> p;
+    auto f = p.get_future();
+    arpc::thread th([&p]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      p.set_value(7);
+    });
+    auto t = [](arpc::future<int>& f) -> arpc::task<int> {
+      co_return co_await f;
+    };
+    REQUIRE(loop.run(t(f)) == 7);
+    th.join();
+  }
+}
+
+TEST_CASE("spawned coroutines") {
+  arpc::event_loop loop;
+  constexpr int num_tasks = 1000;
+  int done = 0;
+
+  for (int i = 0; i < num_tasks; i++) {
+    loop.spawn([](int& done) -> arpc::task<void> {
+      co_await arpc::timeout(std::chrono::milliseconds(1));
+      done++;
+    }(done));
+  }
+  loop.run();
+  REQUIRE(done == num_tasks);
+}
+
+TEST_CASE("coroutines honour the context") {
+  arpc::event_loop loop;
+  arpc::channel fds[2];
+  arpc::pipe(fds);
+
+  SECTION("cancellation") {
+    arpc::context ctx;
+    arpc::thread th([&ctx]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      ctx.cancel();
+    });
+    REQUIRE_THROWS_AS(loop.run(read_some(fds[0])), arpc::errors::cancelled);
+    th.join();
+    REQUIRE_THROWS_AS(loop.run(read_some(fds[0])), arpc::errors::cancelled);
+  }
+  SECTION("deadlines") {
+    arpc::context ctx;
+    ctx.set_timeout(std::chrono::milliseconds(10));
+    REQUIRE_THROWS_AS(loop.run(read_some(fds[0])),
+                      arpc::errors::deadline_exceeded);
+  }
+}
@@ -0,0 +1,237 @@
+/// \file
+/// \brief Test for the `arpc/executor.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/executor.h"
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include "arpc/affinity.h"
+#include "arpc/context.h"
+#include "arpc/flag.h"
+#include "arpc/select.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+#include "catch2/catch.hpp"
+
+TEMPLATE_TEST_CASE("executors run functions", "", arpc::thread_pool,
+                   arpc::work_stealing_pool) {
+  TestType pool(4);
+  constexpr int num_tasks = 10000;
+  std::atomic<int> remaining = num_tasks;
+  arpc::flag done;
+  auto count = [&remaining, &done]() {
+    if (--remaining == 0) done.set();
+  };
+
+  SECTION("from other threads") {
+    std::vector<arpc::thread> producers;
+    for (int i = 0; i < 4; i++) {
+      producers.emplace_back([&pool, &count]() {
+        for (int j = 0; j < num_tasks / 4; j++) pool.run(count);
+      });
+    }
+    for (auto& th : producers) th.join();
+    done.wait();
+    REQUIRE(remaining == 0);
+  }
+  SECTION("from their own workers") {
+    for (int i = 0; i < 100; i++) {
+      pool.run([&pool, &count]() {
+        for (int j = 0; j < num_tasks / 100; j++) pool.run(count);
+      });
+    }
+    done.wait();
+    REQUIRE(remaining == 0);
+  }
+  SECTION("after throwing functions") {
+    pool.run([]() { throw std::runtime_error("oops"); });
+    for (int i = 0; i < num_tasks; i++) pool.run(count);
+    done.wait();
+    REQUIRE(remaining == 0);
+  }
+  SECTION("after idling") {
+    pool.run(count);
+    arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+    for (int i = 1; i < num_tasks; i++) pool.run(count);
+    done.wait();
+    REQUIRE(remaining == 0);
+  }
+}
+
+TEMPLATE_TEST_CASE("bounded executors", "", arpc::thread_pool,
+                   arpc::work_stealing_pool) {
+  TestType pool(1, 1);
+  arpc::flag release, done;
+  std::atomic<int> ran = 0;
+
+  pool.run([&release]() { release.wait(); });
+  // Fills the shared queue while the only worker is busy.
+  arpc::thread producer([&]() {
+    for (int i = 0; i < 3; i++) pool.run([&ran]() { ran++; });
+    done.set();
+  });
+  auto [finished, timed_out] =
+      arpc::select(done.async_wait(),
+                   arpc::timeout(std::chrono::milliseconds(20)));
+  REQUIRE(!finished);
+  release.set();
+  producer.join();
+  while (ran < 3) arpc::wait(arpc::timeout(std::chrono::milliseconds(1)));
+  REQUIRE(ran == 3);
+}
+
+TEMPLATE_TEST_CASE("bounded executors don't block their own workers", "",
+                   arpc::thread_pool, arpc::work_stealing_pool) {
+  TestType pool(1, 1);
+  arpc::flag queued;
+  std::atomic<int> ran = 0;
+
+  // The only worker would wait forever for itself to make room.
+  pool.run([&]() {
+    for (int i = 0; i < 3; i++) pool.run([&ran]() { ran++; });
+    queued.set();
+  });
+  arpc::context ctx;
+  ctx.set_timeout(std::chrono::seconds(10));
+  REQUIRE_NOTHROW(queued.wait());
+  while (ran < 3) arpc::wait(arpc::timeout(std::chrono::milliseconds(1)));
+  REQUIRE(ran == 3);
+}
+
+TEST_CASE("work stealing pools run functions on chosen workers") {
+  arpc::work_stealing_pool pool(4);
+  constexpr int num_tasks = 1000;
+  std::atomic<int> remaining = num_tasks;
+  std::atomic<bool> same_thread = true;
+  arpc::flag done;
+  std::vector<std::thread::id> ids(pool.num_workers());
+  std::vector<arpc::flag> known(pool.num_workers());
+  for (std::size_t i = 0; i < pool.num_workers(); i++) {
+    pool.run_on(i, [&ids, &known, i]() {
+      ids[i] = std::this_thread::get_id();
+      known[i].set();
+    });
+  }
+  for (auto& k : known) k.wait();
+
+  for (int i = 0; i < num_tasks; i++) {
+    pool.run_on(i, [&, i]() {
+      auto on_worker = std::this_thread::get_id() == ids[i % ids.size()];
+      if (!on_worker) same_thread = false;
+      // Functions run from a worker stay on it too.
+      pool.run_on(i, [&, i]() {
+        auto on_worker = std::this_thread::get_id() == ids[i % ids.size()];
+        if (!on_worker) same_thread = false;
+        if (--remaining == 0) done.set();
+      });
+    });
+  }
+  done.wait();
+  REQUIRE(same_thread);
+}
+
+TEMPLATE_TEST_CASE("executors pin their workers", "", arpc::thread_pool,
+                   arpc::work_stealing_pool) {
+  auto allowed = arpc::get_affinity();
+  REQUIRE(!allowed.empty());
+  auto first = arpc::cpu_set{*allowed.begin()};
+  auto last = arpc::cpu_set{*allowed.rbegin()};
+
+  SECTION("to the given CPUs") {
+    TestType pool(3, -1, {first, last});
+    auto placement = pool.worker_affinity();
+    REQUIRE(placement.size() == 3);
+    REQUIRE(placement[0] == first);
+    REQUIRE(placement[1] == last);
+    REQUIRE(placement[2] == first);
+  }
+  SECTION("only when asked to") {
+    TestType pool(2);
+    for (const auto& cpus : pool.worker_affinity()) REQUIRE(cpus == allowed);
+  }
+}
+
+TEST_CASE("adaptive thread pools") {
+  arpc::thread_pool::adaptive_options options;
+  options.min_threads = 1;
+  options.max_threads = 4;
+  options.max_queue_wait = std::chrono::milliseconds(1);
+  options.idle_timeout = std::chrono::milliseconds(50);
+  // Declared before the pool, so that they outlive the functions using them.
+  arpc::flag release;
+  std::atomic<int> started = 0;
+  arpc::thread_pool pool(options);
+  REQUIRE(pool.get_stats().num_threads == 1);
+
+  SECTION("add workers while functions wait") {
+    for (int i = 0; i < 4; i++) {
+      pool.run([&]() {
+        started++;
+        release.wait();
+      });
+    }
+    while (started < 4) arpc::wait(arpc::timeout(std::chrono::milliseconds(1)));
+    auto stats = pool.get_stats();
+    REQUIRE(stats.num_threads == 4);
+    REQUIRE(stats.num_added == 3);
+    REQUIRE(stats.num_queued >= 3);
+    REQUIRE(stats.max_queue_wait >= std::chrono::milliseconds(1));
+    REQUIRE(stats.total_queue_wait >= stats.max_queue_wait);
+
+    SECTION("up to the maximum") {
+      pool.run([]() {});
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      stats = pool.get_stats();
+      REQUIRE(stats.num_threads == 4);
+      REQUIRE(stats.queue_size == 1);
+      release.set();
+    }
+    SECTION("and remove them once idle") {
+      release.set();
+      while (pool.get_stats().num_threads > 1) {
+        arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      }
+      stats = pool.get_stats();
+      REQUIRE(stats.num_threads == 1);
+      REQUIRE(stats.num_removed == 3);
+    }
+  }
+  SECTION("keep running functions") {
+    constexpr int num_tasks = 1000;
+    std::atomic<int> remaining = num_tasks;
+    arpc::flag done;
+    for (int i = 0; i < num_tasks; i++) {
+      pool.run([&remaining, &done]() {
+        if (--remaining == 0) done.set();
+      });
+    }
+    done.wait();
+    REQUIRE(remaining == 0);
+    REQUIRE(pool.get_stats().num_threads <= 4);
+  }
+  SECTION("reject invalid bounds") {
+    options.min_threads = 5;
+    REQUIRE_THROWS_AS(arpc::thread_pool(options),
+                      arpc::errors::invalid_argument);
+  }
+}
@@ -0,0 +1,210 @@
+/// \file
+/// \brief Test for the `arpc/fiber.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/fiber.h"
+#include <sys/resource.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include "arpc/awaitable.h"
+#include "arpc/clock.h"
+#include "arpc/context.h"
+#include "arpc/errors.h"
+#include "arpc/flag.h"
+#include "arpc/future.h"
+#include "arpc/select.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+#include "catch2/catch.hpp"
+
+TEST_CASE("fiber loops") {
+  arpc::fiber_loop loop;
+
+  SECTION("run functions until they finish") {
+    int ran = 0;
+    for (int i = 0; i < 10; i++) loop.spawn([&ran]() { ran++; });
+    loop.run();
+    REQUIRE(ran == 10);
+    REQUIRE(loop.size() == 0);
+  }
+  SECTION("run blocked functions without blocking the thread") {
+    constexpr int num_fibers = 1000;
+    arpc::flag go;
+    int woken = 0;
+    for (int i = 0; i < num_fibers; i++) {
+      loop.spawn([&go, &woken]() {
+        go.wait();
+        woken++;
+      });
+    }
+    loop.spawn([&go, &loop]() {
+      // Every other fiber is waiting by now.
+      REQUIRE(loop.size() == num_fibers + 1);
+      go.set();
+    });
+    loop.run();
+    REQUIRE(woken == num_fibers);
+  }
+  SECTION("hand values between fibers through futures") {
+    arpc::promise<int> p;
+    int result = 0;
+    loop.spawn([f = p.get_future(), &result]() mutable { result = f.get(); });
+    loop.spawn([&p]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(1)));
+      p.set_value(42);
+    });
+    loop.run();
+    REQUIRE(result == 42);
+  }
+  SECTION("honor timeouts") {
+    auto start = std::chrono::steady_clock::now();
+    loop.spawn([]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(20)));
+    });
+    loop.spawn([]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+    });
+    loop.run();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE(elapsed >= std::chrono::milliseconds(20));
+  }
+  SECTION("give each fiber its own context") {
+    auto& outer = arpc::context::current();
+    bool first_timed_out = false, second_finished = false;
+    arpc::flag never;
+    loop.spawn([&]() {
+      arpc::context::current().set_timeout(std::chrono::milliseconds(10));
+      try {
+        never.wait();
+      } catch (const arpc::errors::deadline_exceeded&) {
+        first_timed_out = true;
+      }
+    });
+    loop.spawn([&]() {
+      REQUIRE(!arpc::context::current().deadline_left());
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(30)));
+      second_finished = true;
+    });
+    loop.run();
+    REQUIRE(first_timed_out);
+    REQUIRE(second_finished);
+    REQUIRE(&arpc::context::current() == &outer);
+  }
+  SECTION("can't run from a fiber") {
+    bool threw = false;
+    loop.spawn([&threw]() {
+      arpc::fiber_loop inner;
+      try {
+        inner.run();
+      } catch (const arpc::errors::invalid_state&) {
+        threw = true;
+      }
+    });
+    loop.run();
+    REQUIRE(threw);
+  }
+}
+
+TEST_CASE("fiber pools") {
+  constexpr int num_calls = 10000;
+
+  SECTION("keep many blocked functions on few threads") {
+    arpc::fiber_pool pool(2);
+    std::atomic<int> remaining = num_calls;
+    arpc::flag go, done;
+    for (int i = 0; i < num_calls; i++) {
+      pool.run([&]() {
+        go.wait();
+        if (--remaining == 0) done.set();
+      });
+    }
+    while (pool.size() < num_calls) {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(1)));
+    }
+    go.set();
+    done.wait();
+    REQUIRE(remaining == 0);
+  }
+  SECTION("don't take a descriptor per waiting fiber") {
+    arpc::fiber_pool pool(2);
+    std::atomic<int> remaining = num_calls;
+    arpc::flag go, done;
+    // Create the flags' descriptors before lowering the limit.
+    auto [go_set, done_set, timed_out] =
+        arpc::select(go.async_wait(), done.async_wait(),
+                     arpc::timeout(std::chrono::nanoseconds(0)));
+    REQUIRE(timed_out);
+
+    rlimit old_limit;
+    REQUIRE(getrlimit(RLIMIT_NOFILE, &old_limit) == 0);
+    rlimit low_limit = old_limit;
+    low_limit.rlim_cur = std::min<rlim_t>(old_limit.rlim_cur, 1024);
+    REQUIRE(setrlimit(RLIMIT_NOFILE, &low_limit) == 0);
+
+    for (int i = 0; i < num_calls; i++) {
+      pool.run([&]() {
+        go.wait();
+        if (--remaining == 0) done.set();
+      });
+    }
+    while (pool.size() < num_calls) {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(1)));
+    }
+    go.set();
+    done.wait();
+    setrlimit(RLIMIT_NOFILE, &old_limit);
+    REQUIRE(remaining == 0);
+  }
+  SECTION("unwind waiting fibers when destroyed") {
+    auto unwound = std::make_shared<std::atomic<int>>(0);
+    {
+      arpc::flag never;
+      arpc::fiber_pool pool(2);
+      for (int i = 0; i < 100; i++) {
+        pool.run([&never, unwound]() {
+          std::shared_ptr<void> guard(nullptr,
+                                      [unwound](void*) { (*unwound)++; });
+          never.wait();
+        });
+      }
+      while (pool.size() < 100) {
+        arpc::wait(arpc::timeout(std::chrono::milliseconds(1)));
+      }
+    }
+    REQUIRE(*unwound == 100);
+  }
+  SECTION("refresh a coarse clock on every round") {
+    arpc::fiber_pool pool(1, arpc::fiber_loop::default_stack_size, {}, true);
+    arpc::deadline_clock::duration frozen{1}, waited{};
+    arpc::flag done;
+    pool.run([&]() {
+      auto start = arpc::deadline_clock::now();
+      frozen = arpc::deadline_clock::now() - start;
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      waited = arpc::deadline_clock::now() - start;
+      done.set();
+    });
+    done.wait();
+    REQUIRE(frozen == arpc::deadline_clock::duration::zero());
+    REQUIRE(waited >= std::chrono::milliseconds(10));
+  }
+}
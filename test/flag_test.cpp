@@ -20,6 +20,7 @@
 ///   under the License.
 
 #include "arpc/flag.h"
+#include <unistd.h>
 #include <chrono>
 #include <mutex>
 #include "arpc/awaitable.h"
@@ -79,3 +80,45 @@ TEST_CASE("flag signaling") {
     }
   }
 }
+
+TEST_CASE("flag descriptors are created lazily") {
+  // The lowest free descriptor number changes if any flag holds one.
+  auto lowest_free_fd = []() {
+    int fd = ::dup(0);
+    ::close(fd);
+    return fd;
+  };
+  int before = lowest_free_fd();
+  arpc::flag fl1, fl2;
+  fl1.set();
+  fl1.reset();
+  fl2.set();
+  REQUIRE(lowest_free_fd() == before);
+
+  SECTION("waiting on a flag set earlier triggers without a descriptor") {
+    auto [res] = arpc::select(fl2.async_wait());
+    REQUIRE(res);
+    REQUIRE(lowest_free_fd() == before);
+  }
+  SECTION("waiting on a flag not set yet creates its descriptor") {
+    arpc::thread th([&fl1]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      fl1.set();
+    });
+    fl1.wait();
+    th.join();
+    REQUIRE(lowest_free_fd() != before);
+
+    SECTION("and closing it releases the descriptor") {
+      fl1.close();
+      REQUIRE(!fl1.is_set());
+      REQUIRE(lowest_free_fd() == before);
+    }
+  }
+  SECTION("waiting on a flag reset earlier times out") {
+    arpc::context ctx;
+    ctx.set_timeout(std::chrono::milliseconds(10));
+    REQUIRE_THROWS_AS(arpc::select(fl1.async_wait()),
+                      arpc::errors::deadline_exceeded);
+  }
+}
@@ -0,0 +1,181 @@
+/// \file
+/// \brief Test for the `arpc/future.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/future.h"
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include "arpc/errors.h"
+#include "arpc/executor.h"
+#include "arpc/flag.h"
+#include "arpc/result_holder.h"
+#include "arpc/select.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+#include "catch2/catch.hpp"
+
+namespace {
+thread_local std::size_t num_allocations = 0;
+}  // namespace
+
+void* operator new(std::size_t size) {
+  num_allocations++;
+  if (auto* p = std::malloc(size)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+TEST_CASE("futures and promises") {
+  arpc::promise<int> p;
+  auto f = p.get_future();
+
+  SECTION("values set before getting are returned") {
+    REQUIRE(!f.try_get());
+    p.set_value(13);
+    REQUIRE(f.get() == 13);
+  }
+  SECTION("values set from another thread are returned") {
+    arpc::thread th([&p]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      p.set_value(13);
+    });
+    REQUIRE(f.get() == 13);
+    th.join();
+  }
+  SECTION("exceptions are thrown") {
+    p.set_exception(
+        std::make_exception_ptr(arpc::errors::data_mismatch("oops")));
+    REQUIRE_THROWS_AS(f.get(), arpc::errors::data_mismatch);
+  }
+  SECTION("broken promises are reported") {
+    { auto broken = std::move(p); }
+    REQUIRE_THROWS_AS(f.get(), arpc::errors::invalid_state);
+  }
+  SECTION("continuations apply to the value") {
+    auto g = f.then([](int x) { return std::to_string(x + 1); });
+    p.set_value(13);
+    REQUIRE(g.get() == "14");
+  }
+  SECTION("exception handlers replace the value") {
+    auto g = f.except<arpc::errors::data_mismatch>(
+        [](const arpc::errors::data_mismatch&) { return 22; });
+    p.set_exception(
+        std::make_exception_ptr(arpc::errors::data_mismatch("oops")));
+    REQUIRE(g.get() == 22);
+  }
+  SECTION("futures can be waited for with select") {
+    p.set_value(13);
+    auto [res] = arpc::select(f.async_get());
+    REQUIRE(res);
+    REQUIRE(*res == 13);
+  }
+}
+
+TEST_CASE("future completion callbacks") {
+  arpc::promise<int> p;
+  auto f = p.get_future().then([](int x) { return x + 1; });
+  arpc::result_holder<int> result;
+  auto store = [&result](arpc::result_holder<int> r) { result = std::move(r); };
+
+  SECTION("run when the value is set") {
+    f.on_complete(store);
+    REQUIRE(!result);
+    p.set_value(13);
+    REQUIRE(*result == 14);
+  }
+  SECTION("run right away if the value is already set") {
+    p.set_value(13);
+    f.on_complete(store);
+    REQUIRE(*result == 14);
+  }
+  SECTION("get exceptions") {
+    f.on_complete(store);
+    p.set_exception(
+        std::make_exception_ptr(arpc::errors::data_mismatch("oops")));
+    REQUIRE_THROWS_AS(*result, arpc::errors::data_mismatch);
+  }
+  SECTION("get broken promises") {
+    f.on_complete(store);
+    { auto broken = std::move(p); }
+    REQUIRE_THROWS_AS(*result, arpc::errors::invalid_state);
+  }
+  SECTION("run in the given executor") {
+    arpc::work_stealing_pool pool(1);
+    arpc::flag done;
+    f.on_complete(
+        [&store, &done](arpc::result_holder<int> r) {
+          store(std::move(r));
+          done.set();
+        },
+        pool);
+    arpc::thread th([&p]() { p.set_value(13); });
+    done.wait();
+    th.join();
+    REQUIRE(*result == 14);
+  }
+}
+
+TEST_CASE("future states are recycled") {
+  auto round_trip = [](int i) {
+    arpc::promise<int> p;
+    auto f = p.get_future().then([](int x) { return x + 1; });
+    p.set_value(i);
+    return f.get();
+  };
+
+  // Fill this thread's free list.
+  round_trip(0);
+
+  int sum = 0;
+  auto allocations_before = num_allocations;
+  for (int i = 0; i < 1000; i++) sum += round_trip(i);
+  auto allocations = num_allocations - allocations_before;
+
+  REQUIRE(sum == 1000 * 1001 / 2);
+  REQUIRE(allocations == 0);
+}
+
+TEST_CASE("recycled future states hold no descriptors") {
+  // The lowest free descriptor number changes if any state holds one.
+  auto lowest_free_fd = []() {
+    int fd = ::dup(0);
+    ::close(fd);
+    return fd;
+  };
+  int before = lowest_free_fd();
+  for (int i = 0; i < 10; i++) {
+    arpc::promise<int> p;
+    auto f = p.get_future();
+    // Polling the future creates its flag's descriptor.
+    auto [got, timed_out] = arpc::select(
+        f.can_get(), arpc::timeout(std::chrono::nanoseconds(0)));
+    REQUIRE(timed_out);
+    p.set_value(i);
+    REQUIRE(f.get() == i);
+  }
+  REQUIRE(lowest_free_fd() == before);
+}
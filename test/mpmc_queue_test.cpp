@@ -0,0 +1,116 @@
+/// \file
+/// \brief Test for the `arpc/mpmc_queue.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/mpmc_queue.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include "arpc/context.h"
+#include "arpc/errors.h"
+#include "arpc/select.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+#include "catch2/catch.hpp"
+
+TEST_CASE("mpmc queue operations") {
+  arpc::mpmc_queue<std::unique_ptr<int>> q(2);
+  SECTION("with an empty queue") {
+    REQUIRE(q.empty());
+    REQUIRE(q.size() == 0);
+    SECTION("try_get returns nothing") { REQUIRE(!q.try_get()); }
+    SECTION("maybe_get throws") {
+      REQUIRE_THROWS_AS(q.maybe_get(), arpc::errors::try_again);
+    }
+    SECTION("can_put triggers") {
+      auto [res] = arpc::select(q.can_put());
+      REQUIRE(res);
+    }
+    SECTION("and a timeout get times out") {
+      arpc::context ctx;
+      ctx.set_timeout(std::chrono::milliseconds(10));
+      REQUIRE_THROWS_AS(q.get(), arpc::errors::deadline_exceeded);
+    }
+    SECTION("putting from a different thread lets us progress") {
+      arpc::thread th([&q]() {
+        arpc::wait(arpc::timeout(std::chrono::milliseconds(100)));
+        q.put(std::make_unique<int>(1));
+      });
+      REQUIRE(*q.get() == 1);
+      th.join();
+      REQUIRE(q.empty());
+    }
+  }
+  SECTION("with a full queue") {
+    q.put(std::make_unique<int>(1));
+    q.put(std::make_unique<int>(2));
+    REQUIRE(q.full());
+    REQUIRE(q.size() == 2);
+    SECTION("try_put doesn't move from its argument") {
+      auto item = std::make_unique<int>(3);
+      REQUIRE(!q.try_put(std::move(item)));
+      REQUIRE(item);
+    }
+    SECTION("can_get triggers") {
+      auto [res] = arpc::select(q.can_get());
+      REQUIRE(res);
+    }
+    SECTION("and a timeout put times out") {
+      arpc::context ctx;
+      ctx.set_timeout(std::chrono::milliseconds(10));
+      REQUIRE_THROWS_AS(q.put(std::make_unique<int>(3)),
+                        arpc::errors::deadline_exceeded);
+    }
+    SECTION("items come out in order and make room again") {
+      REQUIRE(*q.get() == 1);
+      auto [res] = arpc::select(q.async_put(std::make_unique<int>(3)));
+      REQUIRE(res);
+      REQUIRE(q.full());
+      REQUIRE(*q.get() == 2);
+      REQUIRE(*q.get() == 3);
+      REQUIRE(q.empty());
+    }
+  }
+}
+
+TEST_CASE("mpmc queue under contention") {
+  constexpr int num_threads = 4;
+  constexpr int num_iterations = 2000;
+  arpc::mpmc_queue<int> q(3);
+  std::atomic<int> sum = 0;
+
+  std::vector<arpc::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&q, &sum, i]() {
+      for (int j = 0; j < num_iterations; j++) {
+        if (i % 2) {
+          q.put(j);
+        } else {
+          sum += q.get();
+        }
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+
+  REQUIRE(q.empty());
+  REQUIRE(sum == num_threads / 2 * num_iterations * (num_iterations - 1) / 2);
+}
@@ -22,6 +22,7 @@
 #include "arpc/mutex.h"
 #include <chrono>
 #include <mutex>
+#include <vector>
 #include "arpc/awaitable.h"
 #include "arpc/context.h"
 #include "arpc/errors.h"
@@ -112,3 +113,24 @@ TEST_CASE("mutex locking") {
     }
   }
 }
+
+TEST_CASE("mutex under contention") {
+  constexpr int num_threads = 4;
+  constexpr int num_iterations = 10000;
+  arpc::mutex mu;
+  int counter = 0;
+
+  std::vector<arpc::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&mu, &counter]() {
+      for (int j = 0; j < num_iterations; j++) {
+        std::scoped_lock lock(mu);
+        counter++;
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+
+  REQUIRE(counter == num_threads * num_iterations);
+  REQUIRE(mu.try_lock());
+}
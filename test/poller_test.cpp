@@ -0,0 +1,110 @@
+/// \file
+/// \brief Test for the `arpc/poller.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/poller.h"
+#include <chrono>
+#include "arpc/awaitable.h"
+#include "arpc/channel.h"
+#include "arpc/pipe.h"
+#include "arpc/select.h"
+#include "catch2/catch.hpp"
+
+TEST_CASE("poller readiness") {
+  arpc::poller p;
+  arpc::channel fds[2];
+  arpc::pipe(fds);
+  fds[0].make_non_blocking();
+  fds[1].make_non_blocking();
+
+  pollfd pfds[] = {{fds[0].get(), POLLIN, 0}, {fds[1].get(), POLLOUT, 0}};
+
+  SECTION("only writable when the pipe is empty") {
+    REQUIRE(p.poll(pfds, 2, std::chrono::nanoseconds::zero()) == 1);
+    REQUIRE(pfds[0].revents == 0);
+    REQUIRE(pfds[1].revents & POLLOUT);
+  }
+  SECTION("readable after a write, across calls") {
+    REQUIRE(p.poll(pfds, 2, std::chrono::nanoseconds::zero()) == 1);
+    fds[1].write("*", 1);
+    REQUIRE(p.poll(pfds, 2, std::chrono::nanoseconds::zero()) == 2);
+    REQUIRE(pfds[0].revents & POLLIN);
+    char c;
+    fds[0].read(&c, 1);
+    REQUIRE(p.poll(pfds, 1, std::chrono::nanoseconds::zero()) == 0);
+  }
+  SECTION("entries sharing a descriptor get their own events") {
+    pollfd same[] = {{fds[1].get(), POLLIN, 0}, {fds[1].get(), POLLOUT, 0}};
+    REQUIRE(p.poll(same, 2, std::chrono::nanoseconds::zero()) == 1);
+    REQUIRE(same[0].revents == 0);
+    REQUIRE(same[1].revents & POLLOUT);
+  }
+  SECTION("negative descriptors are ignored") {
+    pollfd none[] = {{-1, POLLIN, 0}};
+    REQUIRE(p.poll(none, 1, std::chrono::nanoseconds::zero()) == 0);
+  }
+  SECTION("reused descriptor numbers get registered again") {
+    REQUIRE(p.poll(pfds, 1, std::chrono::nanoseconds::zero()) == 0);
+    int old_fd = fds[0].get();
+    fds[0].close();
+    fds[1].close();
+    arpc::pipe(fds);
+    REQUIRE(fds[0].get() == old_fd);
+    fds[1].write("*", 1);
+    REQUIRE(p.poll(pfds, 1, std::chrono::nanoseconds::zero()) == 1);
+    REQUIRE(pfds[0].revents & POLLIN);
+  }
+}
+
+TEST_CASE("select through the poller") {
+  arpc::channel fds[2];
+  arpc::pipe(fds);
+  fds[0].make_non_blocking();
+  fds[1].make_non_blocking();
+
+  SECTION("times out when nothing is ready") {
+    auto [readable, timed_out] = arpc::select(
+        fds[0].can_read(), arpc::timeout(std::chrono::milliseconds(10)));
+    REQUIRE(!readable);
+    REQUIRE(timed_out);
+  }
+  SECTION("nested selects keep the outer interest set") {
+    auto [readable] = arpc::select(fds[1].can_write().then([&fds]() {
+      auto [inner] = arpc::select(fds[1].can_write());
+      REQUIRE(inner);
+      return fds[1].write("*", 1);
+    }));
+    REQUIRE(*readable == 1);
+    auto [now_readable] = arpc::select(fds[0].can_read());
+    REQUIRE(now_readable);
+  }
+}
+
+TEST_CASE("select honours sub-millisecond timeouts") {
+  constexpr int num_waits = 20;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_waits; i++) {
+    auto [res] = arpc::select(arpc::timeout(std::chrono::microseconds(200)));
+    REQUIRE(res);
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  // No upper bound: a loaded machine can oversleep by any amount.
+  REQUIRE(elapsed >= num_waits * std::chrono::microseconds(200));
+}
@@ -0,0 +1,186 @@
+/// \file
+/// \brief Test for the `arpc/reactor.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/reactor.h"
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include "arpc/awaitable.h"
+#include "arpc/channel.h"
+#include "arpc/errors.h"
+#include "arpc/flag.h"
+#include "arpc/pipe.h"
+#include "arpc/select.h"
+#include "catch2/catch.hpp"
+
+namespace {
+// Dispatch once if the reactor becomes ready within a few milliseconds.
+bool dispatch(arpc::reactor& r) {
+  auto [dispatched, timed_out] =
+      arpc::select(r.async_dispatch(),
+                   arpc::timeout(std::chrono::milliseconds(5)));
+  if (dispatched) *dispatched;
+  return !!dispatched;
+}
+}  // namespace
+
+TEST_CASE("reactor dispatch") {
+  arpc::reactor r;
+  arpc::channel fds[2];
+  arpc::pipe(fds);
+  fds[0].make_non_blocking();
+  fds[1].make_non_blocking();
+  int calls = 0;
+
+  SECTION("armed awaitables are called once when ready") {
+    r.arm(fds[0].can_read().then([&calls]() { calls++; }));
+    REQUIRE(r.size() == 1);
+    REQUIRE(!dispatch(r));
+    fds[1].write("*", 1);
+    REQUIRE(dispatch(r));
+    REQUIRE(calls == 1);
+    REQUIRE(r.size() == 0);
+    REQUIRE(!dispatch(r));
+    REQUIRE(calls == 1);
+  }
+  SECTION("readers and writers of a descriptor fire separately") {
+    int writes = 0;
+    r.arm(fds[1].can_read().then([&calls]() { calls++; }));
+    r.arm(fds[1].can_write().then([&writes]() { writes++; }));
+    REQUIRE(dispatch(r));
+    REQUIRE(writes == 1);
+    REQUIRE(calls == 0);
+    REQUIRE(r.size() == 1);
+  }
+  SECTION("re-arming from the react function keeps waiting") {
+    char c;
+    std::function<void()> rearm = [&]() {
+      r.arm(fds[0].can_read().then([&]() {
+        fds[0].read(&c, 1);
+        calls++;
+        rearm();
+      }));
+    };
+    rearm();
+    for (int i = 1; i <= 3; i++) {
+      fds[1].write("*", 1);
+      REQUIRE(dispatch(r));
+      REQUIRE(calls == i);
+    }
+    REQUIRE(r.size() == 1);
+  }
+  SECTION("awaitables already ready in user space are called") {
+    arpc::flag f;
+    f.set();
+    r.arm(f.async_wait().then([&calls]() { calls++; }));
+    r.arm(arpc::always().then([&calls]() { calls++; }));
+    REQUIRE(dispatch(r));
+    REQUIRE(calls == 2);
+  }
+  SECTION("spurious readiness arms the awaitable again") {
+    bool ready = false;
+    r.arm(fds[1]
+              .can_write()
+              .ready_when([&ready]() { return ready; })
+              .then([&calls]() { calls++; }));
+    dispatch(r);
+    REQUIRE(calls == 0);
+    REQUIRE(r.size() == 1);
+    ready = true;
+    REQUIRE(dispatch(r));
+    REQUIRE(calls == 1);
+  }
+  SECTION("errors are rethrown after calling everything") {
+    r.arm(arpc::always().then([]() { throw std::runtime_error("boom"); }));
+    r.arm(arpc::always().then([&calls]() { calls++; }));
+    REQUIRE_THROWS_AS(dispatch(r), std::runtime_error);
+    REQUIRE(calls == 1);
+  }
+  SECTION("timeouts aren't supported") {
+    REQUIRE_THROWS_AS(r.arm(arpc::timeout(std::chrono::milliseconds(1))),
+                      arpc::errors::invalid_argument);
+  }
+  SECTION("disarmed awaitables aren't called") {
+    auto reader = r.arm(fds[0].can_read().then([&calls]() { calls++; }));
+    auto immediate = r.arm(arpc::always().then([&calls]() { calls++; }));
+    REQUIRE(r.size() == 2);
+    REQUIRE(r.disarm(reader));
+    REQUIRE(r.disarm(immediate));
+    REQUIRE(!r.disarm(reader));
+    REQUIRE(r.size() == 0);
+    fds[1].write("*", 1);
+    REQUIRE(!dispatch(r));
+    REQUIRE(calls == 0);
+  }
+  SECTION("awaitables armed again keep their key") {
+    bool ready = false;
+    auto k = r.arm(fds[1]
+                       .can_write()
+                       .ready_when([&ready]() { return ready; })
+                       .then([&calls]() { calls++; }));
+    dispatch(r);
+    REQUIRE(r.disarm(k));
+    ready = true;
+    dispatch(r);
+    REQUIRE(calls == 0);
+  }
+  SECTION("awaitables moved when armed again keep their key") {
+    // Armed as immediate while ready, then watched on its descriptor once
+    // the ready function turns false.
+    bool ready = true;
+    auto k = r.arm(fds[0]
+                       .can_read()
+                       .ready_when([&ready]() { return ready; })
+                       .then([&calls]() { calls++; }));
+    ready = false;
+    REQUIRE(dispatch(r));
+    REQUIRE(r.size() == 1);
+    REQUIRE(r.disarm(k));
+    REQUIRE(r.size() == 0);
+    ready = true;
+    fds[1].write("*", 1);
+    REQUIRE(!dispatch(r));
+    REQUIRE(calls == 0);
+  }
+  SECTION("awaitables armed again after try_again keep their key") {
+    int tries = 0;
+    auto k = r.arm(arpc::always().then([&tries]() {
+      tries++;
+      throw arpc::errors::try_again("Not yet");
+    }));
+    REQUIRE(dispatch(r));
+    REQUIRE(tries == 1);
+    REQUIRE(r.size() == 1);
+    REQUIRE(r.disarm(k));
+    REQUIRE(r.size() == 0);
+    REQUIRE(!dispatch(r));
+    REQUIRE(tries == 1);
+  }
+  SECTION("clearing drops everything") {
+    fds[1].write("*", 1);
+    r.arm(fds[0].can_read().then([&calls]() { calls++; }));
+    r.arm(arpc::always().then([&calls]() { calls++; }));
+    r.clear();
+    REQUIRE(r.size() == 0);
+    REQUIRE(!dispatch(r));
+    REQUIRE(calls == 0);
+  }
+}
@@ -0,0 +1,80 @@
+/// \file
+/// \brief Test for the `arpc/request_scheduler.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/request_scheduler.h"
+#include <chrono>
+#include <vector>
+#include "arpc/clock.h"
+#include "catch2/catch.hpp"
+
+TEST_CASE("request scheduler ordering") {
+  arpc::request_scheduler scheduler;
+  std::vector<int> order;
+  auto now = arpc::deadline_clock::now();
+
+  SECTION("an empty scheduler runs nothing") {
+    REQUIRE(scheduler.empty());
+    REQUIRE(!scheduler.run_next());
+  }
+
+  SECTION("without deadlines or priorities functions run in FIFO order") {
+    for (int i = 0; i < 3; i++) {
+      scheduler.push([&order, i]() { order.push_back(i); });
+    }
+    REQUIRE(scheduler.size() == 3);
+    while (scheduler.run_next()) {
+    }
+    REQUIRE(order == std::vector<int>{0, 1, 2});
+  }
+
+  SECTION("earlier deadlines run first, and no deadline runs last") {
+    scheduler.push([&order]() { order.push_back(0); });
+    scheduler.push([&order]() { order.push_back(1); }, 0,
+                   now + std::chrono::seconds(2));
+    scheduler.push([&order]() { order.push_back(2); }, 0,
+                   now + std::chrono::seconds(1));
+    while (scheduler.run_next()) {
+    }
+    REQUIRE(order == std::vector<int>{2, 1, 0});
+  }
+
+  SECTION("higher priorities run first regardless of deadlines") {
+    scheduler.push([&order]() { order.push_back(0); }, 0,
+                   now + std::chrono::seconds(1));
+    scheduler.push([&order]() { order.push_back(1); }, 1);
+    scheduler.push([&order]() { order.push_back(2); }, 1,
+                   now + std::chrono::seconds(2));
+    while (scheduler.run_next()) {
+    }
+    REQUIRE(order == std::vector<int>{2, 1, 0});
+  }
+
+  SECTION("functions can push more functions") {
+    scheduler.push([&]() {
+      order.push_back(0);
+      scheduler.push([&order]() { order.push_back(1); });
+    });
+    while (scheduler.run_next()) {
+    }
+    REQUIRE(order == std::vector<int>{0, 1});
+    REQUIRE(scheduler.empty());
+  }
+}
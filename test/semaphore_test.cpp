@@ -0,0 +1,106 @@
+/// \file
+/// \brief Test for the `arpc/semaphore.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+
+#include "arpc/semaphore.h"
+#include <chrono>
+#include <vector>
+#include "arpc/context.h"
+#include "arpc/errors.h"
+#include "arpc/select.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+#include "catch2/catch.hpp"
+
+TEST_CASE("semaphore counting") {
+  arpc::semaphore sem(2);
+  SECTION("with an empty semaphore") {
+    REQUIRE(sem.empty());
+    REQUIRE(sem.size() == 0);
+    SECTION("maybe_get throws") {
+      REQUIRE_THROWS_AS(sem.maybe_get(), arpc::errors::try_again);
+    }
+    SECTION("can_put triggers") {
+      auto [res] = arpc::select(sem.can_put());
+      REQUIRE(res);
+    }
+    SECTION("and a timeout get times out") {
+      arpc::context ctx;
+      ctx.set_timeout(std::chrono::milliseconds(10));
+      REQUIRE_THROWS_AS(sem.get(), arpc::errors::deadline_exceeded);
+    }
+    SECTION("putting from a different thread lets us progress") {
+      arpc::thread th([&sem]() {
+        arpc::wait(arpc::timeout(std::chrono::milliseconds(100)));
+        sem.put();
+      });
+      REQUIRE_NOTHROW(sem.get());
+      th.join();
+      REQUIRE(sem.empty());
+    }
+  }
+  SECTION("with a full semaphore") {
+    sem.put();
+    sem.put();
+    REQUIRE(sem.full());
+    REQUIRE(sem.size() == 2);
+    SECTION("maybe_put throws") {
+      REQUIRE_THROWS_AS(sem.maybe_put(), arpc::errors::try_again);
+    }
+    SECTION("can_get triggers") {
+      auto [res] = arpc::select(sem.can_get());
+      REQUIRE(res);
+    }
+    SECTION("and a timeout put times out") {
+      arpc::context ctx;
+      ctx.set_timeout(std::chrono::milliseconds(10));
+      REQUIRE_THROWS_AS(sem.put(), arpc::errors::deadline_exceeded);
+    }
+    SECTION("getting makes room again") {
+      sem.get();
+      auto [res] = arpc::select(sem.async_put());
+      REQUIRE(res);
+      REQUIRE(sem.full());
+    }
+  }
+}
+
+TEST_CASE("semaphore under contention") {
+  constexpr int num_threads = 4;
+  constexpr int num_iterations = 2000;
+  arpc::semaphore sem(1);
+
+  std::vector<arpc::thread> threads;
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&sem, i]() {
+      for (int j = 0; j < num_iterations; j++) {
+        if (i % 2) {
+          sem.put();
+        } else {
+          sem.get();
+        }
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+
+  REQUIRE(sem.empty());
+}
@@ -0,0 +1,127 @@
+/// \file
+/// \brief Test for the `arpc/server.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/server.h"
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "arpc/client.h"
+#include "arpc/errors.h"
+#include "arpc/interface.h"
+#include "catch2/catch.hpp"
+
+namespace {
+
+ARPC_INTERFACE(Slow, (/* doesn't extend other interfaces */),
+               (  // Block the thread running it for some milliseconds.
+                   ((void), block, (((int), ms))),
+                   // Add to the count of calls that ran.
+                   ((void), count, (((int), n)))));
+
+struct SlowImpl : Slow {
+  void block(int ms) override {
+    // Not deadline-aware, so it holds up its thread for the whole time.
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+  }
+  void count(int n) override { num_counted += n; }
+
+  std::atomic<int> num_counted = 0;
+};
+
+}  // namespace
+
+TEST_CASE("requests expired while queued don't run") {
+  // Handlers run on a single fiber thread, so one blocked handler holds up
+  // the rest in the queue, while the worker threads keep receiving requests.
+  arpc::server_options options;
+  options.request_timeout = std::chrono::milliseconds(100);
+  options.num_worker_threads = 2;
+  options.num_fiber_threads = 1;
+  arpc::server_object<SlowImpl> slow;
+  arpc::server server(options, arpc::endpoint().port(9989));
+  server.register_object("slow", slow);
+  server.start();
+
+  arpc::client_connection client(arpc::endpoint().name("localhost").port(9989));
+  auto slow_proxy = client.get_proxy<Slow::async>("slow");
+
+  auto blocked = slow_proxy.block(300).first;
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  auto counted = slow_proxy.count(1).first;
+
+  REQUIRE_THROWS_AS(counted.get(), arpc::errors::deadline_exceeded);
+  REQUIRE_NOTHROW(blocked.get());
+  REQUIRE(slow.num_counted == 0);
+}
+
+TEST_CASE("adaptive workers serve requests while others block") {
+  // A single worker to begin with, which the blocked handler holds up, so
+  // the other request only runs on a worker added meanwhile.
+  arpc::server_options options;
+  options.adaptive_workers.emplace();
+  options.adaptive_workers->min_threads = 1;
+  options.adaptive_workers->max_threads = 4;
+  arpc::server_object<SlowImpl> slow;
+  arpc::server server(options, arpc::endpoint().port(9990));
+  server.register_object("slow", slow);
+  server.start();
+
+  arpc::client_connection client(arpc::endpoint().name("localhost").port(9990));
+  auto slow_proxy = client.get_proxy<Slow::async>("slow");
+
+  auto blocked = slow_proxy.block(1000).first;
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE_NOTHROW(slow_proxy.count(1).first.get());
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  REQUIRE(elapsed < std::chrono::milliseconds(500));
+  REQUIRE(slow.num_counted == 1);
+  REQUIRE_NOTHROW(blocked.get());
+}
+
+TEST_CASE("adaptive workers with a bounded queue don't deadlock") {
+  // Requests are queued from the workers receiving them, which block while
+  // the queue is full until workers finishing other requests drain it.
+  arpc::server_options options;
+  options.adaptive_workers.emplace();
+  options.adaptive_workers->min_threads = 1;
+  options.adaptive_workers->max_threads = 2;
+  options.queue_size = 1;
+  arpc::server_object<SlowImpl> slow;
+  arpc::server server(options, arpc::endpoint().port(9991));
+  server.register_object("slow", slow);
+  server.start();
+
+  arpc::client_connection client(arpc::endpoint().name("localhost").port(9991));
+  auto slow_proxy = client.get_proxy<Slow::async>("slow");
+
+  constexpr int num_calls = 20;
+  std::vector<arpc::future<void>> calls;
+  for (int i = 0; i < num_calls; i++) {
+    calls.push_back(slow_proxy.block(10).first);
+    calls.push_back(slow_proxy.count(1).first);
+  }
+  arpc::context ctx;
+  ctx.set_timeout(std::chrono::seconds(10));
+  for (auto& call : calls) REQUIRE_NOTHROW(call.get());
+  REQUIRE(slow.num_counted == num_calls);
+}
@@ -0,0 +1,104 @@
+/// \file
+/// \brief Test for the `arpc/timer_wheel.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+
+#include "arpc/timer_wheel.h"
+#include <chrono>
+#include <vector>
+#include "catch2/catch.hpp"
+
+namespace {
+using wheel_type = arpc::timer_wheel<int>;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+std::vector<int> expire(wheel_type& wheel, wheel_type::time_point now) {
+  std::vector<int> res;
+  wheel.expire(now, [&res](int v) { res.push_back(v); });
+  return res;
+}
+}  // namespace
+
+TEST_CASE("timer wheel") {
+  const wheel_type::time_point origin{};
+  wheel_type wheel(microseconds(100), origin);
+  REQUIRE(wheel.empty());
+  REQUIRE(!wheel.next_expiry());
+
+  SECTION("timers expire in order and not early") {
+    wheel.add(origin + milliseconds(5), 2);
+    wheel.add(origin + microseconds(150), 1);
+    wheel.add(origin + std::chrono::hours(40), 4);
+    wheel.add(origin + std::chrono::seconds(7), 3);
+    REQUIRE(wheel.size() == 4);
+    REQUIRE(*wheel.next_expiry() == origin + microseconds(200));
+
+    REQUIRE(expire(wheel, origin + microseconds(100)).empty());
+    REQUIRE(expire(wheel, origin + microseconds(200)) == std::vector<int>{1});
+    REQUIRE(*wheel.next_expiry() == origin + milliseconds(5));
+    REQUIRE(expire(wheel, origin + milliseconds(4)).empty());
+    REQUIRE(expire(wheel, origin + milliseconds(5)) == std::vector<int>{2});
+    REQUIRE(*wheel.next_expiry() == origin + std::chrono::seconds(7));
+    REQUIRE(expire(wheel, origin + std::chrono::seconds(10)) ==
+            std::vector<int>{3});
+    REQUIRE(*wheel.next_expiry() == origin + std::chrono::hours(40));
+    REQUIRE(expire(wheel, origin + std::chrono::hours(41)) ==
+            std::vector<int>{4});
+    REQUIRE(wheel.empty());
+  }
+
+  SECTION("timers in the past expire right away") {
+    REQUIRE(expire(wheel, origin + milliseconds(10)).empty());
+    wheel.add(origin + milliseconds(1), 1);
+    REQUIRE(*wheel.next_expiry() <= origin + milliseconds(10));
+    REQUIRE(expire(wheel, origin + milliseconds(10)) == std::vector<int>{1});
+  }
+
+  SECTION("timers can be removed") {
+    wheel.add(origin + milliseconds(1), 1);
+    wheel.add(origin + milliseconds(1), 2);
+    wheel.add(origin + std::chrono::seconds(1), 3);
+    REQUIRE(expire(wheel, origin + milliseconds(500)) ==
+            std::vector<int>{1, 2});
+    wheel.add(origin + std::chrono::seconds(2), 4);
+    REQUIRE(wheel.remove(origin + std::chrono::seconds(1), 3));
+    REQUIRE(!wheel.remove(origin + std::chrono::seconds(1), 3));
+    REQUIRE(!wheel.remove(origin + milliseconds(1), 1));
+    REQUIRE(wheel.size() == 1);
+    REQUIRE(*wheel.next_expiry() == origin + std::chrono::seconds(2));
+  }
+
+  SECTION("many timers cascade correctly") {
+    constexpr int num_timers = 10000;
+    for (int i = num_timers - 1; i >= 0; i--) {
+      wheel.add(origin + microseconds(100) * i * 37, i);
+    }
+    std::vector<int> expired;
+    for (auto now = origin; !wheel.empty(); now += milliseconds(13)) {
+      for (auto v : expire(wheel, now)) {
+        REQUIRE(origin + microseconds(100) * v * 37 <= now);
+        expired.push_back(v);
+      }
+    }
+    REQUIRE(expired.size() == num_timers);
+    for (int i = 0; i < num_timers; i++) REQUIRE(expired[i] == i);
+  }
+}
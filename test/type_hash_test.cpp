@@ -34,6 +34,7 @@
 #include <vector>
 #include "arpc/container/flat_map.h"
 #include "arpc/container/flat_set.h"
+#include "arpc/future.h"
 #include "arpc/serializable.h"
 #include "arpc/testing/static_checks.h"
 #include "catch2/catch.hpp"
@@ -217,3 +218,9 @@ TEST_CASE("type cycle hashing") {
   check_type_hash<I, 794330892>();
   check_type_hash<J, 794330892>();
 }
+
+TEST_CASE("future type hashing") {
+  check_type_hash<arpc::future<bool>, arpc::traits::type_hash_v<bool>>();
+  check_type_hash<arpc::future<void>, arpc::traits::type_hash_v<void>>();
+  check_type_hash<arpc::future<bool>(char), 2234233700>();
+}
@@ -0,0 +1,143 @@
+/// \file
+/// \brief Test for the `arpc/uring.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/uring.h"
+#include <chrono>
+#include <string>
+#include "arpc/address.h"
+#include "arpc/address_resolver.h"
+#include "arpc/channel.h"
+#include "arpc/errors.h"
+#include "arpc/pipe.h"
+#include "arpc/select.h"
+#include "arpc/socket.h"
+#include "arpc/thread.h"
+#include "arpc/wait.h"
+#include "catch2/catch.hpp"
+
+namespace {
+struct use_uring {
+  use_uring() : enabled(arpc::uring::enable()) {}
+  ~use_uring() { arpc::uring::enable(false); }
+
+  const bool enabled;
+};
+}  // namespace
+
+TEST_CASE("uring channel reads") {
+  use_uring u;
+  if (!u.enabled) {
+    WARN("io_uring is not available; only the fallback was tested");
+  }
+
+  arpc::channel fds[2];
+  arpc::pipe(fds);
+  fds[0].make_non_blocking();
+  fds[1].make_non_blocking();
+  char buf[16];
+
+  SECTION("data already there is read") {
+    fds[1].write("abc", 3);
+    REQUIRE(fds[0].read(buf, sizeof(buf)) == 3);
+    REQUIRE(std::string(buf, 3) == "abc");
+  }
+  SECTION("a pending read completes when data arrives") {
+    arpc::thread th([&fds]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      fds[1].write("xy", 2);
+    });
+    REQUIRE(fds[0].read(buf, sizeof(buf)) == 2);
+    th.join();
+    REQUIRE(std::string(buf, 2) == "xy");
+  }
+  SECTION("end of channel is reported") {
+    fds[1].close();
+    REQUIRE_THROWS_AS(fds[0].read(buf, sizeof(buf)), arpc::errors::eof);
+  }
+  SECTION("a timed out read doesn't lose later data") {
+    auto [num, timed_out] =
+        arpc::select(fds[0].async_read(buf, sizeof(buf)),
+                     arpc::timeout(std::chrono::milliseconds(5)));
+    REQUIRE(!num);
+    REQUIRE(timed_out);
+    fds[1].write("later", 5);
+    REQUIRE(fds[0].read(buf, sizeof(buf)) == 5);
+    REQUIRE(std::string(buf, 5) == "later");
+  }
+  SECTION("data read for a dropped awaitable goes to the next read") {
+    {
+      auto pending = fds[0].async_read(buf, sizeof(buf));
+      auto [num, timed_out] = arpc::select(
+          pending, arpc::timeout(std::chrono::milliseconds(5)));
+      REQUIRE(!num);
+      fds[1].write("kept", 4);
+      // Give the kernel a chance to complete the read.
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(5)));
+    }
+    char other[16];
+    REQUIRE(fds[0].read(other, sizeof(other)) == 4);
+    REQUIRE(std::string(other, 4) == "kept");
+  }
+  SECTION("writes go through") {
+    REQUIRE(fds[1].write("w", 1) == 1);
+    REQUIRE(fds[0].read(buf, sizeof(buf)) == 1);
+  }
+}
+
+TEST_CASE("uring accepts") {
+  use_uring u;
+
+  auto addr_list = arpc::address_resolver::get().resolve(
+      arpc::endpoint().name("127.0.0.1").port(0).passive());
+  REQUIRE(!addr_list.empty());
+  auto listening = arpc::socket(*addr_list.begin());
+  listening.make_non_blocking().bind(*addr_list.begin()).listen();
+  auto listening_addr = listening.own_addr();
+
+  SECTION("a pending accept completes when a client connects") {
+    arpc::thread th([&listening_addr]() {
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(10)));
+      auto client = arpc::socket(listening_addr);
+      client.connect(listening_addr);
+      client.write("!", 1);
+    });
+    arpc::address peer;
+    auto accepted = listening.accept(peer);
+    REQUIRE(accepted);
+    REQUIRE(peer.address_data()->sa_family == AF_INET);
+    char c;
+    REQUIRE(accepted.read(&c, 1) == 1);
+    th.join();
+    REQUIRE(c == '!');
+  }
+  SECTION("connections accepted for a dropped awaitable aren't lost") {
+    auto client = arpc::socket(listening_addr);
+    {
+      auto pending = listening.async_accept();
+      auto [accepted, timed_out] = arpc::select(
+          pending, arpc::timeout(std::chrono::milliseconds(5)));
+      REQUIRE(!accepted);
+      client.connect(listening_addr);
+      arpc::wait(arpc::timeout(std::chrono::milliseconds(5)));
+    }
+    REQUIRE(listening.accept());
+  }
+}
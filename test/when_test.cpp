@@ -0,0 +1,123 @@
+/// \file
+/// \brief Test for the `arpc/when.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/when.h"
+#include <chrono>
+#include <string>
+#include <vector>
+#include "arpc/context.h"
+#include "arpc/errors.h"
+#include "arpc/future.h"
+#include "arpc/thread.h"
+#include "catch2/catch.hpp"
+
+namespace {
+std::vector<arpc::future<int>> futures_of(std::vector<arpc::promise<int>>& p) {
+  std::vector<arpc::future<int>> f;
+  for (auto& i : p) f.push_back(i.get_future());
+  return f;
+}
+}  // namespace
+
+TEST_CASE("when_all") {
+  SECTION("waits for all futures in a vector") {
+    std::vector<arpc::promise<int>> p(200);
+    auto all = arpc::when_all(futures_of(p));
+    arpc::thread th([&p]() {
+      for (int i = p.size() - 1; i >= 0; i--) p[i].set_value(i);
+    });
+    auto results = all.get();
+    th.join();
+    REQUIRE(results.size() == 200);
+    for (int i = 0; i < 200; i++) REQUIRE(*results[i] == i);
+  }
+  SECTION("reports each future's exception") {
+    std::vector<arpc::promise<int>> p(2);
+    auto all = arpc::when_all(futures_of(p));
+    p[0].set_exception(
+        std::make_exception_ptr(arpc::errors::data_mismatch("oops")));
+    p[1].set_value(1);
+    auto results = all.get();
+    REQUIRE_THROWS_AS(*results[0], arpc::errors::data_mismatch);
+    REQUIRE(*results[1] == 1);
+  }
+  SECTION("completes right away with no futures") {
+    auto results = arpc::when_all(std::vector<arpc::future<int>>()).get();
+    REQUIRE(results.empty());
+  }
+  SECTION("waits for futures of different types") {
+    arpc::promise<int> p1;
+    arpc::promise<std::string> p2;
+    arpc::promise<void> p3;
+    auto all =
+        arpc::when_all(p1.get_future(), p2.get_future(), p3.get_future());
+    p2.set_value("two");
+    p3.set_value();
+    p1.set_value(1);
+    auto [r1, r2, r3] = all.get();
+    REQUIRE(*r1 == 1);
+    REQUIRE(*r2 == "two");
+    REQUIRE_NOTHROW(*r3);
+  }
+  SECTION("honors the context's deadline") {
+    std::vector<arpc::promise<int>> p(2);
+    auto all = arpc::when_all(futures_of(p));
+    p[0].set_value(0);
+    arpc::context ctx;
+    ctx.set_timeout(std::chrono::milliseconds(10));
+    REQUIRE_THROWS_AS(all.get(), arpc::errors::deadline_exceeded);
+  }
+}
+
+TEST_CASE("when_any and when_n") {
+  std::vector<arpc::promise<int>> p(5);
+  SECTION("when_any returns the first future to complete") {
+    auto any = arpc::when_any(futures_of(p));
+    p[3].set_value(3);
+    p[1].set_value(1);
+    auto [index, result] = any.get();
+    REQUIRE(index == 3);
+    REQUIRE(*result == 3);
+  }
+  SECTION("when_n returns the first n futures to complete") {
+    auto some = arpc::when_n(2, futures_of(p));
+    p[4].set_value(4);
+    p[0].set_value(0);
+    p[2].set_value(2);
+    auto results = some.get();
+    REQUIRE(results.size() == 2);
+    REQUIRE(results[0].first == 4);
+    REQUIRE(*results[0].second == 4);
+    REQUIRE(results[1].first == 0);
+    REQUIRE(*results[1].second == 0);
+  }
+  SECTION("when_n rejects waiting for more futures than given") {
+    REQUIRE_THROWS_AS(arpc::when_n(6, futures_of(p)),
+                      arpc::errors::invalid_argument);
+  }
+  SECTION("when_any can be cancelled") {
+    auto any = arpc::when_any(futures_of(p));
+    arpc::context ctx;
+    arpc::thread th([&ctx]() { ctx.cancel(); });
+    REQUIRE_THROWS_AS(any.get(), arpc::errors::cancelled);
+    th.join();
+  }
+}
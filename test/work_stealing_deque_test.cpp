@@ -0,0 +1,89 @@
+/// \file
+/// \brief Test for the `arpc/work_stealing_deque.h` header.
+///
+/// \copyright
+///   Copyright 2019 by Google LLC.
+///
+/// \copyright
+///   Licensed under the Apache License, Version 2.0 (the "License"); you may
+///   not use this file except in compliance with the License. You may obtain a
+///   copy of the License at
+///
+/// \copyright
+///   http://www.apache.org/licenses/LICENSE-2.0
+///
+/// \copyright
+///   Unless required by applicable law or agreed to in writing, software
+///   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+///   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+///   License for the specific language governing permissions and limitations
+///   under the License.
+
+#include "arpc/work_stealing_deque.h"
+#include <atomic>
+#include <vector>
+#include "arpc/thread.h"
+#include "catch2/catch.hpp"
+
+TEST_CASE("work stealing deque") {
+  arpc::work_stealing_deque<int> d(4);
+  int items[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+
+  SECTION("empty deques return nothing") {
+    REQUIRE(d.empty());
+    REQUIRE(d.pop() == nullptr);
+    REQUIRE(d.steal() == nullptr);
+  }
+  SECTION("the owner pops in LIFO order and thieves steal in FIFO order") {
+    for (auto& i : items) d.push(&i);
+    REQUIRE(d.size() == 10);
+    REQUIRE(d.pop() == &items[9]);
+    REQUIRE(d.steal() == &items[0]);
+    REQUIRE(d.pop() == &items[8]);
+    REQUIRE(d.steal() == &items[1]);
+    REQUIRE(d.size() == 6);
+  }
+  SECTION("the last item goes to only one of the owner and a thief") {
+    d.push(&items[0]);
+    REQUIRE(d.steal() == &items[0]);
+    REQUIRE(d.pop() == nullptr);
+    d.push(&items[1]);
+    REQUIRE(d.pop() == &items[1]);
+    REQUIRE(d.steal() == nullptr);
+  }
+}
+
+TEST_CASE("work stealing deque under contention") {
+  constexpr int num_items = 100000;
+  constexpr int num_thieves = 3;
+  arpc::work_stealing_deque<int> d;
+  std::vector<int> items(num_items);
+  std::vector<std::atomic<int>> taken(num_items);
+  std::atomic<int> num_taken = 0;
+
+  auto take = [&](int* item) {
+    taken[item - items.data()]++;
+    num_taken++;
+  };
+
+  std::vector<arpc::thread> thieves;
+  for (int i = 0; i < num_thieves; i++) {
+    thieves.emplace_back([&]() {
+      while (num_taken < num_items) {
+        if (auto* item = d.steal()) take(item);
+      }
+    });
+  }
+  for (int i = 0; i < num_items; i++) {
+    d.push(&items[i]);
+    if (i % 3 == 0) {
+      if (auto* item = d.pop()) take(item);
+    }
+  }
+  while (num_taken < num_items) {
+    if (auto* item = d.pop()) take(item);
+  }
+  for (auto& th : thieves) th.join();
+
+  for (const auto& t : taken) REQUIRE(t == 1);
+}